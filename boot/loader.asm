@@ -180,8 +180,24 @@ p_mode_start:
 ;------------- 加载 kernel 的二进制文件到内存中 -------------
 	mov eax, KERNEL_START_SECTOR
 	mov ebx, KERNEL_BIN_BASE_ADDR
-	mov ecx, 200 ; 由于内核大小不会超过 100KB，因此直接读 100KB 出来避免未来重复修改
+	mov ecx, KERNEL_SECTS
+.load_kernel:
+	; rd_disk 会破坏 eax 和 ecx，ebx 则随读入的数据向后移动
+	push eax
+	push ecx
+	; 扇区数寄存器只有 8 位，一次最多读 255 个扇区，分多次读完
+	cmp ecx, 255
+	jbe .last_batch
+	mov ecx, 255
+.last_batch:
+	push ecx
 	call rd_disk
+	pop edx
+	pop ecx
+	pop eax
+	add eax, edx
+	sub ecx, edx
+	jnz .load_kernel
 
 ;------------- 开启分页 -------------
 ;开启分页的三步：
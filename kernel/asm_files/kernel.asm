@@ -50,13 +50,14 @@ syscall_handler:
 	push gs
 	pushad
 	push 0x80
-; 最多支持 3 个参数的系统调用
+; 最多支持 4 个参数的系统调用
+	push esi
 	push edx
 	push ecx
 	push ebx
 ; 调用子功能对应的处理函数
 	call [syscall_table + eax*4]
-	add esp, 12 ; 跳过上面的三个参数
+	add esp, 16 ; 跳过上面的四个参数
 
 ; 将返回值放置在栈中原 eax 的位置上，该值由 pushad 压入
 	mov [esp + 8*4], eax
@@ -80,7 +81,7 @@ VECTOR 0x0a, ZERO
 VECTOR 0x0b, ZERO
 VECTOR 0x0c, ZERO
 VECTOR 0x0d, ZERO
-VECTOR 0x0e, ZERO
+VECTOR 0x0e, ERROR_CODE ; 缺页异常由处理器压入错误码
 VECTOR 0x0f, ZERO
 VECTOR 0x10, ZERO
 VECTOR 0x11, ZERO
@@ -0,0 +1,561 @@
+#include "ahci.h"
+#include "pci.h"
+#include "stdio.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/* hba 全局寄存器 */
+#define HBA_CAP 0x00
+#define HBA_GHC 0x04
+#define HBA_IS  0x08
+#define HBA_PI  0x0c
+
+// GHC 寄存器：第 31 位打开 ahci 模式，第 1 位允许中断
+#define HBA_GHC_AE 0x80000000
+#define HBA_GHC_IE 0x2
+
+/* 端口寄存器，第 n 个端口的寄存器从 0x100 + n * 0x80 开始 */
+// hba 最多有 32 个端口
+#define HBA_PORT_CNT 32
+#define PORT_CLB  0x00
+#define PORT_CLBU 0x04
+#define PORT_FB   0x08
+#define PORT_FBU  0x0c
+#define PORT_IS   0x10
+#define PORT_IE   0x14
+#define PORT_CMD  0x18
+#define PORT_TFD  0x20
+#define PORT_SIG  0x24
+#define PORT_SSTS 0x28
+#define PORT_SERR 0x30
+#define PORT_SACT 0x34
+#define PORT_CI   0x38
+
+/* PxCMD 寄存器的一些关键位 */
+#define PORT_CMD_ST  0x1
+#define PORT_CMD_FRE 0x10
+#define PORT_CMD_FR  0x4000
+#define PORT_CMD_CR  0x8000
+
+/* PxIS 寄存器的一些关键位 */
+// 收到 D2H 寄存器 FIS，非队列命令完成
+#define PORT_IS_DHRS 0x1
+// 收到 PIO setup FIS
+#define PORT_IS_PSS  0x2
+// 收到 DMA setup FIS
+#define PORT_IS_DSS  0x4
+// 收到 set device bits FIS，NCQ 命令完成
+#define PORT_IS_SDBS 0x8
+// 命令出错
+#define PORT_IS_TFES 0x40000000
+
+// TFD 寄存器中的 BSY 和 DRQ 位
+#define PORT_TFD_BUSY 0x88
+
+// 端口上接的是 sata 硬盘时的签名
+#define SATA_SIG_ATA 0x00000101
+
+/* 一些 ata 命令 */
+#define ATA_CMD_IDENTIFY   0xec
+#define ATA_CMD_READ_DMA   0x25
+#define ATA_CMD_WRITE_DMA  0x35
+#define ATA_CMD_READ_FPDMA 0x60
+#define ATA_CMD_WRITE_FPDMA 0x61
+#define ATA_CMD_FLUSH_EXT  0xea
+
+// H2D 寄存器 FIS 的类型
+#define FIS_TYPE_REG_H2D 0x27
+
+// 每张命令表中的 PRDT 项数，64KB 的缓冲区跨越的物理页不会超过 17 个
+#define AHCI_PRDT_CNT 24
+// 命令表的大小，128 字节的表头加上 PRDT，需要 128 字节对齐
+#define AHCI_CMD_TBL_SIZE (0x80 + AHCI_PRDT_CNT * 16)
+#define AHCI_TBLS_PER_PAGE (PG_SIZE / AHCI_CMD_TBL_SIZE)
+
+// 等待端口状态变化时的轮询次数
+#define AHCI_SPIN_LIMIT 1000000
+
+/* 命令列表中的一项 */
+typedef struct {
+	// 0~4 位为命令 FIS 的双字数，第 6 位表示写，16~31 位为 PRDT 项数
+	uint32_t flags;
+	// 实际传输的字节数
+	uint32_t prdbc;
+	// 命令表的物理地址
+	uint32_t ctba;
+	uint32_t ctbau;
+	uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header;
+
+/* PRDT 中的一项，描述一段物理上连续的缓冲区 */
+typedef struct {
+	uint32_t dba;
+	uint32_t dbau;
+	uint32_t reserved;
+	// 0~21 位为字节数减 1，第 31 位表示完成后产生中断
+	uint32_t dbc;
+} __attribute__((packed)) ahci_prd;
+
+/* H2D 寄存器 FIS，用来向硬盘发命令 */
+typedef struct {
+	uint8_t fis_type;
+	// 第 7 位为 1 表示这是一条命令
+	uint8_t pm_c;
+	uint8_t command;
+	uint8_t feature_l;
+	uint8_t lba0;
+	uint8_t lba1;
+	uint8_t lba2;
+	uint8_t device;
+	uint8_t lba3;
+	uint8_t lba4;
+	uint8_t lba5;
+	uint8_t feature_h;
+	uint8_t count_l;
+	uint8_t count_h;
+	uint8_t icc;
+	uint8_t control;
+	uint8_t reserved[4];
+} __attribute__((packed)) fis_reg_h2d;
+
+/* 一个命令槽 */
+typedef struct {
+	// 占用此槽的请求，identify 等内部命令为 NULL
+	disk_req* req;
+	// 命令完成后由中断处理程序 sema_up
+	semaphore done;
+	// 命令是否出错
+	bool error;
+} ahci_slot;
+
+/* 一个 sata 端口，即一块硬盘 */
+typedef struct {
+	volatile uint8_t* regs;
+	// 命令列表，共 32 项，需要 1KB 对齐
+	ahci_cmd_header* cmd_list;
+	// 硬盘回送的 FIS 存放在这里，需要 256 字节对齐
+	uint8_t* fis;
+	uint8_t* cmd_tbls[AHCI_MAX_SLOTS];
+	// 被请求占用的槽
+	uint32_t busy;
+	// 已发出且未完成的槽，由中断处理程序清除
+	volatile uint32_t inflight;
+	// 可用的槽数，不支持 NCQ 时只能用 1 个
+	uint8_t slot_cnt;
+	bool ncq;
+	// 刷新写缓存时要占用全部的槽，同时只能有一个刷新者，否则各占一部分槽会互相等待
+	lock flush_lock;
+	ahci_slot slots[AHCI_MAX_SLOTS];
+} ahci_port;
+
+/* ahci 控制器 */
+typedef struct {
+	pci_device pdev;
+	volatile uint8_t* abar;
+	ahci_port* ports[AHCI_MAX_PORTS];
+	// 端口在 hba 中的编号
+	uint8_t port_no[AHCI_MAX_PORTS];
+	uint8_t port_cnt;
+} ahci_hba;
+
+// 当前只驱动一个 ahci 控制器
+static ahci_hba hba;
+static disk ahci_disks[AHCI_MAX_PORTS];
+
+#define hba_reg(off) (*(volatile uint32_t*)(hba.abar + (off)))
+#define port_reg(port, off) (*(volatile uint32_t*)((port)->regs + (off)))
+
+/*
+在 PRDT 中描述 vaddr 开始的 bytes 字节，返回项数
+缓冲区按页逐个转换为物理地址，物理上相邻的页合并为一项，各页须已由 disk_submit 映射好
+*/
+static uint16_t build_prdt(ahci_prd* prdt, void* vaddr, uint32_t bytes) {
+	ASSERT(bytes > 0);
+	uint32_t vaddr_cur = (uint32_t)vaddr;
+	uint16_t prd_cnt = 0;
+	while (bytes > 0) {
+		ASSERT(page_present(vaddr_cur));
+		uint32_t phy = addr_v2p(vaddr_cur);
+		uint32_t len = PG_SIZE - (vaddr_cur & 0x00000fff);
+		if (len > bytes) {
+			len = bytes;
+		}
+
+		ahci_prd* last = prd_cnt > 0 ? &prdt[prd_cnt - 1] : NULL;
+		if (last != NULL && last->dba + (last->dbc & 0x3fffff) + 1 == phy) {
+			last->dbc += len;
+		} else {
+			ASSERT(prd_cnt < AHCI_PRDT_CNT);
+			prdt[prd_cnt].dba = phy;
+			prdt[prd_cnt].dbau = 0;
+			prdt[prd_cnt].dbc = len - 1;
+			prd_cnt++;
+		}
+		vaddr_cur += len;
+		bytes -= len;
+	}
+	return prd_cnt;
+}
+
+/* 在 slot 号槽中组织一条命令并发出，sec_cnt 为 0 表示非读写命令 */
+static void ahci_issue(
+	ahci_port* port, uint8_t slot, uint8_t cmd,
+	uint32_t lba, uint32_t sec_cnt, void* buf, uint32_t bytes, bool is_write
+) {
+	uint8_t* tbl = port->cmd_tbls[slot];
+	memset(tbl, 0, AHCI_CMD_TBL_SIZE);
+
+	fis_reg_h2d* fis = (fis_reg_h2d*)tbl;
+	fis->fis_type = FIS_TYPE_REG_H2D;
+	fis->pm_c = 0x80;
+	fis->command = cmd;
+	fis->lba0 = lba;
+	fis->lba1 = lba >> 8;
+	fis->lba2 = lba >> 16;
+	fis->lba3 = lba >> 24;
+	if (cmd == ATA_CMD_READ_FPDMA || cmd == ATA_CMD_WRITE_FPDMA) {
+		// NCQ 命令的扇区数放在 feature 中，count 的 3~7 位为槽号
+		fis->feature_l = sec_cnt;
+		fis->feature_h = sec_cnt >> 8;
+		fis->count_l = slot << 3;
+		fis->device = 0x40;
+	} else if (sec_cnt != 0) {
+		fis->count_l = sec_cnt;
+		fis->count_h = sec_cnt >> 8;
+		fis->device = 0x40;
+	}
+
+	// 没有数据阶段的命令不需要 PRDT
+	ahci_prd* prdt = (ahci_prd*)(tbl + 0x80);
+	uint16_t prd_cnt = bytes > 0 ? build_prdt(prdt, buf, bytes) : 0;
+
+	ahci_cmd_header* hdr = &port->cmd_list[slot];
+	hdr->flags = (sizeof(fis_reg_h2d) / 4) | (is_write ? 0x40 : 0) | (prd_cnt << 16);
+	hdr->prdbc = 0;
+
+	port->slots[slot].error = 0;
+	intr_status old_status = intr_disable();
+	port->inflight |= 1 << slot;
+	// NCQ 命令要先在 SACT 中登记槽号再发出
+	if (port->ncq && sec_cnt != 0) {
+		port_reg(port, PORT_SACT) = 1 << slot;
+	}
+	port_reg(port, PORT_CI) = 1 << slot;
+	intr_set_status(old_status);
+}
+
+/* 把请求中下一段至多 AHCI_MAX_SECTS_PER_CMD 个扇区放到 slot 号槽中发出 */
+static void issue_chunk(ahci_port* port, uint8_t slot, disk_req* req) {
+	uint32_t secs_op = req->sec_cnt - req->secs_done;
+	if (secs_op > AHCI_MAX_SECTS_PER_CMD) {
+		secs_op = AHCI_MAX_SECTS_PER_CMD;
+	}
+	uint8_t cmd;
+	if (port->ncq) {
+		cmd = req->is_write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+	} else {
+		cmd = req->is_write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+	}
+	port->slots[slot].req = req;
+	ahci_issue(
+		port, slot, cmd, req->lba + req->secs_done, secs_op,
+		(void*)((uint32_t)req->buf + req->secs_done * 512), secs_op * 512, req->is_write
+	);
+	// ahci 驱动中 secs_done 记录的是已经发出的扇区数
+	req->secs_done += secs_op;
+}
+
+/* 尝试占用一个空闲的槽，没有时返回 -1 */
+static int8_t try_alloc_slot(ahci_port* port) {
+	int8_t slot = -1;
+	intr_status old_status = intr_disable();
+	uint8_t idx = 0;
+	while (idx < port->slot_cnt) {
+		if (!(port->busy & (1 << idx))) {
+			port->busy |= 1 << idx;
+			slot = idx;
+			break;
+		}
+		idx++;
+	}
+	intr_set_status(old_status);
+	return slot;
+}
+
+static uint8_t alloc_slot(ahci_port* port) {
+	int8_t slot;
+	while ((slot = try_alloc_slot(port)) == -1) {
+		thread_yeild();
+	}
+	return slot;
+}
+
+static void release_slot(ahci_port* port, uint8_t slot) {
+	intr_status old_status = intr_disable();
+	port->slots[slot].req = NULL;
+	port->busy &= ~(1 << slot);
+	intr_set_status(old_status);
+}
+
+/*
+发出请求的前几段，每段占用一个槽，硬盘可以自行调整这些命令的执行顺序
+只在第一个槽上等待，后面的槽要是没空就留给 ahci_wait 复用自己的槽，
+否则两个请求各占一部分槽又互相等待就会死锁
+*/
+static void ahci_submit(disk_req* req) {
+	ahci_port* port = req->hd->priv;
+	ASSERT(req->sec_cnt > 0);
+	ASSERT(req->lba + req->sec_cnt <= req->hd->sec_cnt);
+	req->secs_done = 0;
+
+	issue_chunk(port, alloc_slot(port), req);
+	uint8_t slots_used = 1;
+	int8_t slot;
+	while (
+		req->secs_done < req->sec_cnt && slots_used < AHCI_SLOTS_PER_REQ
+		&& (slot = try_alloc_slot(port)) != -1
+	) {
+		issue_chunk(port, slot, req);
+		slots_used++;
+	}
+}
+
+/* 等待请求占用的槽逐个完成，还有没发出的部分就在完成的槽中继续发出 */
+static void ahci_wait(disk_req* req) {
+	ahci_port* port = req->hd->priv;
+	bool pending = 1;
+	while (pending) {
+		pending = 0;
+		uint8_t slot = 0;
+		for (; slot < port->slot_cnt; slot++) {
+			if (port->slots[slot].req != req) {
+				continue;
+			}
+			pending = 1;
+			sema_down(&port->slots[slot].done);
+			if (port->slots[slot].error) {
+				printk("%s %s error, lba: %d\n", req->hd->name, req->is_write ? "write" : "read", req->lba);
+				intr_disable();
+				while (1);
+			}
+			if (req->secs_done < req->sec_cnt) {
+				issue_chunk(port, slot, req);
+			} else {
+				release_slot(port, slot);
+			}
+		}
+	}
+}
+
+/*
+让硬盘把写缓存中的数据落盘，FLUSH CACHE 不是 NCQ 命令，不能与 NCQ 命令同时执行，
+所以先占用全部的槽，等已经发出的命令都完成后再在第 0 个槽中发出
+*/
+static void ahci_flush(disk* hd) {
+	ahci_port* port = hd->priv;
+	lock_acquire(&port->flush_lock);
+	uint8_t idx = 0;
+	for (; idx < port->slot_cnt; idx++) {
+		alloc_slot(port);
+	}
+	ahci_issue(port, 0, ATA_CMD_FLUSH_EXT, 0, 0, NULL, 0, 0);
+	sema_down(&port->slots[0].done);
+	if (port->slots[0].error) {
+		printk("%s flush cache error\n", hd->name);
+		intr_disable();
+		while (1);
+	}
+	for (idx = 0; idx < port->slot_cnt; idx++) {
+		release_slot(port, idx);
+	}
+	lock_release(&port->flush_lock);
+}
+
+// ahci 硬盘的驱动
+static disk_ops ahci_ops = {ahci_submit, ahci_wait, ahci_flush};
+
+/* 处理一个端口上的中断，完成的命令在 SACT 和 CI 中对应的位都已清零 */
+static void port_intr(ahci_port* port, uint8_t port_no) {
+	uint32_t is = port_reg(port, PORT_IS);
+	port_reg(port, PORT_IS) = is;
+
+	uint32_t done = port->inflight & ~(port_reg(port, PORT_SACT) | port_reg(port, PORT_CI));
+	if (is & PORT_IS_TFES) {
+		// 出错后端口停止处理命令，把所有未完成的命令都标记为出错
+		done = port->inflight;
+	}
+	port->inflight &= ~done;
+
+	uint8_t slot = 0;
+	while (done != 0) {
+		if (done & 1) {
+			port->slots[slot].error = (is & PORT_IS_TFES) != 0;
+			sema_up(&port->slots[slot].done);
+		}
+		done >>= 1;
+		slot++;
+	}
+	hba_reg(HBA_IS) = 1 << port_no;
+}
+
+/* ahci 控制器的中断处理程序，中断号可能与其他 pci 设备共享 */
+static void intr_ahci_handler(void* arg) {
+	(void)arg;
+	uint32_t is = hba_reg(HBA_IS);
+	uint8_t idx = 0;
+	while (idx < hba.port_cnt) {
+		if (is & (1 << hba.port_no[idx])) {
+			port_intr(hba.ports[idx], hba.port_no[idx]);
+		}
+		idx++;
+	}
+}
+
+/* 轮询等待 reg 中 mask 对应的位全部清零，超时返回 0 */
+static bool spin_until_clear(volatile uint32_t* reg, uint32_t mask) {
+	uint32_t spin = AHCI_SPIN_LIMIT;
+	while ((*reg & mask) && --spin > 0);
+	return spin > 0;
+}
+
+/* 停止端口的命令引擎并设置命令列表、FIS 区和命令表，然后重新启动 */
+static bool port_rebase(ahci_port* port) {
+	port_reg(port, PORT_CMD) &= ~(PORT_CMD_ST | PORT_CMD_FRE);
+	if (!spin_until_clear(&port_reg(port, PORT_CMD), PORT_CMD_CR | PORT_CMD_FR)) {
+		return 0;
+	}
+
+	// 命令列表占 1KB，FIS 区紧随其后占 256 字节，一页足够
+	uint8_t* page = get_kernel_pages(1);
+	port->cmd_list = (ahci_cmd_header*)page;
+	port->fis = page + 1024;
+	port_reg(port, PORT_CLB) = addr_v2p((uint32_t)port->cmd_list);
+	port_reg(port, PORT_CLBU) = 0;
+	port_reg(port, PORT_FB) = addr_v2p((uint32_t)port->fis);
+	port_reg(port, PORT_FBU) = 0;
+
+	uint8_t slot = 0;
+	for (; slot < AHCI_MAX_SLOTS; slot++) {
+		if (slot % AHCI_TBLS_PER_PAGE == 0) {
+			page = get_kernel_pages(1);
+		}
+		port->cmd_tbls[slot] = page + (slot % AHCI_TBLS_PER_PAGE) * AHCI_CMD_TBL_SIZE;
+		port->cmd_list[slot].ctba = addr_v2p((uint32_t)port->cmd_tbls[slot]);
+		port->cmd_list[slot].ctbau = 0;
+		sema_init(&port->slots[slot].done, 0);
+	}
+	lock_init(&port->flush_lock);
+
+	port_reg(port, PORT_SERR) = 0xffffffff;
+	port_reg(port, PORT_IS) = 0xffffffff;
+	port_reg(port, PORT_CMD) |= PORT_CMD_FRE;
+	if (!spin_until_clear(&port_reg(port, PORT_TFD), PORT_TFD_BUSY)) {
+		return 0;
+	}
+	port_reg(port, PORT_IE) = PORT_IS_DHRS | PORT_IS_PSS | PORT_IS_DSS | PORT_IS_SDBS | PORT_IS_TFES;
+	port_reg(port, PORT_CMD) |= PORT_CMD_ST;
+	return 1;
+}
+
+/* 通过 identify 获得硬盘的容量以及是否支持 NCQ */
+static bool identify_port(ahci_port* port, disk* hd) {
+	uint16_t* id = sys_malloc(512);
+	port->slot_cnt = 1;
+	port->ncq = 0;
+	uint8_t slot = alloc_slot(port);
+	ahci_issue(port, slot, ATA_CMD_IDENTIFY, 0, 0, id, 512, 0);
+	sema_down(&port->slots[slot].done);
+	release_slot(port, slot);
+	if (port->slots[slot].error) {
+		sys_free(id);
+		return 0;
+	}
+
+	// 第 83 字的第 10 位表示支持 48 位 lba，扇区数在 100~103 字，否则在 60~61 字
+	if (id[83] & 0x400) {
+		hd->sec_cnt = (id[102] || id[103]) ? 0xffffffff : id[100] | ((uint32_t)id[101] << 16);
+	} else {
+		hd->sec_cnt = id[60] | (id[61] << 16);
+	}
+
+	// 第 76 字的第 8 位表示支持 NCQ，第 75 字的 0~4 位为队列深度减 1
+	uint8_t hba_slots = ((hba_reg(HBA_CAP) >> 8) & 0x1f) + 1;
+	if (id[76] & 0x100) {
+		port->ncq = 1;
+		port->slot_cnt = (id[75] & 0x1f) + 1;
+		if (port->slot_cnt > hba_slots) {
+			port->slot_cnt = hba_slots;
+		}
+	}
+	printk(
+		"  disk %s info:\n   SECTORS: %d\n   CAPACITY: %dMB\n   NCQ DEPTH: %d\n",
+		hd->name, hd->sec_cnt, hd->sec_cnt / 2048, port->ncq ? port->slot_cnt : 0
+	);
+	sys_free(id);
+	return 1;
+}
+
+/* 匹配 ahci 控制器，即 class 0x01 subclass 0x06 prog_if 0x01 的设备 */
+static bool match_ahci(pci_device* pdev, int arg) {
+	(void)arg;
+	return pdev->class_code == 0x01 && pdev->subclass == 0x06 && pdev->prog_if == 0x01;
+}
+
+/* 扫描 pci 总线找到 ahci 控制器，初始化上面接有 sata 硬盘的端口并扫描分区 */
+void ahci_init(void) {
+	if (!pci_find(match_ahci, 0, &hba.pdev)) {
+		return;
+	}
+	printk("ahci_init start\n");
+	pci_enable(&hba.pdev, PCI_CMD_MEM_SPACE | PCI_CMD_BUS_MASTER);
+	// BAR5 即 ABAR，是 hba 寄存器所在的物理地址
+	uint32_t abar = pci_config_read(&hba.pdev, PCI_BAR5) & 0xfffffff0;
+	hba.abar = map_mmio(abar, 0x100 + HBA_PORT_CNT * 0x80);
+	hba_reg(HBA_GHC) |= HBA_GHC_AE;
+
+	pci_register_irq(hba.pdev.irq_line, intr_ahci_handler, NULL);
+
+	uint32_t pi = hba_reg(HBA_PI);
+	uint8_t port_no = 0;
+	for (; port_no < HBA_PORT_CNT && hba.port_cnt < AHCI_MAX_PORTS; port_no++) {
+		if (!(pi & (1 << port_no))) {
+			continue;
+		}
+		volatile uint8_t* regs = hba.abar + 0x100 + port_no * 0x80;
+		// SSTS 的 0~3 位为 3 表示设备已连接且通信已建立
+		uint32_t ssts = *(volatile uint32_t*)(regs + PORT_SSTS);
+		uint32_t sig = *(volatile uint32_t*)(regs + PORT_SIG);
+		if ((ssts & 0xf) != 3 || sig != SATA_SIG_ATA) {
+			continue;
+		}
+
+		ahci_port* port = sys_malloc(sizeof(ahci_port));
+		memset(port, 0, sizeof(ahci_port));
+		port->regs = regs;
+		if (!port_rebase(port)) {
+			printk("  ahci port %d not ready\n", port_no);
+			sys_free(port);
+			continue;
+		}
+
+		uint8_t idx = hba.port_cnt;
+		hba.ports[idx] = port;
+		hba.port_no[idx] = port_no;
+		hba.port_cnt++;
+		hba_reg(HBA_GHC) |= HBA_GHC_IE;
+
+		disk* hd = &ahci_disks[idx];
+		// 排在最多 4 块 ide 硬盘之后
+		sprintf(hd->name, "sd%c", 'e' + idx);
+		hd->ops = &ahci_ops;
+		hd->priv = port;
+		hd->my_channel = NULL;
+		hd->dev_no = 0;
+		if (identify_port(port, hd)) {
+			disk_scan_partitions(hd);
+		}
+	}
+	printk("ahci_init done\n");
+}
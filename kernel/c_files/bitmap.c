@@ -28,14 +28,13 @@ uint8_t bitmap_scan_test(bitmap* btmp, uint32_t bit_idx) {
  */
 int bitmap_scan(bitmap* btmp, uint32_t cnt) {
 	uint32_t idx_byte = 0;
+	// 先判断下标，不能读到位图之外；位图已满时返回 -1，由调用者处理
 	while (
-		(0xff == btmp->bits[idx_byte])
-		&&
 		(idx_byte < btmp->btmp_bytes_len)
+		&&
+		(0xff == btmp->bits[idx_byte])
 	) { idx_byte++; }
 
-
-	ASSERT(idx_byte < btmp->btmp_bytes_len);
 	if (idx_byte == btmp->btmp_bytes_len) return -1;
 
 	int idx_bit = 0;
@@ -0,0 +1,207 @@
+#include "dcache.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "sync.h"
+
+static dentry* dentrys;
+static struct list dcache_buckets[DCACHE_BUCKETS];
+// 所有目录项缓存按使用时间排列，空闲的项在队尾，淘汰时从队尾取
+static struct list dcache_lru;
+static lock dcache_lock;
+/*
+目录的版本号，目录项的增删开始和结束时各加一，按 (分区, 目录 inode 号) 散列到各个计数器上，散列到一起的目录共享计数器
+查找时先取版本号再读目录，读完时若版本号变了或者仍有修改在进行，读到的可能是修改前或修改中的内容，就不放入缓存
+*/
+typedef struct {
+	uint32_t ver;
+	uint32_t writers;
+} dir_version;
+static dir_version dcache_dir_vers[DCACHE_BUCKETS];
+
+/* 计算键的哈希桶，文件名可能恰好占满 MAX_FILE_NAME_LEN 而没有结尾的 0 */
+static uint32_t dcache_hash(partition* part, uint32_t parent_ino, const char* name) {
+	uint32_t hash = parent_ino * 31 + (uint32_t)part;
+	uint32_t idx = 0;
+	while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+		hash = hash * 31 + (uint8_t)name[idx++];
+	}
+	return hash % DCACHE_BUCKETS;
+}
+
+/* 目录 parent_ino 的版本号计数器 */
+static dir_version* dcache_dir_ver(partition* part, uint32_t parent_ino) {
+	return &dcache_dir_vers[(parent_ino * 31 + (uint32_t)part) % DCACHE_BUCKETS];
+}
+
+/* 比较缓存中补零的文件名 cached 与 name 是否相同，最多比较 MAX_FILE_NAME_LEN 个字符 */
+static bool dcache_name_eq(const char* cached, const char* name) {
+	uint32_t idx = 0;
+	while (idx < MAX_FILE_NAME_LEN) {
+		if (cached[idx] != name[idx]) {
+			return 0;
+		}
+		if (name[idx] == 0) {
+			return 1;
+		}
+		idx++;
+	}
+	return 1;
+}
+
+/* 在哈希桶中查找键对应的项，调用者需持有 dcache_lock */
+static dentry* dcache_find(partition* part, uint32_t parent_ino, const char* name) {
+	struct list* bucket = &dcache_buckets[dcache_hash(part, parent_ino, name)];
+	struct list_elem* elem = bucket->head.next;
+	while (elem != &bucket->tail) {
+		dentry* de = elem2entry(dentry, hash_tag, elem);
+		if (
+			de->part == part && de->parent_ino == parent_ino
+			&& dcache_name_eq(de->name, name)
+		) {
+			return de;
+		}
+		elem = elem->next;
+	}
+	return NULL;
+}
+
+/* 初始化目录项缓存 */
+void dcache_init(void) {
+	dentrys = sys_malloc(sizeof(dentry) * DCACHE_ENTRYS);
+	ASSERT(dentrys != NULL);
+	lock_init(&dcache_lock);
+	list_init(&dcache_lru);
+	uint32_t idx = 0;
+	while (idx < DCACHE_BUCKETS) {
+		list_init(&dcache_buckets[idx++]);
+	}
+	// 空闲项的 part 为 NULL，不在任何哈希桶中
+	for (idx = 0; idx < DCACHE_ENTRYS; idx++) {
+		dentrys[idx].part = NULL;
+		list_append(&dcache_lru, &dentrys[idx].lru_tag);
+	}
+}
+
+/*
+在缓存中查找分区 part 上目录 parent_ino 下名为 name 的目录项
+命中则返回 1，并将结果写入 dir_e，负缓存命中时 dir_e->f_type 为 FT_UNKNOWN；未命中返回 0
+*/
+bool dcache_lookup(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e) {
+	lock_acquire(&dcache_lock);
+	dentry* de = dcache_find(part, parent_ino, name);
+	if (de != NULL) {
+		memset(dir_e, 0, sizeof(dir_entry));
+		memcpy(dir_e->filename, de->name, MAX_FILE_NAME_LEN);
+		dir_e->i_no = de->i_no;
+		dir_e->f_type = de->f_type;
+		// 移到 LRU 队首
+		list_remove(&de->lru_tag);
+		list_push(&dcache_lru, &de->lru_tag);
+	}
+	lock_release(&dcache_lock);
+	return de != NULL;
+}
+
+/* 缓存目录项 dir_e，dir_e 为 NULL 时缓存的是 "name 不存在" 这一结果，调用者需持有 dcache_lock */
+static void dcache_set(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e) {
+	dentry* de = dcache_find(part, parent_ino, name);
+	if (de == NULL) {
+		// 淘汰最久没有使用的项
+		de = elem2entry(dentry, lru_tag, dcache_lru.tail.prev);
+		if (de->part != NULL) {
+			list_remove(&de->hash_tag);
+		}
+		de->part = part;
+		de->parent_ino = parent_ino;
+		memset(de->name, 0, MAX_FILE_NAME_LEN);
+		uint32_t idx = 0;
+		while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+			de->name[idx] = name[idx];
+			idx++;
+		}
+		list_push(&dcache_buckets[dcache_hash(part, parent_ino, name)], &de->hash_tag);
+	}
+	de->i_no = dir_e == NULL ? 0 : dir_e->i_no;
+	de->f_type = dir_e == NULL ? FT_UNKNOWN : dir_e->f_type;
+	list_remove(&de->lru_tag);
+	list_push(&dcache_lru, &de->lru_tag);
+}
+
+/* 目录项 dir_e 已写入目录 parent_ino，缓存它 */
+void dcache_insert(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e) {
+	lock_acquire(&dcache_lock);
+	dcache_set(part, parent_ino, name, dir_e);
+	lock_release(&dcache_lock);
+}
+
+/* 开始修改目录 parent_ino 中的目录项，与 dcache_dir_end 成对使用 */
+void dcache_dir_begin(partition* part, uint32_t parent_ino) {
+	lock_acquire(&dcache_lock);
+	dir_version* dv = dcache_dir_ver(part, parent_ino);
+	dv->ver++;
+	dv->writers++;
+	lock_release(&dcache_lock);
+}
+
+/* 目录 parent_ino 修改完成 */
+void dcache_dir_end(partition* part, uint32_t parent_ino) {
+	lock_acquire(&dcache_lock);
+	dir_version* dv = dcache_dir_ver(part, parent_ino);
+	ASSERT(dv->writers > 0);
+	dv->ver++;
+	dv->writers--;
+	lock_release(&dcache_lock);
+}
+
+/* 返回目录 parent_ino 当前的版本号，查找在读目录之前取得，之后交给 dcache_fill */
+uint32_t dcache_version(partition* part, uint32_t parent_ino) {
+	lock_acquire(&dcache_lock);
+	uint32_t ver = dcache_dir_ver(part, parent_ino)->ver;
+	lock_release(&dcache_lock);
+	return ver;
+}
+
+/* 缓存查找读目录得到的结果，读的期间目录被修改过或正在被修改时丢弃这个结果 */
+void dcache_fill(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e, uint32_t ver) {
+	lock_acquire(&dcache_lock);
+	dir_version* dv = dcache_dir_ver(part, parent_ino);
+	if (dv->writers == 0 && dv->ver == ver) {
+		dcache_set(part, parent_ino, name, dir_e);
+	}
+	lock_release(&dcache_lock);
+}
+
+/* 把缓存项 de 放回空闲队列，调用者需持有 dcache_lock */
+static void dcache_drop(dentry* de) {
+	list_remove(&de->hash_tag);
+	de->part = NULL;
+	// 空闲项放到队尾，优先被重用
+	list_remove(&de->lru_tag);
+	list_append(&dcache_lru, &de->lru_tag);
+}
+
+/* 使缓存中的对应项失效，之后的查找会重新读目录 */
+void dcache_invalidate(partition* part, uint32_t parent_ino, const char* name) {
+	lock_acquire(&dcache_lock);
+	dentry* de = dcache_find(part, parent_ino, name);
+	if (de != NULL) {
+		dcache_drop(de);
+	}
+	lock_release(&dcache_lock);
+}
+
+/* inode parent_ino 被删除时使以它为父目录的所有项失效，否则编号被重新分配后会查到旧的目录项 */
+void dcache_invalidate_dir(partition* part, uint32_t parent_ino) {
+	lock_acquire(&dcache_lock);
+	// 与之并发、正在读这个目录的查找结果也要作废
+	dcache_dir_ver(part, parent_ino)->ver++;
+	uint32_t idx = 0;
+	for (; idx < DCACHE_ENTRYS; idx++) {
+		if (dentrys[idx].part == part && dentrys[idx].parent_ino == parent_ino) {
+			dcache_drop(&dentrys[idx]);
+		}
+	}
+	lock_release(&dcache_lock);
+}
@@ -2,91 +2,373 @@
 #include "memory.h"
 #include "stdio.h"
 #include "file.h"
+#include "extent.h"
+#include "journal.h"
+#include "dcache.h"
 #include "ide.h"
 #include "dir.h"
 
-// 根目录
-dir root_dir;
-
-/* 打开根目录 */
-void open_root_dir(partition* part) {
-	root_dir.inode = inode_open(part, part->sb->root_inode_no);
-	root_dir.dir_pos = 0;
-}
-
 /* 在分区 part 上打开 inode_no 对应的目录并返回其指针 */
 dir* dir_open(partition* part, uint32_t inode_no) {
 	dir* pdir = sys_malloc(sizeof(dir));
 	pdir->inode = inode_open(part, inode_no);
 	pdir->dir_pos = 0;
+	pdir->free_hint = 0;
 	return pdir;
 }
 
-/* 在分区 part 中的 pdir 目录内寻找名为 name 的目录项，找到会赋值给 dir_e 并返回 1，否则返回 0*/
-bool search_dir_entry(
-	partition* part, dir* pdir,
-	const char* name, dir_entry* dir_e
-) {
-	// 12 个直接块 + 128 个一级间接块 = 140 块
-	uint32_t block_cnt = 140;
-	uint32_t* all_blocks = (uint32_t*)sys_malloc(block_cnt * 4);
-	if (all_blocks == NULL) {
-		printk("search_dir_entry: sys_malloc for all blocks failed");
+// 索引头中的魔数
+#define DIR_INDEX_MAGIC "dxi"
+// 取出目录块 buf 末尾的 dir_leaf_tail
+#define LEAF_TAIL(buf) \
+	((dir_leaf_tail*)((uint8_t*)(buf) + DIR_ENTRYS_PER_BLOCK * sizeof(dir_entry)))
+
+/* 计算文件名的哈希值 (FNV-1a)，文件名可能恰好占满 MAX_FILE_NAME_LEN 而没有结尾的 0 */
+static uint32_t dir_hash(const char* name) {
+	uint32_t hash = 2166136261u;
+	uint32_t idx = 0;
+	while (idx < MAX_FILE_NAME_LEN && name[idx]) {
+		hash ^= (uint8_t)name[idx++];
+		hash *= 16777619u;
+	}
+	return hash % DIR_INDEX_BUCKETS;
+}
+
+/* 若第 0 块的内容 buf 中有索引头则将其复制到 head 并返回 1，否则说明是线性目录，返回 0 */
+static bool dir_index_head_parse(void* buf, dir_index_head* head) {
+	dir_index_head* h = (dir_index_head*)((dir_entry*)buf + DIR_INDEX_HEAD_SLOT);
+	if (h->zero != 0 || h->f_type != FT_UNKNOWN || memcmp(h->magic, DIR_INDEX_MAGIC, 3)) {
 		return 0;
 	}
+	memcpy(head, h, sizeof(dir_index_head));
+	return 1;
+}
 
-	uint32_t block_idx = 0;
-	while (block_idx < 12) {
-		all_blocks[block_idx] = pdir->inode->i_sectors[block_idx];
-		block_idx++;
+/* 将目录的第 0 块读入 buf，并解析其中的索引头 */
+static bool dir_index_head_get(
+	partition* part, inode* dir_inode,
+	void* buf, dir_index_head* head
+) {
+	uint32_t lba = extent_map(part, dir_inode, 0, NULL);
+	ASSERT(lba != 0);
+	journal_read(part, lba, buf, 1);
+	return dir_index_head_parse(buf, head);
+}
+
+/* 将 head 写回目录第 0 块中的索引头，buf 为一个扇区大小的缓冲 */
+static void dir_index_head_sync(
+	partition* part, inode* dir_inode,
+	dir_index_head* head, void* buf
+) {
+	uint32_t lba = extent_map(part, dir_inode, 0, NULL);
+	journal_read(part, lba, buf, 1);
+	memcpy((dir_entry*)buf + DIR_INDEX_HEAD_SLOT, head, sizeof(dir_index_head));
+	journal_write(part, lba, buf, 1);
+}
+
+/* 在目录块 buf 中查找名为 name 的目录项，没有则返回 NULL */
+static dir_entry* block_find_entry(void* buf, const char* name) {
+	dir_entry* p_de = (dir_entry*)buf;
+	uint32_t dir_entry_idx = 0;
+	while (dir_entry_idx < DIR_ENTRYS_PER_BLOCK) {
+		if (p_de->f_type != FT_UNKNOWN && ! strcmp(p_de->filename, name)) {
+			return p_de;
+		}
+		dir_entry_idx++; p_de++;
+	}
+	return NULL;
+}
+
+/* 返回目录块 buf 中第一个空位，没有则返回 NULL */
+static dir_entry* block_free_slot(void* buf) {
+	dir_entry* p_de = (dir_entry*)buf;
+	uint32_t dir_entry_idx = 0;
+	while (dir_entry_idx < DIR_ENTRYS_PER_BLOCK) {
+		// 无论是初始化还是删除文件后，都会将 f_type 置为 FT_UNKNOWN
+		if (p_de->f_type == FT_UNKNOWN) {
+			return p_de;
+		}
+		dir_entry_idx++; p_de++;
+	}
+	return NULL;
+}
+
+/* 读取索引目录的哈希表，返回哈希桶 bucket 对应的叶子块号，table 为一个扇区大小的缓冲 */
+static uint32_t dir_index_leaf(
+	partition* part, inode* dir_inode,
+	dir_index_head* head, uint32_t bucket, uint16_t* table
+) {
+	uint32_t lba = extent_map(part, dir_inode, head->index_block, NULL);
+	ASSERT(lba != 0);
+	journal_read(part, lba, table, 1);
+	return table[bucket];
+}
+
+/* 为索引目录取一个新的叶子块，块已存在 (转换时留下的) 就直接复用，返回逻辑块号，失败返回 -1 */
+static int32_t dir_leaf_new(partition* part, inode* dir_inode, dir_index_head* head) {
+	uint32_t lblock = head->leaf_next;
+	// 哈希表中的块号是 uint16_t
+	if (lblock > 0xffff) {
+		return -1;
+	}
+	if (
+		extent_map(part, dir_inode, lblock, NULL) == 0
+		&& extent_alloc(part, dir_inode, lblock, 1) == -1
+	) {
+		return -1;
+	}
+	head->leaf_next++;
+	return lblock;
+}
+
+/*
+将目录项 p_de 插入到索引目录中，bucket 为其哈希桶，不修改目录的 i_size
+io_buf 至少两个扇区大小，成功返回 1，失败返回 0
+*/
+static bool dir_index_insert(
+	partition* part, inode* dir_inode, dir_index_head* head,
+	uint32_t bucket, dir_entry* p_de, void* io_buf
+) {
+	uint16_t* table = sys_malloc(BLOCK_SIZE);
+	if (table == NULL) {
+		printk("dir_index_insert: sys_malloc for table failed\n");
+		return 0;
 	}
-	block_idx = 0;
+	uint8_t* leaf = io_buf;
+	uint8_t* other = (uint8_t*)io_buf + BLOCK_SIZE;
+	dir_entry* slot;
+	bool ret = 0;
+
+	while (1) {
+		uint32_t lblock = dir_index_leaf(part, dir_inode, head, bucket, table);
+		uint32_t lba;
+		// 沿着溢出链寻找空位，一般情况下链上只有一个块
+		while (1) {
+			lba = extent_map(part, dir_inode, lblock, NULL);
+			ASSERT(lba != 0);
+			journal_read(part, lba, leaf, 1);
+			if ((slot = block_free_slot(leaf)) != NULL) {
+				memcpy(slot, p_de, sizeof(dir_entry));
+				journal_write(part, lba, leaf, 1);
+				ret = 1;
+				goto out;
+			}
+			if (LEAF_TAIL(leaf)->next == 0) {
+				break;
+			}
+			lblock = LEAF_TAIL(leaf)->next;
+		}
+
+		// 叶子 (或溢出链的最后一块) 已满，需要一个新叶子
+		int32_t new_lblock = dir_leaf_new(part, dir_inode, head);
+		if (new_lblock == -1) {
+			printk("dir_index_insert: alloc leaf block failed\n");
+			goto out;
+		}
+		uint32_t new_lba = extent_map(part, dir_inode, new_lblock, NULL);
+		dir_leaf_tail* tail = LEAF_TAIL(leaf);
+		dir_leaf_tail* new_tail = LEAF_TAIL(other);
+		memset(other, 0, BLOCK_SIZE);
+
+		if (tail->bucket_cnt == 1) {
+			// 只负责一个桶的叶子无法再分裂，把新叶子挂到溢出链的末尾
+			new_tail->bucket_lo = tail->bucket_lo;
+			new_tail->bucket_cnt = 1;
+			memcpy(other, p_de, sizeof(dir_entry));
+			journal_write(part, new_lba, other, 1);
+			tail->next = new_lblock;
+			journal_write(part, lba, leaf, 1);
+			dir_index_head_sync(part, dir_inode, head, table);
+			ret = 1;
+			goto out;
+		}
+
+		// 把叶子负责的桶分成两半，后一半连同其中的目录项移到新叶子，然后重试
+		uint32_t mid = tail->bucket_lo + tail->bucket_cnt / 2;
+		new_tail->bucket_lo = mid;
+		new_tail->bucket_cnt = tail->bucket_lo + tail->bucket_cnt - mid;
+		tail->bucket_cnt = mid - tail->bucket_lo;
 
-	if (pdir->inode->i_sectors[12] != 0) {
-		ide_read(
-			part->my_disk,
-			pdir->inode->i_sectors[12],
-			all_blocks + 12, 1
+		dir_entry* src = (dir_entry*)leaf;
+		dir_entry* dst = (dir_entry*)other;
+		uint32_t dir_entry_idx = 0;
+		while (dir_entry_idx < DIR_ENTRYS_PER_BLOCK) {
+			if (src->f_type != FT_UNKNOWN && dir_hash(src->filename) >= mid) {
+				memcpy(dst++, src, sizeof(dir_entry));
+				memset(src, 0, sizeof(dir_entry));
+			}
+			dir_entry_idx++; src++;
+		}
+		uint32_t b = mid;
+		while (b < mid + new_tail->bucket_cnt) {
+			table[b++] = new_lblock;
+		}
+		journal_write(part, lba, leaf, 1);
+		journal_write(part, new_lba, other, 1);
+		journal_write(
+			part, extent_map(part, dir_inode, head->index_block, NULL),
+			table, 1
 		);
+		dir_index_head_sync(part, dir_inode, head, table);
 	}
-/* 到此为止，all_blocks 储存了该文件或目录的所有扇区地址 */
 
-	// TODO: 写目录项时保证了目录项不跨扇区
-	uint8_t* buf = sys_malloc(SECTOR_SIZE);
-	dir_entry* p_de = (dir_entry*)buf;
-	uint32_t dir_entry_size = part->sb->dir_entry_size;
-	uint32_t dir_entry_cnt = SECTOR_SIZE / dir_entry_size;
+out:
+	sys_free(table);
+	return ret;
+}
 
+/*
+将块数为 block_cnt 的线性目录转换为索引目录，转换后：
+第 0 块只保留 . 和 ..，并在其后放置索引头，第 1 块为哈希表，第 2 块为负责所有桶的叶子，
+其余的块清空后留给之后分裂出的叶子，原有的目录项再逐个插入到索引中
+*/
+static bool dir_index_build(
+	partition* part, inode* dir_inode,
+	uint32_t block_cnt, void* io_buf
+) {
+	ASSERT(block_cnt > 2);
+	uint8_t* old = sys_malloc(block_cnt * BLOCK_SIZE);
+	if (old == NULL) {
+		printk("dir_index_build: sys_malloc for old blocks failed\n");
+		return 0;
+	}
+	uint32_t block_idx = 0;
 	while (block_idx < block_cnt) {
-		// 如果块地址为 0 表示该块中无数据
-		if (all_blocks[block_idx] == 0) {
-			block_idx++; continue;
+		journal_read(
+			part, extent_map(part, dir_inode, block_idx, NULL),
+			old + block_idx * BLOCK_SIZE, 1
+		);
+		block_idx++;
+	}
+
+	// 第 0 块：. 和 .. 以及索引头
+	dir_entry* block0 = io_buf;
+	memset(block0, 0, BLOCK_SIZE);
+	dir_entry* de = (dir_entry*)old;
+	for (block_idx = 0; block_idx < block_cnt; block_idx++) {
+		de = (dir_entry*)(old + block_idx * BLOCK_SIZE);
+		uint32_t dir_entry_idx = 0;
+		while (dir_entry_idx < DIR_ENTRYS_PER_BLOCK) {
+			if (de->f_type != FT_UNKNOWN && ! strcmp(de->filename, ".")) {
+				memcpy(block0, de, sizeof(dir_entry));
+			} else if (de->f_type != FT_UNKNOWN && ! strcmp(de->filename, "..")) {
+				memcpy(block0 + 1, de, sizeof(dir_entry));
+			}
+			dir_entry_idx++; de++;
 		}
-		ide_read(part->my_disk, all_blocks[block_idx], buf, 1);
+	}
+	dir_index_head head;
+	memset(&head, 0, sizeof(dir_index_head));
+	memcpy(head.magic, DIR_INDEX_MAGIC, 3);
+	head.index_block = 1;
+	head.leaf_next = 3;
+	memcpy(block0 + DIR_INDEX_HEAD_SLOT, &head, sizeof(dir_index_head));
+	journal_write(part, extent_map(part, dir_inode, 0, NULL), block0, 1);
+
+	// 第 1 块：所有的桶都指向第 2 块
+	uint16_t* table = io_buf;
+	uint32_t b = 0;
+	while (b < DIR_INDEX_BUCKETS) {
+		table[b++] = 2;
+	}
+	journal_write(part, extent_map(part, dir_inode, 1, NULL), table, 1);
 
-		// TODO: 如果一个扇区中没有写满目录项，那么剩下的部分会清零吗，否则为什么这里不做判断
+	// 第 2 块为空叶子，其余块清空
+	for (block_idx = 2; block_idx < block_cnt; block_idx++) {
+		memset(io_buf, 0, BLOCK_SIZE);
+		if (block_idx == 2) {
+			LEAF_TAIL(io_buf)->bucket_cnt = DIR_INDEX_BUCKETS;
+		}
+		journal_write(part, extent_map(part, dir_inode, block_idx, NULL), io_buf, 1);
+	}
+
+	// 重新插入原有的目录项
+	bool ret = 1;
+	for (block_idx = 0; block_idx < block_cnt && ret; block_idx++) {
+		de = (dir_entry*)(old + block_idx * BLOCK_SIZE);
 		uint32_t dir_entry_idx = 0;
-		while (dir_entry_idx < dir_entry_cnt) {
-			if (! strcmp(p_de->filename, name)) {
-				memcpy(dir_e, p_de, dir_entry_size);
-				sys_free(buf);
-				sys_free(all_blocks);
-				return 1;
+		while (dir_entry_idx < DIR_ENTRYS_PER_BLOCK) {
+			if (
+				de->f_type != FT_UNKNOWN
+				&& strcmp(de->filename, ".") && strcmp(de->filename, "..")
+				&& ! dir_index_insert(part, dir_inode, &head, dir_hash(de->filename), de, io_buf)
+			) {
+				printk("dir_index_build: entry %s lost\n", de->filename);
+				ret = 0;
 			}
-			dir_entry_idx++; p_de++;
+			dir_entry_idx++; de++;
 		}
-		block_idx++;
-		p_de = (dir_entry*)buf;
-		memset(buf, 0, SECTOR_SIZE);
+	}
+	sys_free(old);
+	return ret;
+}
+
+/*
+在分区 part 中的 pdir 目录内寻找名为 name 的目录项，找到会赋值给 dir_e 并返回 1，否则返回 0
+没找到时会把途中见到的空位记录在 pdir->free_hint 中，供紧随其后的 sync_dir_entry 使用
+*/
+bool search_dir_entry(
+	partition* part, dir* pdir,
+	const char* name, dir_entry* dir_e
+) {
+	uint8_t* buf = sys_malloc(SECTOR_SIZE);
+	if (buf == NULL) {
+		printk("search_dir_entry: sys_malloc for buf failed");
+		return 0;
+	}
+	uint32_t hash = dir_hash(name);
+	pdir->free_hint = 0;
+	pdir->free_hint_hash = hash;
+
+	// . 和 .. 总在第 0 块中，索引目录的索引头也在这里
+	dir_index_head head;
+	bool indexed = dir_index_head_get(part, pdir->inode, buf, &head);
+	dir_entry* found = block_find_entry(buf, name);
+	uint32_t block_idx, block_lba;
+
+	if (indexed) {
+		// 索引目录只需要查找哈希桶对应的叶子及其溢出链
+		block_idx = dir_index_leaf(part, pdir->inode, &head, hash, (uint16_t*)buf);
+		while (found == NULL && block_idx != 0) {
+			block_lba = extent_map(part, pdir->inode, block_idx, NULL);
+			ASSERT(block_lba != 0);
+			journal_read(part, block_lba, buf, 1);
+			found = block_find_entry(buf, name);
+			if (pdir->free_hint == 0 && block_free_slot(buf) != NULL) {
+				pdir->free_hint = block_idx + 1;
+			}
+			block_idx = LEAF_TAIL(buf)->next;
+		}
+	} else {
+		if (block_free_slot(buf) != NULL) {
+			pdir->free_hint = 1;
+		}
+		// 目录的块从 0 开始连续编号，extent_map 返回 0 时说明已经查完了所有的块
+		block_idx = 1;
+		while (
+			found == NULL
+			&& (block_lba = extent_map(part, pdir->inode, block_idx, NULL)) != 0
+		) {
+			journal_read(part, block_lba, buf, 1);
+			found = block_find_entry(buf, name);
+			if (pdir->free_hint == 0 && block_free_slot(buf) != NULL) {
+				pdir->free_hint = block_idx + 1;
+			}
+			block_idx++;
+		}
+	}
+
+	if (found != NULL) {
+		memcpy(dir_e, found, sizeof(dir_entry));
 	}
 	sys_free(buf);
-	sys_free(all_blocks);
-	return 0;
+	return found != NULL;
 }
 
 /* 关闭目录 */
 void dir_close(dir* dir) {
-	if (dir == &root_dir) {
+	// 各挂载点的根目录一直打开着
+	if (is_mount_root(dir)) {
 		return;
 	}
 	inode_close(dir->inode);
@@ -105,149 +387,166 @@ void create_dir_entry(
 	p_de->f_type = file_type;
 }
 
-extern partition* cur_part;
+/*
+尝试把目录项 p_de 写入目录的第 lblock 块，用于验证并使用 search_dir_entry 留下的空闲位置提示
+indexed 时 head 为索引头，此时该块必须是负责 bucket 的叶子
+*/
+static bool dir_block_try_insert(
+	inode* dir_inode, bool indexed, dir_index_head* head,
+	uint32_t lblock, uint32_t bucket, dir_entry* p_de, void* io_buf
+) {
+	if (indexed && (lblock == 0 || lblock == head->index_block || lblock >= head->leaf_next)) {
+		return 0;
+	}
+	partition* part = dir_inode->i_part;
+	uint32_t block_lba = extent_map(part, dir_inode, lblock, NULL);
+	if (block_lba == 0) {
+		return 0;
+	}
+	journal_read(part, block_lba, io_buf, 1);
+	if (indexed) {
+		dir_leaf_tail* tail = LEAF_TAIL(io_buf);
+		if (bucket < tail->bucket_lo || bucket >= tail->bucket_lo + tail->bucket_cnt) {
+			return 0;
+		}
+	}
+	dir_entry* slot = block_free_slot(io_buf);
+	if (slot == NULL) {
+		return 0;
+	}
+	memcpy(slot, p_de, sizeof(dir_entry));
+	journal_write(part, block_lba, io_buf, 1);
+	return 1;
+}
 
-/* 将目录项 p_de 写入父目录 parent_dir 中，io_buf 由主调函数提供 */
-bool sync_dir_entry(dir* parent_dir, dir_entry* p_de, void* io_buf) {
+/* 目录项 p_de 已写入目录 dir_inode 后，更新目录大小和目录项缓存 */
+static void dir_entry_added(inode* dir_inode, dir_entry* p_de) {
+	dir_inode->i_size += dir_inode->i_part->sb->dir_entry_size;
+	dcache_insert(dir_inode->i_part, dir_inode->i_no, p_de->filename, p_de);
+}
+
+/* 将目录项 p_de 写入父目录 parent_dir 中，io_buf 由主调函数提供，至少两个扇区大小 */
+static bool do_sync_dir_entry(dir* parent_dir, dir_entry* p_de, void* io_buf) {
 	inode* dir_inode = parent_dir->inode;
+	partition* part = dir_inode->i_part;
 	uint32_t dir_size = dir_inode->i_size;
-	uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+	uint32_t dir_entry_size = part->sb->dir_entry_size;
 
 	// dir_size 应该是 dir_entry_size 的整数倍
 	ASSERT(dir_size % dir_entry_size == 0);
-	// 每个扇区最大的目录项数目，由于向下取整，因此保证了目录项不会跨扇区
-	uint32_t dir_entrys_per_sec = (SECTOR_SIZE / dir_entry_size);
-	int32_t block_lba = -1;
-	// 用来存储所有的扇区地址
-	uint8_t block_idx = 0;
-	uint32_t all_blocks[140] = {0};
-
-	// 将 12 个直接块存入 all_blocks
-	// TODO: 是不是有 bug？如果下标 12 对应的一级间接表有值呢
-	while (block_idx < 12) {
-		all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-		block_idx++;
+	// 目录项引用的 inode 必须先在 inode 位图中落盘
+	bitmap_flush(part);
+	uint32_t bucket = dir_hash(p_de->filename);
+	dir_index_head head;
+	bool indexed = dir_index_head_get(part, dir_inode, io_buf, &head);
+
+	// 先尝试刚才查找该文件名时留下的空闲位置提示，省去再次遍历
+	uint32_t hint = parent_dir->free_hint;
+	parent_dir->free_hint = 0;
+	if (
+		hint != 0 && parent_dir->free_hint_hash == bucket
+		&& dir_block_try_insert(dir_inode, indexed, &head, hint - 1, bucket, p_de, io_buf)
+	) {
+		dir_entry_added(dir_inode, p_de);
+		return 1;
 	}
 
-	dir_entry* dir_e = (dir_entry*)io_buf;
+	if (indexed) {
+		if (! dir_index_insert(part, dir_inode, &head, bucket, p_de, io_buf)) {
+			return 0;
+		}
+		dir_entry_added(dir_inode, p_de);
+		return 1;
+	}
 
 	/*
-	开始遍历所有块以寻找目录项的空位，若已有扇区中没有空闲位，
-	在不超过文件大小的情况下申请新扇区来存储新目录项
+	线性目录：遍历所有块以寻找目录项的空位，若已有扇区中没有空闲位，
+	就在目录末尾分配一个新块来存储新目录项，块数达到阈值后转换为索引目录
 	*/
-	int32_t block_bitmap_idx = -1;
-	block_idx = 0;
-	while (block_idx < 140) {
-		block_bitmap_idx = -1;
-		// 如果为 0 说明该块当前为空，需要被分配
-		if (all_blocks[block_idx] == 0) {
-			// 先分配一个块，块的用途针对不同的 block_idx 而不同
-			block_lba = block_bitmap_alloc(cur_part);
-			if (block_lba == -1) {
-				printk("alloc block bitmap for sync_dir_entry failed\n");
-				return 0;
-			}
-
-			// 每分配一个块就同步一次 block_bitmap
-			block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-			ASSERT(block_bitmap_idx >= 0);
-			bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-			block_bitmap_idx = -1;
-			if (block_idx < 12) {
-				// 如果是直接块
-				dir_inode->i_sectors[block_idx] =\
-				all_blocks[block_idx] = block_lba;
-			} else if (block_idx == 12) {
-				// 如果是一级间接块表，那么由于上面的 all_blocks[block_idx] == 0，可知当前表空间未分配
-				dir_inode->i_sectors[12] = block_lba;
-
-				// 再分配一块用于作为一级间接块表的表项
-				block_lba = -1;
-				block_lba = block_bitmap_alloc(cur_part);
-				if (block_lba == -1) {
-					// 如果这个时候分配失败了，回收上面块表的分配的块
-					block_bitmap_idx = dir_inode->i_sectors[12] -\
-					cur_part->sb->data_start_lba;
-					bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
-					dir_inode->i_sectors[12] = 0;
-					printk("alloc block bitmap for sync_dir_entry failed\n");
-					return 0;
-				}
-
-				// 每分配一个块就同步一次 block_bitmap
-				block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-				ASSERT(block_bitmap_idx >= 0);
-				bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-
-				all_blocks[12] = block_lba;
-				// 把新分配的第 0 个间接块地址写入一级间接表
-				ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-			} else {
-				// 如果是间接块
-				all_blocks[block_idx] = block_lba;
-				// 把新分配的第 (block_idx - 12) 个间接块地址写入一级间接表
-				ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
-			}
-
-			// 再将新目录项写入新分配的间接块
-			memset(io_buf, 0, 512);
-			memcpy(io_buf, p_de, dir_entry_size);
-			ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-			dir_inode->i_size += dir_entry_size;
+	dir_entry* slot;
+	uint32_t block_idx = 0, block_lba;
+	while ((block_lba = extent_map(part, dir_inode, block_idx, NULL)) != 0) {
+		// 若第 block_idx 块已经存在，则将其读入内存，然后在该块中查找空目录项
+		journal_read(part, block_lba, io_buf, 1);
+		if ((slot = block_free_slot(io_buf)) != NULL) {
+			memcpy(slot, p_de, dir_entry_size);
+			journal_write(part, block_lba, io_buf, 1);
+			dir_entry_added(dir_inode, p_de);
 			return 1;
 		}
+		block_idx++;
+	}
 
-		// 若第 block_idx 块已经存在，则将其读入内存，然后在该块中查找空目录项
-		ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-		// 在扇区内查找空目录项
-		uint8_t dir_entry_idx = 0;
-		while (dir_entry_idx < dir_entrys_per_sec) {
-			if ((dir_e + dir_entry_idx)->f_type == FT_UNKNOWN) {
-				// 无论是初始化还是删除文件后，都会将 f_type 置为 FT_UNKNOWN
-				memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
-				ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
-				dir_inode->i_size += dir_entry_size;
-				return 1;
-			}
-			dir_entry_idx++;
+	if (block_idx >= DIR_INDEX_THRESHOLD) {
+		if (
+			! dir_index_build(part, dir_inode, block_idx, io_buf)
+			|| ! dir_index_head_get(part, dir_inode, io_buf, &head)
+			|| ! dir_index_insert(part, dir_inode, &head, bucket, p_de, io_buf)
+		) {
+			printk("build dir index for sync_dir_entry failed\n");
+			return 0;
 		}
-		block_idx++;
+		dir_entry_added(dir_inode, p_de);
+		return 1;
 	}
-	printk("directory is full\n");
-	return 0;
+
+	// 所有块都满了，为目录分配第 block_idx 块
+	if (extent_alloc(part, dir_inode, block_idx, 1) == -1) {
+		printk("alloc block bitmap for sync_dir_entry failed\n");
+		return 0;
+	}
+	block_lba = extent_map(part, dir_inode, block_idx, NULL);
+
+	// 再将新目录项写入新分配的块
+	memset(io_buf, 0, 512);
+	memcpy(io_buf, p_de, dir_entry_size);
+	journal_write(part, block_lba, io_buf, 1);
+	dir_entry_added(dir_inode, p_de);
+	return 1;
+}
+
+/*
+将目录项 p_de 写入父目录 parent_dir 中，io_buf 由主调函数提供，至少两个扇区大小
+写入过程中叶子分裂、转换为索引目录时目录项会暂时不在原处，期间读目录的查找结果不能放入目录项缓存
+*/
+bool sync_dir_entry(dir* parent_dir, dir_entry* p_de, void* io_buf) {
+	inode* dir_inode = parent_dir->inode;
+	dcache_dir_begin(dir_inode->i_part, dir_inode->i_no);
+	bool ret = do_sync_dir_entry(parent_dir, p_de, io_buf);
+	dcache_dir_end(dir_inode->i_part, dir_inode->i_no);
+	return ret;
 }
 
 /* 读取目录，成功返回 1 个目录项，失败返回 NULL */
 dir_entry* dir_read(dir* dir) {
 	dir_entry* dir_e = (dir_entry*)dir->dir_buf;
 	inode* dir_inode = dir->inode;
-	uint32_t all_blocks[140] = {0}, block_cnt = 12;
-	uint32_t block_idx = 0, dir_entry_idx = 0;
-	// 根据 i_sectors 的状态读出目录所占的所有块
-	while (block_idx < 12) {
-		all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-		block_idx++;
-	}
-	if (dir_inode->i_sectors[12] != 0) {
-		ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-		block_cnt = 140;
-	}
-	block_idx = 0;
+	uint32_t block_idx = 0, block_lba, dir_entry_idx = 0;
 
+	partition* part = dir_inode->i_part;
 	uint32_t cur_dir_entry_pos = 0;
-	uint32_t dir_entry_size = cur_part->sb->dir_entry_size;
+	uint32_t dir_entry_size = part->sb->dir_entry_size;
 	uint32_t dir_entrys_per_sec = SECTOR_SIZE / dir_entry_size;
+	dir_index_head head;
+	bool indexed = 0;
 	while (dir->dir_pos < dir_inode->i_size) {
 		if (dir->dir_pos >= dir_inode->i_size) {
 			return NULL;
 		}
-		if (all_blocks[block_idx] == 0) {
+		// 索引目录的哈希表块中没有目录项
+		if (indexed && block_idx == head.index_block) {
 			block_idx++;
 			continue;
 		}
+		block_lba = extent_map(part, dir_inode, block_idx, NULL);
+		if (block_lba == 0) {
+			return NULL;
+		}
 		memset(dir_e, 0, SECTOR_SIZE);
-		ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+		journal_read(part, block_lba, dir_e, 1);
+		if (block_idx == 0) {
+			indexed = dir_index_head_parse(dir_e, &head);
+		}
 		dir_entry_idx = 0;
 		while (dir_entry_idx < dir_entrys_per_sec) {
 			if ((dir_e + dir_entry_idx)->f_type) {
@@ -280,17 +579,9 @@ void sys_rewinddir(dir* dir) {
 }
 
 /* 把分区 part 目录 pdir 中编号为 inode_no 的目录项删除 */
-bool delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_buf) {
+static bool do_delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_buf) {
 	inode* dir_inode = pdir->inode;
-	uint32_t block_idx = 0, all_blocks[140] = {0}, block_cnt = 12;
-	while (block_idx < 12) {
-		all_blocks[block_idx] = dir_inode->i_sectors[block_idx];
-		block_idx++;
-	}
-	if (dir_inode->i_sectors[12]) {
-		ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-		block_cnt = 140;
-	}
+	uint32_t block_idx = 0, block_lba;
 
 	// 目录项不会跨扇区
 	uint32_t dir_entry_size = part->sb->dir_entry_size;
@@ -298,34 +589,32 @@ bool delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_bu
 
 	dir_entry* dir_e = (dir_entry*) io_buf;
 	dir_entry* dir_entry_found = NULL;
-	uint8_t dir_entry_idx, dir_entry_cnt;
-	bool is_dir_first_block = 0; // 目录的第一个块
+	uint8_t dir_entry_idx;
+	dir_index_head head;
+	bool indexed = 0;
 
-	block_idx = 0;
-	while (block_idx < block_cnt) {
-		is_dir_first_block = 0;
-		if (all_blocks[block_idx] == 0) {
+	while ((block_lba = extent_map(part, dir_inode, block_idx, NULL)) != 0) {
+		// 索引目录的哈希表块中没有目录项
+		if (indexed && block_idx == head.index_block) {
 			block_idx++;
 			continue;
 		}
-
-		dir_entry_idx = dir_entry_cnt = 0;
+		dir_entry_idx = 0;
 		memset(io_buf, 0, SECTOR_SIZE);
-		ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
+		journal_read(part, block_lba, io_buf, 1);
+		if (block_idx == 0) {
+			indexed = dir_index_head_parse(io_buf, &head);
+		}
 
 		while (dir_entry_idx < dir_entrys_per_sec) {
-			if ((dir_e + dir_entry_idx)->f_type != FT_UNKNOWN) {
-				if (! strcmp((dir_e + dir_entry_idx)->filename, ".")) {
-					is_dir_first_block = 1;
-				} else if (
-					strcmp((dir_e + dir_entry_idx)->filename, ".")
-					&& strcmp((dir_e + dir_entry_idx)->filename, "..")
-				) {
-					dir_entry_cnt++;
-					if ((dir_e + dir_entry_idx)->i_no == inode_no) {
-						dir_entry_found = dir_e + dir_entry_idx;
-					}
-				}
+			if (
+				(dir_e + dir_entry_idx)->f_type != FT_UNKNOWN
+				&& strcmp((dir_e + dir_entry_idx)->filename, ".")
+				&& strcmp((dir_e + dir_entry_idx)->filename, "..")
+				&& (dir_e + dir_entry_idx)->i_no == inode_no
+			) {
+				dir_entry_found = dir_e + dir_entry_idx;
+				break;
 			}
 			dir_entry_idx++;
 		}
@@ -335,45 +624,13 @@ bool delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_bu
 			continue;
 		}
 
-		ASSERT(dir_entry_cnt >= 1);
-		// 除目录第一个扇区外，若该扇区上只有待删除的目录项，那么将整个扇区回收
-		if (dir_entry_cnt == 1 && !is_dir_first_block) {
-			uint32_t block_bitmap_idx =\
-			all_blocks[block_idx] - part->sb->data_start_lba;
-			bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-			bitmap_sync(part, block_bitmap_idx, BLOCK_BITMAP);
-
-			if (block_idx < 12) {
-				dir_inode->i_sectors[block_idx] = 0;
-			} else {
-				// 如果间接索引表中只有这一个间接块，那么回收索引表
-				uint32_t indirect_blocks = 0;
-				uint32_t indirect_block_idx = 12;
-				while (indirect_block_idx < 140) {
-					if (all_blocks[indirect_block_idx] != 0) {
-						indirect_blocks++;
-					}
-				}
-				ASSERT(indirect_blocks >= 1);
-
-				if (indirect_blocks > 1) {
-					// 若索引表中还有其他间接块，那么仅在索引表中擦除这个地址
-					all_blocks[block_idx] = 0;
-					ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks+12, 1);
-				} else {
-					//TODO: 这里不先将索引块清零再回收吗？
-					// 否则回收整个索引表
-					block_bitmap_idx =\
-					dir_inode->i_sectors[12] - part->sb->data_start_lba;
-					bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-					bitmap_sync(part, block_bitmap_idx, BLOCK_BITMAP);
-					dir_inode->i_sectors[12] = 0;
-				}
-			}
-		} else { // 仅将该目录项清空
-			memset(dir_entry_found, 0, dir_entry_size);
-			ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
-		}
+		/*
+		仅将该目录项清空，即使该扇区因此空了也不回收，
+		这样目录的块始终连续，不必在 extent 中间打洞，空出的位置会被之后的 sync_dir_entry 重用
+		*/
+		dcache_invalidate(part, dir_inode->i_no, dir_entry_found->filename);
+		memset(dir_entry_found, 0, dir_entry_size);
+		journal_write(part, block_lba, io_buf, 1);
 
 		ASSERT(dir_inode->i_size >= dir_entry_size);
 		dir_inode->i_size -= dir_entry_size;
@@ -383,4 +640,12 @@ bool delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_bu
 		return 1;
 	}
 	return 0;
+}
+
+/* 把分区 part 目录 pdir 中编号为 inode_no 的目录项删除，删除期间读目录的查找结果不放入目录项缓存 */
+bool delete_dir_entry(partition* part, dir* pdir, uint32_t inode_no, void* io_buf) {
+	dcache_dir_begin(part, pdir->inode->i_no);
+	bool ret = do_delete_dir_entry(part, pdir, inode_no, io_buf);
+	dcache_dir_end(part, pdir->inode->i_no);
+	return ret;
 }
\ No newline at end of file
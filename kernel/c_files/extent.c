@@ -0,0 +1,313 @@
+#include "extent.h"
+#include "journal.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "file.h"
+
+/* 清空 inode 的 extent 树，用于新建的 inode */
+void extent_init(inode* inode) {
+	inode->i_extent_cnt = 0;
+	inode->i_extent_depth = 0;
+	memset(inode->i_inline, 0, sizeof(inode->i_inline));
+}
+
+/* 在按 ee_block 升序排列的 cnt 项中二分查找最后一个 ee_block <= lblock 的项，没有则返回 -1 */
+static int32_t extent_search(extent* e, uint16_t cnt, uint32_t lblock) {
+	int32_t lo = 0, hi = (int32_t)cnt - 1, mid, found = -1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		if (e[mid].ee_block <= lblock) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	return found;
+}
+
+/*
+返回文件第 lblock 块所在的扇区地址，没有映射时返回 0
+run_len 不为 NULL 时存入从 lblock 起物理上连续的块数，供调用者一次读写多个扇区
+*/
+uint32_t extent_map(partition* part, inode* inode, uint32_t lblock, uint32_t* run_len) {
+	extent* e = inode->i_extents;
+	uint16_t cnt = inode->i_extent_cnt;
+	uint16_t depth = inode->i_extent_depth;
+	extent_block* blk = NULL;
+	uint32_t lba = 0;
+	int32_t idx;
+
+	while ((idx = extent_search(e, cnt, lblock)) != -1) {
+		if (depth == 0) {
+			if (lblock - e[idx].ee_block < e[idx].ee_len) {
+				lba = e[idx].ee_start + (lblock - e[idx].ee_block);
+				if (run_len != NULL) {
+					*run_len = e[idx].ee_len - (lblock - e[idx].ee_block);
+				}
+			}
+			break;
+		}
+		// 索引项指向下一层的树块，每层只读一个扇区
+		if (blk == NULL) {
+			blk = sys_malloc(sizeof(extent_block));
+		}
+		journal_read(part, e[idx].ee_start, blk, 1);
+		e = blk->entries;
+		cnt = blk->eh_cnt;
+		depth--;
+		ASSERT(blk->eh_depth == depth);
+	}
+
+	if (blk != NULL) {
+		sys_free(blk);
+	}
+	return lba;
+}
+
+/* 分配一个树块并标记块位图，优先靠近扇区地址 goal，返回其扇区地址 */
+static int32_t tree_block_alloc(partition* part, uint32_t goal) {
+	return block_bitmap_alloc(part, goal);
+}
+
+/* 在 e 的第 idx 项处插入 ext，e 中要有 cnt + 1 项的空间 */
+static void entry_insert_at(extent* e, uint16_t* cnt, uint16_t idx, extent* ext) {
+	memmove(&e[idx + 1], &e[idx], (*cnt - idx) * sizeof(extent));
+	e[idx] = *ext;
+	(*cnt)++;
+}
+
+/* 在叶子的 cnt 项中插入 ext，逻辑上和物理上都相连的 extent 会被合并 */
+static void leaf_insert(extent* e, uint16_t* cnt, extent* ext) {
+	int32_t idx = extent_search(e, *cnt, ext->ee_block);
+	extent* prev = idx >= 0 ? &e[idx] : NULL;
+	extent* next = idx + 1 < *cnt ? &e[idx + 1] : NULL;
+
+	if (
+		prev != NULL && prev->ee_block + prev->ee_len == ext->ee_block
+		&& prev->ee_start + prev->ee_len == ext->ee_start
+	) {
+		prev->ee_len += ext->ee_len;
+		// 新的 extent 刚好填上了前后两项之间的空隙
+		if (
+			next != NULL && prev->ee_block + prev->ee_len == next->ee_block
+			&& prev->ee_start + prev->ee_len == next->ee_start
+		) {
+			prev->ee_len += next->ee_len;
+			memmove(next, next + 1, (*cnt - idx - 2) * sizeof(extent));
+			(*cnt)--;
+		}
+		return;
+	}
+
+	if (
+		next != NULL && ext->ee_block + ext->ee_len == next->ee_block
+		&& ext->ee_start + ext->ee_len == next->ee_start
+	) {
+		next->ee_block = ext->ee_block;
+		next->ee_start = ext->ee_start;
+		next->ee_len += ext->ee_len;
+		return;
+	}
+
+	entry_insert_at(e, cnt, idx + 1, ext);
+}
+
+/*
+把 ext 插入到深度为 depth 的节点中，节点的 cnt 项存放在 e 中且还有一项空余
+子树块插入后若超过 EXTENTS_PER_BLOCK 项就分裂成两块，新块的索引插入到本节点
+子树块已满时，在改动任何一层之前先分配好分裂用的树块，
+这样失败只会发生在写日志之前，已经写入日志的下层树块不会因为上层失败而失去索引
+成功返回 0，分配树块失败返回 -1，此时树没有任何改动
+*/
+static int32_t node_insert(partition* part, extent* e, uint16_t* cnt, uint16_t depth, extent* ext) {
+	if (depth == 0) {
+		leaf_insert(e, cnt, ext);
+		return 0;
+	}
+
+	ASSERT(*cnt > 0);
+	int32_t idx = extent_search(e, *cnt, ext->ee_block);
+	// 比所有索引都小时插入第一个子树
+	if (idx == -1) {
+		idx = 0;
+	}
+
+	// 多分配一项的空间，供插入后暂时超出一项
+	extent_block* child = sys_malloc(sizeof(extent_block) + sizeof(extent));
+	if (child == NULL) {
+		return -1;
+	}
+	journal_read(part, e[idx].ee_start, child, 1);
+
+	// 子树块满了，插入后可能要分裂
+	int32_t sibling_lba = -1;
+	extent_block* sibling = NULL;
+	if (child->eh_cnt == EXTENTS_PER_BLOCK) {
+		sibling = sys_malloc(sizeof(extent_block));
+		if (sibling == NULL) {
+			sys_free(child);
+			return -1;
+		}
+		sibling_lba = tree_block_alloc(part, e[idx].ee_start);
+		if (sibling_lba == -1) {
+			printk("extent: alloc tree block failed\n");
+			sys_free(sibling);
+			sys_free(child);
+			return -1;
+		}
+	}
+
+	uint16_t child_cnt = child->eh_cnt;
+	if (node_insert(part, child->entries, &child_cnt, depth - 1, ext) == -1) {
+		if (sibling != NULL) {
+			block_bitmap_free_run(part, sibling_lba, 1);
+			sys_free(sibling);
+		}
+		sys_free(child);
+		return -1;
+	}
+	child->eh_cnt = child_cnt;
+	e[idx].ee_block = child->entries[0].ee_block;
+
+	if (child->eh_cnt > EXTENTS_PER_BLOCK) {
+		// 把后一半移到新的树块中
+		ASSERT(sibling != NULL);
+		memset(sibling, 0, sizeof(extent_block));
+		uint16_t keep = child->eh_cnt / 2;
+		sibling->eh_cnt = child->eh_cnt - keep;
+		sibling->eh_depth = depth - 1;
+		memcpy(sibling->entries, &child->entries[keep], sibling->eh_cnt * sizeof(extent));
+		child->eh_cnt = keep;
+		journal_write(part, sibling_lba, sibling, 1);
+
+		extent index = {sibling->entries[0].ee_block, sibling_lba, 0};
+		entry_insert_at(e, cnt, idx + 1, &index);
+	} else if (sibling != NULL) {
+		// 插入时与相邻的 extent 合并了，不需要分裂
+		block_bitmap_free_run(part, sibling_lba, 1);
+	}
+	if (sibling != NULL) {
+		sys_free(sibling);
+	}
+	journal_write(part, e[idx].ee_start, child, 1);
+	sys_free(child);
+	return 0;
+}
+
+/* 根节点满时把它的所有项移到一个新的树块中，根节点只留下指向它的索引，树长高一层 */
+static int32_t extent_grow(partition* part, inode* inode) {
+	extent_block* blk = sys_malloc(sizeof(extent_block));
+	if (blk == NULL) {
+		return -1;
+	}
+	int32_t block_lba = tree_block_alloc(part, block_group_goal(part, inode->i_no));
+	if (block_lba == -1) {
+		printk("extent: alloc tree block failed\n");
+		sys_free(blk);
+		return -1;
+	}
+	memset(blk, 0, sizeof(extent_block));
+	blk->eh_cnt = inode->i_extent_cnt;
+	blk->eh_depth = inode->i_extent_depth;
+	memcpy(blk->entries, inode->i_extents, blk->eh_cnt * sizeof(extent));
+	journal_write(part, block_lba, blk, 1);
+
+	inode->i_extents[0].ee_block = blk->entries[0].ee_block;
+	inode->i_extents[0].ee_start = block_lba;
+	inode->i_extents[0].ee_len = 0;
+	inode->i_extent_cnt = 1;
+	inode->i_extent_depth++;
+	sys_free(blk);
+	return 0;
+}
+
+/* 把 ext 加入 inode 的 extent 树，ext 不能与已有的映射重叠 */
+static int32_t extent_insert(partition* part, inode* inode, extent* ext) {
+	// 先保证根节点有空余，这样插入时只有树块会分裂
+	if (inode->i_extent_cnt == INODE_EXTENTS) {
+		if (inode->i_extent_depth == EXTENT_MAX_DEPTH) {
+			printk("extent: tree of inode %d is full\n", inode->i_no);
+			return -1;
+		}
+		if (extent_grow(part, inode) == -1) {
+			return -1;
+		}
+	}
+	return node_insert(part, inode->i_extents, &inode->i_extent_cnt, inode->i_extent_depth, ext);
+}
+
+/*
+为文件第 lblock 块起的 cnt 块分配扇区并加入 extent 树，已经有映射的块会被跳过
+分配时尽量紧接在前一块之后，使文件在磁盘上连续，extent 也就更少；前一块没有映射时放在 inode 所在的分配组中
+成功返回 0，失败返回 -1，此时已分配的部分仍然保留在树中
+*/
+int32_t extent_alloc(partition* part, inode* inode, uint32_t lblock, uint32_t cnt) {
+	uint32_t goal = block_group_goal(part, inode->i_no), run_len, got;
+	if (lblock > 0) {
+		uint32_t prev = extent_map(part, inode, lblock - 1, NULL);
+		if (prev != 0) {
+			goal = prev + 1;
+		}
+	}
+
+	while (cnt > 0) {
+		uint32_t mapped = extent_map(part, inode, lblock, &run_len);
+		if (mapped != 0) {
+			run_len = run_len < cnt ? run_len : cnt;
+			lblock += run_len;
+			cnt -= run_len;
+			goal = mapped + run_len;
+			continue;
+		}
+
+		int32_t block_lba = block_bitmap_alloc_run(part, goal, cnt, &got);
+		if (block_lba == -1) {
+			return -1;
+		}
+		extent ext = {lblock, block_lba, got};
+		if (extent_insert(part, inode, &ext) == -1) {
+			block_bitmap_free_run(part, block_lba, got);
+			return -1;
+		}
+		lblock += got;
+		cnt -= got;
+		goal = block_lba + got;
+	}
+	return 0;
+}
+
+/* 把已经在块位图中分配好的、从扇区 block_lba 开始的 cnt 个块映射为文件第 lblock 块起的 cnt 块 */
+int32_t extent_add(partition* part, inode* inode, uint32_t lblock, uint32_t block_lba, uint32_t cnt) {
+	extent ext = {lblock, block_lba, cnt};
+	return extent_insert(part, inode, &ext);
+}
+
+/* 回收深度为 depth 的节点下的所有数据块和树块 */
+static void free_node(partition* part, extent* e, uint16_t cnt, uint16_t depth) {
+	extent_block* child = NULL;
+	uint16_t idx = 0;
+	if (depth > 0) {
+		child = sys_malloc(sizeof(extent_block));
+	}
+	for (; idx < cnt; idx++) {
+		if (depth == 0) {
+			block_bitmap_free_run(part, e[idx].ee_start, e[idx].ee_len);
+			continue;
+		}
+		journal_read(part, e[idx].ee_start, child, 1);
+		free_node(part, child->entries, child->eh_cnt, depth - 1);
+		block_bitmap_free_run(part, e[idx].ee_start, 1);
+	}
+	if (child != NULL) {
+		sys_free(child);
+	}
+}
+
+/* 回收 inode 的所有数据块及 extent 树块，并清空 extent 树 */
+void extent_release(partition* part, inode* inode) {
+	free_node(part, inode->i_extents, inode->i_extent_cnt, inode->i_extent_depth);
+	extent_init(inode);
+}
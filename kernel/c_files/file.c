@@ -2,93 +2,480 @@
 #include "string.h"
 #include "stdio.h"
 #include "file.h"
+#include "extent.h"
+#include "journal.h"
+#include "writeback.h"
+#include "interrupt.h"
 #include "ide.h"
 #include "fs.h"
+#include "page_cache.h"
+
+/* 文件表的一块，块中空闲的项通过 next_free 串成链表 */
+typedef struct {
+	file files[FILE_TABLE_CHUNK];
+	int32_t next_free[FILE_TABLE_CHUNK];
+} file_chunk;
+
+/*
+文件表，因同一文件可被打开多次，故里面有可能有相同的文件
+文件表按块增长，已分配的项不会移动，因此持有 file* 期间文件表增长也是安全的
+*/
+static file_chunk* file_chunks[FILE_TABLE_CHUNKS];
+static uint32_t file_chunk_cnt = 0;
+// 空闲项链表的表头，为 -1 时需要为文件表增加一块
+static int32_t file_free_head = -1;
+static lock file_table_lock;
+
+/* 在内核空间中申请 size 字节，文件表和进程的描述符表都要被所有任务访问 */
+static void* file_kmalloc(uint32_t size) {
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	void* ptr = sys_malloc(size);
+	cur->pgdir = cur_pagedir_bak;
+	return ptr;
+}
+
+/* 释放 file_kmalloc 申请的内存 */
+static void file_kfree(void* ptr) {
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	sys_free(ptr);
+	cur->pgdir = cur_pagedir_bak;
+}
 
-/* 文件表，因同一文件可被打开多次，故里面有可能有相同的文件 */
-file file_table[MAX_FILE_OPEN];
+/* 返回全局描述符 global_fd 对应的文件表项 */
+file* file_get(uint32_t global_fd) {
+	ASSERT(global_fd < file_chunk_cnt * FILE_TABLE_CHUNK);
+	return &file_chunks[global_fd / FILE_TABLE_CHUNK]->files[global_fd % FILE_TABLE_CHUNK];
+}
 
-/* 从文件表 file_table 中获取一个空闲位，成功返回下标，失败返回 -1 */
-int32_t get_free_slot_in_global(void) {
-	// 前三个已经被占用了
-	int idx = 3;
-	for (; idx < MAX_FILE_OPEN; idx++) {
-		if (file_table[idx].fd_inode == NULL) {
-			break;
+/* 为文件表增加一块，新的项都加入空闲链表，调用者需持有 file_table_lock，失败返回 0 */
+static bool file_table_grow(void) {
+	if (file_chunk_cnt == FILE_TABLE_CHUNKS) {
+		return 0;
+	}
+	file_chunk* chunk = file_kmalloc(sizeof(file_chunk));
+	if (chunk == NULL) {
+		return 0;
+	}
+	memset(chunk, 0, sizeof(file_chunk));
+
+	uint32_t base = file_chunk_cnt * FILE_TABLE_CHUNK;
+	file_chunks[file_chunk_cnt++] = chunk;
+	// 倒序加入，使下标小的项先被使用，前三个留给标准输入输出
+	uint32_t idx = FILE_TABLE_CHUNK;
+	while (idx-- > 0) {
+		if (base + idx <= stderr_no) {
+			continue;
 		}
+		chunk->next_free[idx] = file_free_head;
+		file_free_head = base + idx;
 	}
+	return 1;
+}
+
+/* 初始化文件表，先分配一块 */
+void file_table_init(void) {
+	lock_init(&file_table_lock);
+	lock_acquire(&file_table_lock);
+	ASSERT(file_table_grow());
+	lock_release(&file_table_lock);
+}
 
-	if (idx == MAX_FILE_OPEN) {
+/* 从文件表 file_table 中取出一个空闲项，成功返回下标，失败返回 -1 */
+int32_t get_free_slot_in_global(void) {
+	lock_acquire(&file_table_lock);
+	if (file_free_head == -1 && !file_table_grow()) {
+		lock_release(&file_table_lock);
 		printk("exceed max open files\n");
 		return -1;
 	}
+	int32_t idx = file_free_head;
+	file_free_head = file_chunks[idx / FILE_TABLE_CHUNK]->next_free[idx % FILE_TABLE_CHUNK];
+	lock_release(&file_table_lock);
+
+	file* f = file_get(idx);
+	memset(f, 0, sizeof(file));
+	f->fd_refs = 1;
 	return idx;
 }
 
-/* 将全局描述符下标安装到进程或线程自己的文件描述符数组 fd_table 中 */
+/* 把文件表中下标为 global_fd 的项放回空闲链表 */
+void put_free_slot_in_global(uint32_t global_fd) {
+	lock_acquire(&file_table_lock);
+	file_get(global_fd)->fd_inode = NULL;
+	file_chunks[global_fd / FILE_TABLE_CHUNK]->next_free[global_fd % FILE_TABLE_CHUNK] = file_free_head;
+	file_free_head = global_fd;
+	lock_release(&file_table_lock);
+}
+
+/*
+将全局描述符下标安装到进程或线程自己的文件描述符数组 fd_table 中
+fd_table 满了就成倍扩大，最多到 MAX_FD_TABLE_SIZE
+*/
 int32_t pcb_fd_install(int32_t globa_fd_idx) {
 	task_struct* cur = running_thread();
-	int idx = 3;
-	for (; idx < MAX_FILES_OPEN_PER_PROC; idx++) {
+	uint32_t idx = cur->fd_free_hint;
+	for (; idx < cur->fd_table_size; idx++) {
 		if (cur->fd_table[idx] == -1) {
-			cur->fd_table[idx] = globa_fd_idx;
 			break;
 		}
 	}
 
-	if (idx == MAX_FILES_OPEN_PER_PROC) {
-		printk("exceed max open files_per_proc\n");
-		return -1;
+	if (idx == cur->fd_table_size) {
+		uint32_t new_size = cur->fd_table_size * 2;
+		int32_t* new_table = new_size > MAX_FD_TABLE_SIZE ? NULL : file_kmalloc(new_size * sizeof(int32_t));
+		if (new_table == NULL) {
+			printk("exceed max open files_per_proc\n");
+			return -1;
+		}
+		memcpy(new_table, cur->fd_table, cur->fd_table_size * sizeof(int32_t));
+		memset(new_table + cur->fd_table_size, 0xff, (new_size - cur->fd_table_size) * sizeof(int32_t));
+		if (cur->fd_table != cur->fd_inline) {
+			file_kfree(cur->fd_table);
+		}
+		cur->fd_table = new_table;
+		cur->fd_table_size = new_size;
 	}
+	cur->fd_table[idx] = globa_fd_idx;
+	cur->fd_free_hint = idx + 1;
 	return idx;
 }
 
-/* 分配一个 i 结点，返回 i 结点号 */
-int32_t inode_bitmap_alloc(partition* part) {
-	int32_t bit_idx = bitmap_scan(&part->inode_bitmap, 1);
+/*
+fork 时为子进程复制父进程的描述符表，两者的描述符指向同一个文件表项，因此要增加各项的引用数
+pcb 已经被整页复制，这里只需要处理存放在堆中的描述符表，成功返回 0，失败返回 -1
+*/
+int32_t fd_table_copy(task_struct* child_thread, task_struct* parent_thread) {
+	if (parent_thread->fd_table == parent_thread->fd_inline) {
+		child_thread->fd_table = child_thread->fd_inline;
+	} else {
+		child_thread->fd_table = file_kmalloc(parent_thread->fd_table_size * sizeof(int32_t));
+		if (child_thread->fd_table == NULL) {
+			return -1;
+		}
+		memcpy(
+			child_thread->fd_table, parent_thread->fd_table,
+			parent_thread->fd_table_size * sizeof(int32_t)
+		);
+	}
+
+	uint32_t local_fd = stderr_no + 1;
+	for (; local_fd < child_thread->fd_table_size; local_fd++) {
+		int32_t global_fd = child_thread->fd_table[local_fd];
+		if (global_fd != -1) {
+			file_get(global_fd)->fd_refs++;
+		}
+	}
+	return 0;
+}
+
+/*
+确保分区 part 的位图中从 bit_idx 开始的 cnt 位所在的扇区都已读入内存
+挂载时不读位图，每个扇区在第一次被使用时才读入
+*/
+void bitmap_load(partition* part, bitmap_type type, uint32_t bit_idx, uint32_t cnt) {
+	bitmap* btmp = &part->block_bitmap;
+	bitmap* loaded = &part->block_bitmap_loaded;
+	uint32_t bitmap_lba = part->sb->block_bitmap_lba;
+	if (type == INODE_BITMAP) {
+		btmp = &part->inode_bitmap;
+		loaded = &part->inode_bitmap_loaded;
+		bitmap_lba = part->sb->inode_bitmap_lba;
+	}
+	uint32_t sec = bit_idx / BITS_PER_SECTOR;
+	for (; sec <= (bit_idx + cnt - 1) / BITS_PER_SECTOR; sec++) {
+		if (bitmap_scan_test(loaded, sec)) {
+			continue;
+		}
+		// 持有锁读盘，否则两个任务同时读入同一扇区时，后读完的会覆盖先读完的修改
+		lock_acquire(&part->bitmap_load_lock);
+		if (! bitmap_scan_test(loaded, sec)) {
+			ide_read(part->my_disk, bitmap_lba + sec, btmp->bits + sec * SECTOR_SIZE, 1);
+			bitmap_set(loaded, sec, 1);
+		}
+		lock_release(&part->bitmap_load_lock);
+	}
+}
+
+/*
+在分区 part 的位图中从 start 到 end 的范围内逐个扇区地寻找 cnt 个连续的空闲位，只读入扫描过的扇区
+start 和 end 按字节对齐，找到的空闲位不跨越扇区，返回第一位的下标，找不到返回 -1
+*/
+static int32_t bitmap_scan_lazy(partition* part, bitmap_type type, uint32_t start, uint32_t end, uint32_t cnt) {
+	bitmap* btmp = type == INODE_BITMAP ? &part->inode_bitmap : &part->block_bitmap;
+	while (start < end) {
+		uint32_t sec_end = (start / BITS_PER_SECTOR + 1) * BITS_PER_SECTOR;
+		sec_end = sec_end < end ? sec_end : end;
+		bitmap_load(part, type, start, 1);
+		bitmap sec_btmp = {(sec_end - start) / 8, btmp->bits + start / 8};
+		int32_t bit_idx = bitmap_scan(&sec_btmp, cnt);
+		if (bit_idx != -1) {
+			return start + bit_idx;
+		}
+		start = sec_end;
+	}
+	return -1;
+}
+
+/*
+从第 goal_group 个分配组开始依次在各组中寻找 cnt 个连续的空闲位，空闲计数不够的组不用读入位图
+返回第一位的下标，找不到返回 -1
+*/
+static int32_t group_scan(partition* part, bitmap_type type, uint32_t goal_group, uint32_t cnt) {
+	struct super_block* sb = part->sb;
+	uint32_t per_group = sb->blocks_per_group;
+	uint32_t bit_len = part->block_bitmap.btmp_bytes_len * 8;
+	if (type == INODE_BITMAP) {
+		per_group = sb->inodes_per_group;
+		bit_len = sb->inode_cnt;
+	}
+	uint32_t idx = 0;
+	for (; idx < sb->group_cnt; idx++) {
+		uint32_t group = (goal_group + idx) % sb->group_cnt;
+		group_desc* gd = &sb->groups[group];
+		if ((type == INODE_BITMAP ? gd->free_inodes : gd->free_blocks) < cnt) {
+			continue;
+		}
+		uint32_t start = group * per_group;
+		uint32_t end = start + per_group < bit_len ? start + per_group : bit_len;
+		int32_t bit_idx = bitmap_scan_lazy(part, type, start, end, cnt);
+		if (bit_idx != -1) {
+			return bit_idx;
+		}
+	}
+	return -1;
+}
+
+/* 分配一个 i 结点，优先在第 goal_group 个分配组中分配，返回 i 结点号 */
+int32_t inode_bitmap_alloc(partition* part, uint32_t goal_group) {
+	// 分区已满时不用扫描整个位图
+	if (part->sb->free_inode_cnt == 0) {
+		return -1;
+	}
+	int32_t bit_idx = group_scan(part, INODE_BITMAP, goal_group, 1);
 	if (bit_idx == -1) {
 		return -1;
 	}
 	bitmap_set(&part->inode_bitmap, bit_idx, 1);
+	part->sb->free_inode_cnt--;
+	part->sb->groups[INODE_GROUP(part->sb, bit_idx)].free_inodes--;
 	return bit_idx;
 }
 
-/* 分配一个空闲块，返回其扇区地址 */
-int32_t block_bitmap_alloc(partition* part) {
-	int32_t bit_idx = bitmap_scan(&part->block_bitmap, 1);
-	if (bit_idx == -1) {
+/* 回收 i 结点 inode_no，并标记 inode 位图 */
+void inode_bitmap_free(partition* part, uint32_t inode_no) {
+	bitmap_load(part, INODE_BITMAP, inode_no, 1);
+	bitmap_set(&part->inode_bitmap, inode_no, 0);
+	part->sb->free_inode_cnt++;
+	part->sb->groups[INODE_GROUP(part->sb, inode_no)].free_inodes++;
+	bitmap_mark_dirty(part, inode_no, INODE_BITMAP);
+}
+
+/* 返回 inode_no 所在分配组的第一个数据块的扇区地址，文件的数据优先放在这里之后 */
+uint32_t block_group_goal(partition* part, uint32_t inode_no) {
+	struct super_block* sb = part->sb;
+	return sb->data_start_lba + INODE_GROUP(sb, inode_no) * sb->blocks_per_group;
+}
+
+/* 分配一个空闲块，优先分配扇区地址 goal 处或与它同组的块，返回其扇区地址 */
+int32_t block_bitmap_alloc(partition* part, uint32_t goal) {
+	uint32_t cnt;
+	return block_bitmap_alloc_run(part, goal, 1, &cnt);
+}
+
+/*
+分配至多 max_cnt 个连续的空闲块，优先从扇区地址 goal 处开始，找不到就从 goal 所在的分配组起另找一段足够长的，
+再不行就从该组起找第一个空闲块，实际分配的块数存入 cnt，返回起始扇区地址，失败返回 -1
+*/
+int32_t block_bitmap_alloc_run(partition* part, uint32_t goal, uint32_t max_cnt, uint32_t* cnt) {
+	struct super_block* sb = part->sb;
+	bitmap* btmp = &part->block_bitmap;
+	uint32_t bit_len = btmp->btmp_bytes_len * 8;
+	uint32_t data_start = sb->data_start_lba;
+	uint32_t goal_group = 0;
+	int32_t bit_idx = -1;
+	if (sb->free_block_cnt == 0) {
 		return -1;
 	}
-	bitmap_set(&part->block_bitmap, bit_idx, 1);
-	return (part->sb->data_start_lba + bit_idx);
+
+	if (goal >= data_start && goal - data_start < bit_len) {
+		goal_group = BLOCK_GROUP(sb, goal - data_start);
+		bitmap_load(part, BLOCK_BITMAP, goal - data_start, 1);
+		if (!bitmap_scan_test(btmp, goal - data_start)) {
+			bit_idx = goal - data_start;
+		}
+	}
+	if (bit_idx == -1 && max_cnt > 1) {
+		bit_idx = group_scan(part, BLOCK_BITMAP, goal_group, max_cnt);
+	}
+	if (bit_idx == -1) {
+		bit_idx = group_scan(part, BLOCK_BITMAP, goal_group, 1);
+		if (bit_idx == -1) {
+			return -1;
+		}
+	}
+
+	uint32_t got = 0;
+	while (got < max_cnt && bit_idx + got < bit_len) {
+		// 这段块延伸到下一个扇区时先读入它
+		if ((bit_idx + got) % BITS_PER_SECTOR == 0) {
+			bitmap_load(part, BLOCK_BITMAP, bit_idx + got, 1);
+		}
+		if (bitmap_scan_test(btmp, bit_idx + got)) {
+			break;
+		}
+		bitmap_set(btmp, bit_idx + got, 1);
+		// 这段块可能跨越分配组
+		sb->groups[BLOCK_GROUP(sb, bit_idx + got)].free_blocks--;
+		got++;
+	}
+	sb->free_block_cnt -= got;
+
+	// 标记这段块涉及到的每个位图扇区
+	uint32_t sec = bit_idx / BITS_PER_SECTOR;
+	for (; sec <= (bit_idx + got - 1) / BITS_PER_SECTOR; sec++) {
+		bitmap_mark_dirty(part, sec * BITS_PER_SECTOR, BLOCK_BITMAP);
+	}
+	*cnt = got;
+	return data_start + bit_idx;
 }
 
-/* 将内存中 bitmap 第 bit_idx 位所在的 512 字节同步到硬盘 */
-void bitmap_sync(partition* part, uint32_t bit_idx, bitmap_type btmp) {
-	// 计算本结点索引所在扇区相对于位图的扇区偏移量
-	uint32_t off_sec = bit_idx / BITS_PER_SECTOR;
-	// 计算本结点索引所在扇区相对于位图的字节偏移量
-	uint32_t off_size = off_sec * BLOCK_SIZE;
-	uint32_t sec_lba;
-	uint8_t* bitmap_off;
+/* 回收从扇区地址 block_lba 开始的 cnt 个块，并标记块位图 */
+void block_bitmap_free_run(partition* part, uint32_t block_lba, uint32_t cnt) {
+	struct super_block* sb = part->sb;
+	ASSERT(block_lba > sb->data_start_lba && cnt > 0);
+	uint32_t bit_idx = block_lba - sb->data_start_lba;
+	bitmap_load(part, BLOCK_BITMAP, bit_idx, cnt);
+	uint32_t idx = 0;
+	for (; idx < cnt; idx++) {
+		bitmap_set(&part->block_bitmap, bit_idx + idx, 0);
+		sb->groups[BLOCK_GROUP(sb, bit_idx + idx)].free_blocks++;
+	}
+	sb->free_block_cnt += cnt;
+	// 这些块可能是事务中的元数据块，之后被当作数据块直接写入时不能再被提交覆盖
+	journal_forget(part, block_lba, cnt);
+	uint32_t sec = bit_idx / BITS_PER_SECTOR;
+	for (; sec <= (bit_idx + cnt - 1) / BITS_PER_SECTOR; sec++) {
+		bitmap_mark_dirty(part, sec * BITS_PER_SECTOR, BLOCK_BITMAP);
+	}
+}
 
-	switch (btmp) {
-	case INODE_BITMAP:
-		sec_lba = part->sb->inode_bitmap_lba + off_sec;
-		bitmap_off = part->inode_bitmap.bits + off_size;
-		break;
-	case BLOCK_BITMAP:
-		sec_lba = part->sb->block_bitmap_lba + off_sec;
-		bitmap_off = part->block_bitmap.bits + off_size;
-		break;
+/*
+将内存中 bitmap 第 bit_idx 位所在的扇区标记为脏，之后由 bitmap_flush 成批写回
+分配出的块和 inode 被其他元信息引用之前必须先调用 bitmap_flush，见 inode_sync 和 sync_dir_entry
+*/
+void bitmap_mark_dirty(partition* part, uint32_t bit_idx, bitmap_type btmp) {
+	bitmap* dirty = (btmp == INODE_BITMAP) ? &part->inode_bitmap_dirty : &part->block_bitmap_dirty;
+	intr_status old_status = intr_disable();
+	bitmap_set(dirty, bit_idx / BITS_PER_SECTOR, 1);
+	intr_set_status(old_status);
+}
+
+/* 在块位图第 sec 个扇区的副本 sec_buf 中清除预分配窗口里剩余的块，调用者需持有日志锁 */
+static void prealloc_mask(partition* part, uint32_t sec, uint8_t* sec_buf) {
+	uint32_t sec_start = sec * BITS_PER_SECTOR;
+	intr_status old_status = intr_disable();
+	struct list_elem* elem = part->prealloc_windows.head.next;
+	while (elem != &part->prealloc_windows.tail) {
+		inode_delay* d = elem2entry(inode_delay, pa_tag, elem);
+		uint32_t bit_idx = d->pa_start - part->sb->data_start_lba;
+		uint32_t end = bit_idx + d->pa_len;
+		bit_idx = bit_idx > sec_start ? bit_idx : sec_start;
+		end = end < sec_start + BITS_PER_SECTOR ? end : sec_start + BITS_PER_SECTOR;
+		for (; bit_idx < end; bit_idx++) {
+			uint32_t off = bit_idx - sec_start;
+			sec_buf[off / 8] &= ~(1 << (off % 8));
+		}
+		elem = elem->next;
 	}
+	intr_set_status(old_status);
+}
+
+/* 把 sb 中的空闲计数加上各预分配窗口中剩余的块数，sb 是将要写入日志的超级块副本 */
+void prealloc_unreserve_counts(partition* part, struct super_block* sb) {
+	intr_status old_status = intr_disable();
+	struct list_elem* elem = part->prealloc_windows.head.next;
+	while (elem != &part->prealloc_windows.tail) {
+		inode_delay* d = elem2entry(inode_delay, pa_tag, elem);
+		uint32_t bit_idx = d->pa_start - sb->data_start_lba;
+		uint32_t idx = 0;
+		// 窗口可能跨越分配组
+		for (; idx < d->pa_len; idx++) {
+			sb->groups[BLOCK_GROUP(sb, bit_idx + idx)].free_blocks++;
+		}
+		sb->free_block_cnt += d->pa_len;
+		elem = elem->next;
+	}
+	intr_set_status(old_status);
+}
+
+/*
+将位图 btmp 中由 dirty 标记的扇区写入日志中从 bitmap_lba 开始的 sects 个扇区，相邻的脏扇区合并为一次写，写了扇区时返回 1
+块位图的扇区逐个复制后去掉预分配窗口再写入
+*/
+static bool bitmap_flush_one(
+	partition* part, bitmap* btmp, bitmap* dirty,
+	uint32_t bitmap_lba, uint32_t sects
+) {
+	bool flushed = 0;
+	uint32_t sec = 0;
+	while (sec < sects) {
+		if (! bitmap_scan_test(dirty, sec)) {
+			sec++;
+			continue;
+		}
+		// 先清除脏标记再写，写的过程中再被修改的扇区会重新被标记
+		uint32_t run = 0;
+		intr_status old_status = intr_disable();
+		while (sec + run < sects && bitmap_scan_test(dirty, sec + run)) {
+			bitmap_set(dirty, sec + run, 0);
+			run++;
+		}
+		intr_set_status(old_status);
+		if (btmp == &part->block_bitmap && ! list_empty(&part->prealloc_windows)) {
+			uint8_t sec_buf[SECTOR_SIZE];
+			uint32_t idx = 0;
+			for (; idx < run; idx++) {
+				memcpy(sec_buf, btmp->bits + (sec + idx) * SECTOR_SIZE, SECTOR_SIZE);
+				prealloc_mask(part, sec + idx, sec_buf);
+				journal_write(part, bitmap_lba + sec + idx, sec_buf, 1);
+			}
+		} else {
+			journal_write(part, bitmap_lba + sec, btmp->bits + sec * SECTOR_SIZE, run);
+		}
+		sec += run;
+		flushed = 1;
+	}
+	return flushed;
+}
 
-	ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+/* 将分区 part 的两个位图中所有的脏扇区和超级块中的空闲计数写入日志 */
+void bitmap_flush(partition* part) {
+	// 先持有日志锁再持有位图锁，与在元数据操作中被调用时的顺序一致
+	journal_begin(part);
+	lock_acquire(&part->bitmap_flush_lock);
+	bool flushed = bitmap_flush_one(
+		part, &part->inode_bitmap, &part->inode_bitmap_dirty,
+		part->sb->inode_bitmap_lba, part->sb->inode_bitmap_sects
+	);
+	flushed |= bitmap_flush_one(
+		part, &part->block_bitmap, &part->block_bitmap_dirty,
+		part->sb->block_bitmap_lba, part->sb->block_bitmap_sects
+	);
+	// 空闲计数随位图一起进入日志
+	if (flushed) {
+		super_block_sync(part, FS_DIRTY);
+	}
+	lock_release(&part->bitmap_flush_lock);
+	journal_end(part);
 }
 
-extern partition* cur_part;
 /* 创建文件，若成功则返回文件描述符，否则返回 -1 */
 int32_t file_create(dir* parent_dir, char* filename, uint8_t flag) {
+	partition* part = parent_dir->inode->i_part;
 	void* io_buf = sys_malloc(1024);
 	if (io_buf == NULL) {
 		printk("in file_create: sys_malloc for io_buf failed\n");
@@ -98,13 +485,16 @@ int32_t file_create(dir* parent_dir, char* filename, uint8_t flag) {
 	// 用于操作失败时回滚各资源状态
 	uint8_t rollback_step = 0;
 
-	int32_t inode_no = inode_bitmap_alloc(cur_part);
+	// 新文件的 inode 放在父目录所在的分配组中
+	int32_t inode_no = inode_bitmap_alloc(part, INODE_GROUP(part->sb, parent_dir->inode->i_no));
 	if (inode_no == -1) {
 		printk("in file_create: allocate inode failed\n");
 		return -1;
 	}
+	// sync_dir_entry 写入引用它的目录项之前会先写回 inode_bitmap
+	bitmap_mark_dirty(part, inode_no, INODE_BITMAP);
 
-	inode* new_file_inode = sys_malloc(sizeof(inode));
+	inode* new_file_inode = inode_alloc();
 	if (new_file_inode == NULL) {
 		printk("file_create: sys_malloc for inode failed\n");
 		rollback_step = 1;
@@ -112,6 +502,8 @@ int32_t file_create(dir* parent_dir, char* filename, uint8_t flag) {
 	}
 	// 初始化这个新的 inode
 	inode_init(inode_no, new_file_inode);
+	// 新文件的数据先内联在 inode 中，写得放不下时再转换为用块存放
+	new_file_inode->i_flags = INODE_INLINE;
 
 	// 获取 file_table 中空闲的下标
 	int fd_idx = get_free_slot_in_global();
@@ -120,15 +512,10 @@ int32_t file_create(dir* parent_dir, char* filename, uint8_t flag) {
 		goto rollback;
 	}
 
-	file_table[fd_idx].fd_inode = new_file_inode;
-	file_table[fd_idx].fd_pos = 0;
-	file_table[fd_idx].fd_flag = flag;
-	if (flag & O_WRONLY || flag & O_RDWR) {
-		// 只要有可能写文件，就考虑是否有其他进程也在写
-		intr_status old_status = intr_disable();
-		file_table[fd_idx].fd_inode->write_deny = 1;
-		intr_set_status(old_status);
-	}
+	file* new_file = file_get(fd_idx);
+	new_file->fd_inode = new_file_inode;
+	new_file->fd_pos = 0;
+	new_file->fd_flag = flag;
 
 	dir_entry new_dir_entry;
 	memset(&new_dir_entry, 0, sizeof(dir_entry));
@@ -143,62 +530,61 @@ int32_t file_create(dir* parent_dir, char* filename, uint8_t flag) {
 
 	// 将父目录 inode 的内容同步到硬盘
 	memset(io_buf, 0, 1024);
-	inode_sync(cur_part, parent_dir->inode, io_buf);
+	inode_sync(part, parent_dir->inode, io_buf);
 
 	// 将新创建的 inode 结点同步到硬盘
 	memset(io_buf, 0, 1024);
-	inode_sync(cur_part, new_file_inode, io_buf);
+	inode_sync(part, new_file_inode, io_buf);
 
-	// 将 inode_bitmap 同步到硬盘
-	bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
-	// 将创建的文件 inode 添加到 open_inodes 链表
-	list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
+	// 将创建的文件 inode 添加到 inode 缓存
+	inode_cache_add(part, new_file_inode);
 
 	sys_free(io_buf);
 	// TODO: 这里不会只安装在内核线程中吗
-	return pcb_fd_install(fd_idx);
+	int32_t fd = pcb_fd_install(fd_idx);
+	if (fd == -1) {
+		// 文件已经创建好了，只是没法打开
+		file_close(new_file);
+		put_free_slot_in_global(fd_idx);
+	}
+	return fd;
 
 rollback:
 	switch (rollback_step) {
 	case 3:
-		memset(&file_table[fd_idx], 0, sizeof(file));
+		put_free_slot_in_global(fd_idx);
+		// fall through
 	case 2:
-		sys_free(new_file_inode);
+		inode_free(new_file_inode);
+		// fall through
 	case 1:
-		bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
+		inode_bitmap_free(part, inode_no);
 		break;
 	}
 	sys_free(io_buf);
 	return -1;
 }
 
-/* 打开编号为 inode_no 的 inode 对应的文件，成功返回描述符，否则返回 -1 */
-int32_t file_open(uint32_t inode_no, uint8_t flag) {
+/* 打开分区 part 上编号为 inode_no 的 inode 对应的文件，成功返回描述符，否则返回 -1 */
+int32_t file_open(partition* part, uint32_t inode_no, uint8_t flag) {
 	int fd_idx = get_free_slot_in_global();
 	if (fd_idx == -1) {
 		printk("exceed max open files\n");
 		return -1;
 	}
 
-	file_table[fd_idx].fd_inode = inode_open(cur_part, inode_no);
-	file_table[fd_idx].fd_pos = 0;
-	file_table[fd_idx].fd_flag = flag;
-	bool* write_deny = &file_table[fd_idx].fd_inode->write_deny;
-
-	if (flag & O_WRONLY || flag & O_RDWR) {
-		// 只要有可能写文件，就考虑是否有其他进程也在写
-		intr_status old_status = intr_disable();
-		if (! (*write_deny)) {
-			*write_deny = 1;
-			intr_set_status(old_status);
-		} else {
-			intr_set_status(old_status);
-			printk("file can not be write now, try again later\n");
-			return -1;
-		}
+	file* opened = file_get(fd_idx);
+	opened->fd_inode = inode_open(part, inode_no);
+	opened->fd_pos = 0;
+	opened->fd_flag = flag;
+	// 多个描述符可以同时写同一个文件，读写之间由 inode 的读写锁和字节范围锁互斥
+	int32_t fd = pcb_fd_install(fd_idx);
+	if (fd == -1) {
+		file_close(opened);
+		put_free_slot_in_global(fd_idx);
 	}
-	return pcb_fd_install(fd_idx);
+	return fd;
 }
 
 /* 关闭文件，成功返回 0，失败返回 -1 */
@@ -206,275 +592,440 @@ int32_t file_close(file* file) {
 	if (file == NULL) {
 		return -1;
 	}
-	/*
-	由于 file_open 保证了同一时刻一个文件只可能出现一个对应的可写 file* 结构
-	因此这里不需要关中断来保证原子操作
-	*/
-	if (file->fd_flag & O_WRONLY || file->fd_flag & O_RDWR) {
-		file->fd_inode->write_deny = 0;
-	}
+	partition* part = file->fd_inode->i_part;
 	inode_close(file->fd_inode);
+	bitmap_flush(part);
 	// 这里使 file_table 对应的项目可用
 	file->fd_inode = NULL;
 	return 0;
 }
 
-/* 把 buf 中的 count 个字节写入 file，成功返回写入的字节数，失败返回 -1 */
-int32_t file_write(file* file, const void*buf, uint32_t count) {
-	// TODO: 如果 count 等于 uint32_t 的最大值不是也会返回 -1 吗
+/* 窗口 d 中的块用完或被归还，从分区的 prealloc_windows 链表中去掉 */
+static void prealloc_unlist(inode_delay* d) {
+	intr_status old_status = intr_disable();
+	list_remove(&d->pa_tag);
+	intr_set_status(old_status);
+}
 
-	if ((file->fd_inode->i_size + count) > (BLOCK_SIZE * 140)) {
-		// 文件目前最大只支持 512*140=71680 字节
-		printk("exceed max file_size 71680 bytes, write file failed\n");
-		return -1;
+/* 归还预分配窗口中剩余的块 */
+static void prealloc_drop(partition* part, inode_delay* d) {
+	if (d->pa_len > 0) {
+		prealloc_unlist(d);
+		block_bitmap_free_run(part, d->pa_start, d->pa_len);
+		d->pa_len = 0;
 	}
+}
+
+/*
+为文件 in 的第 lblock 块起的 cnt 块分配物理块，已经有映射的块会被跳过
+优先从预分配窗口中取，窗口用完后紧接着文件末尾再预分配一个更大的窗口
+成功返回 0，失败返回 -1，此时已分配的部分仍然保留在树中
+*/
+static int32_t delay_alloc(partition* part, inode* in, uint32_t lblock, uint32_t cnt) {
+	inode_delay* d = in->i_delay;
+	while (cnt > 0) {
+		if (extent_map(part, in, lblock, NULL) != 0) {
+			lblock++; cnt--;
+			continue;
+		}
+		if (d->pa_len == 0) {
+			uint32_t goal = block_group_goal(part, in->i_no), got;
+			uint32_t prev;
+			if (lblock > 0 && (prev = extent_map(part, in, lblock - 1, NULL)) != 0) {
+				goal = prev + 1;
+			}
+			uint32_t want = cnt > d->pa_window ? cnt : d->pa_window;
+			int32_t block_lba = block_bitmap_alloc_run(part, goal, want, &got);
+			if (block_lba == -1) {
+				return -1;
+			}
+			d->pa_start = block_lba;
+			d->pa_len = got;
+			intr_status old_status = intr_disable();
+			list_append(&part->prealloc_windows, &d->pa_tag);
+			intr_set_status(old_status);
+			if (d->pa_window < PREALLOC_MAX_BLOCKS) {
+				d->pa_window *= 2;
+			}
+		}
+		uint32_t take = cnt < d->pa_len ? cnt : d->pa_len;
+		if (extent_add(part, in, lblock, d->pa_start, take) == -1) {
+			return -1;
+		}
+		// 这些块离开了窗口，它们在位图中的位要随所在的扇区写入日志
+		uint32_t bit_idx = d->pa_start - part->sb->data_start_lba;
+		uint32_t sec = bit_idx / BITS_PER_SECTOR;
+		for (; sec <= (bit_idx + take - 1) / BITS_PER_SECTOR; sec++) {
+			bitmap_mark_dirty(part, sec * BITS_PER_SECTOR, BLOCK_BITMAP);
+		}
+		d->pa_start += take;
+		d->pa_len -= take;
+		if (d->pa_len == 0) {
+			prealloc_unlist(d);
+		}
+		lblock += take;
+		cnt -= take;
+	}
+	return 0;
+}
 
-	uint8_t* io_buf = sys_malloc(512);
+extern uint32_t ticks;
+
+/* 分配缓冲并把 inode in 写入日志，成功返回 1，失败返回 0 */
+static bool inode_sync_alloc(partition* part, inode* in) {
+	// 磁盘 inode 不跨扇区，inode_sync 只操作一个扇区
+	uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
 	if (io_buf == NULL) {
-		printk("file_write: sys_malloc for io_buf failed\n");
-		return -1;
+		printk("inode_sync_alloc: sys_malloc for io_buf failed\n");
+		return 0;
 	}
+	inode_sync(part, in, io_buf);
+	sys_free(io_buf);
+	return 1;
+}
 
-	// 用来记录文件所有的块地址
-	uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
-	if (all_blocks == NULL) {
-		printk("file_write: sys_malloc for all_blocks failed\n");
-		return -1;
+/* 缓冲 d 变脏，按变脏的先后加入分区 part 的脏文件链表 */
+static void delay_mark_dirty(partition* part, inode_delay* d) {
+	intr_status old_status = intr_disable();
+	d->dirty = 1;
+	d->dirty_tick = ticks;
+	list_append(&part->dirty_inodes, &d->dirty_tag);
+	part->dirty_cnt++;
+	intr_set_status(old_status);
+}
+
+/* 缓冲 d 中的数据已经写回或被丢弃，从分区 part 的脏文件链表中去掉 */
+static void delay_mark_clean(partition* part, inode_delay* d) {
+	intr_status old_status = intr_disable();
+	if (d->dirty) {
+		d->dirty = 0;
+		list_remove(&d->dirty_tag);
+		part->dirty_cnt--;
 	}
+	intr_set_status(old_status);
+}
 
-	// 用 src 指向 buf 中待写入的数据
-	const uint8_t* src = buf;
-	// 用来记录已写入数据大小
-	uint32_t bytes_written = 0;
-	// 用来记录未写入数据大小
-	uint32_t size_left = count;
-	// 块地址
-	int32_t block_lba = -1;
-	// 用来记录 block 对应于 block_bitmap 中的索引，作为参数传给 bitmap_sync
-	uint32_t block_bitmap_idx = 0;
-
-	// 用来索引扇区
-	uint32_t sec_idx;
-	// 扇区地址
-	uint32_t sec_lba;
-	// 扇区内字节偏移量
-	uint32_t sec_off_bytes;
-	// 扇区内剩余字节量
-	uint32_t sec_left_bytes;
-	// 每次写入硬盘的数据块大小
-	uint32_t chunk_size;
-	// 用来获取一级间接表地址
-	int32_t indirect_block_table;
-	// 块索引
-	uint32_t block_idx;
-
-	/* 判断文件是否是第一次写，如果是，先为其分配一个块 */
-	if (file->fd_inode->i_sectors[0] == 0) {
-		block_lba = block_bitmap_alloc(cur_part);
-		if (block_lba == -1) {
-			printk("file_write: block_bitmap_alloc failed\n");
-			return -1;
+/*
+写回文件 in 的延迟分配缓冲：先为缓冲中的块分配一段尽量连续的物理块，
+再按 extent 的连续段成批写入，最后同步 inode
+分配失败时文件被截断到最后一个已分配的块，并丢弃其后的数据
+*/
+void delay_flush(partition* part, inode* in) {
+	rwlock_write_acquire(&in->i_rwlock);
+	inode_delay* d = in->i_delay;
+	if (d == NULL || ! d->dirty) {
+		rwlock_write_release(&in->i_rwlock);
+		return;
+	}
+	uint32_t end = DIV_ROUND_UP(in->i_size, BLOCK_SIZE);
+	if (delay_alloc(part, in, d->first_block, end - d->first_block) == -1) {
+		printk("delay_flush: allocate blocks for inode %d failed\n", in->i_no);
+	}
+
+	uint32_t lblock = d->first_block, block_lba, run_len, secs;
+	while (lblock < end) {
+		block_lba = extent_map(part, in, lblock, &run_len);
+		if (block_lba == 0) {
+			in->i_size = lblock * BLOCK_SIZE;
+			break;
 		}
+		secs = run_len < end - lblock ? run_len : end - lblock;
+		ide_write(
+			part->my_disk, block_lba,
+			d->buf + (lblock - d->first_block) * BLOCK_SIZE, secs
+		);
+		lblock += secs;
+	}
+	delay_mark_clean(part, d);
+	inode_sync_alloc(part, in);
+	rwlock_write_release(&in->i_rwlock);
+}
 
-		file->fd_inode->i_sectors[0] = block_lba;
-		/* 每分配一个块就将位图同步到硬盘 */
-		block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-		ASSERT(block_bitmap_idx >= 0);
-		bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-	}
-
-	/*
-	写入 count 个字节前，该文件已经占用的块数
-	TODO: 为什么不用向上取整除，这个 +1 是否有问题
-	*/
-	uint32_t file_has_used_blocks = file->fd_inode->i_size / BLOCK_SIZE + 1;
-
-	/*
-	存储 count 字节后该文件将占用的块数
-	TODO: 同上
-	*/
-	uint32_t file_will_use_blocks =\
-	(file->fd_inode->i_size + count) / BLOCK_SIZE + 1;
-	ASSERT(file_will_use_blocks <= 140);
-
-	/* 通过此增量判断是否需要分配扇区，如增量为 0，表示原扇区够用 */
-	uint32_t add_blocks = file_will_use_blocks - file_has_used_blocks;
-	/*
-	将写文件所用到的块地址收集到 all_blocks，系统中块大小等于扇区大小，
-	后面都统一在 all_blocks 中获取写入扇区地址
-	*/
-	if (add_blocks == 0) {
-		/* 在同一扇区内写入数据，不涉及到分配新扇区 */
-		if (file_will_use_blocks <= 12 ) { // 文件数据量将在 12 块之内
-			// 指向最后一个已有数据的扇区
-			block_idx = file_has_used_blocks - 1;
-			all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-		} else {
-			/* 未写入新数据之前已经占用了间接块，需要将间接块地址读进来 */
-			ASSERT(file->fd_inode->i_sectors[12] != 0);
-			indirect_block_table = file->fd_inode->i_sectors[12];
-			ide_read(
-				cur_part->my_disk, indirect_block_table,
-				all_blocks + 12, 1
-			);
-		}
-	}else{
-/* 若有增量，便涉及到分配新扇区及是否分配一级间接块表， 下面要分三种情况处理 */
-/* 第一种情况:12 个直接块够用*/
-		if (file_will_use_blocks <= 12) {
-			/* 先将有剩余空间的可继续用的扇区地址写入 all_blocks */
-			block_idx = file_has_used_blocks - 1;
-			ASSERT(file->fd_inode->i_sectors[block_idx] != 0);
-			all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-
-			/* 再将未来要用的扇区分配好后写入 all_blocks */
-			block_idx = file_has_used_blocks; // 指向第一个要分配的新扇区
-			while (block_idx < file_will_use_blocks) {
-				block_lba = block_bitmap_alloc(cur_part);
-				if (block_lba == -1) {
-					printk("file_write: block_bitmap_alloc for situation 1 failed\n");
-					return -1;
-				}
+/* 写回 (discard 为 1 时丢弃) 文件 in 的延迟分配缓冲，归还预分配窗口，并释放延迟分配状态 */
+void delay_release(partition* part, inode* in, bool discard) {
+	rwlock_write_acquire(&in->i_rwlock);
+	inode_delay* d = in->i_delay;
+	if (d == NULL) {
+		rwlock_write_release(&in->i_rwlock);
+		return;
+	}
+	if (! discard) {
+		delay_flush(part, in);
+	}
+	delay_mark_clean(part, d);
+	prealloc_drop(part, d);
+	in->i_delay = NULL;
 
-				/* 写文件时，不应该存在块未使用，但已经分配扇区的情况， 当文件删除时，就会把块地址清0 */
-				ASSERT(file->fd_inode->i_sectors[block_idx] == 0); // 确保尚未分配扇区地址
-				file->fd_inode->i_sectors[block_idx] = \
-				all_blocks[block_idx] = block_lba;
+	// 与 inode 一样放在内核空间中
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	sys_free(d);
+	cur->pgdir = cur_pagedir_bak;
+	rwlock_write_release(&in->i_rwlock);
+}
 
-				/* 每分配一个块就将位图同步到硬盘 */
-				block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-				bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-				block_idx++; // 下一个分配的新扇区
-			}
-		} else if (file_has_used_blocks <= 12 && file_will_use_blocks > 12) {
-/* 第二种情况: 旧数据在 12 个直接块内，新数据将使用间接块*/
+/*
+尝试把 count 个字节追加到文件 in 的延迟分配缓冲中，放不下时返回 0，由调用者直接写盘
+缓冲为空时从文件的末块开始，若末块已经分配但没有写满，就先把它读进来
+*/
+static bool delay_append(partition* part, inode* in, const void* src, uint32_t count) {
+	inode_delay* d = in->i_delay;
+	if (d == NULL) {
+		task_struct* cur = running_thread();
+		uint32_t* cur_pagedir_bak = cur->pgdir;
+		cur->pgdir = NULL;
+		d = sys_malloc(sizeof(inode_delay));
+		cur->pgdir = cur_pagedir_bak;
+		if (d == NULL) {
+			return 0;
+		}
+		d->dirty = 0;
+		d->owner = in;
+		d->pa_len = 0;
+		d->pa_window = PREALLOC_MIN_BLOCKS;
+		in->i_delay = d;
+	}
 
-			/* 先将有剩余空间的可继续用的扇区地址收集到 all_blocks */
-			block_idx = file_has_used_blocks - 1;
+	uint32_t first_block = d->dirty ? d->first_block : in->i_size / BLOCK_SIZE;
+	if (DIV_ROUND_UP(in->i_size + count, BLOCK_SIZE) - first_block > DELAY_BUF_BLOCKS) {
+		return 0;
+	}
+	if (! d->dirty) {
+		d->first_block = first_block;
+		if (in->i_size % BLOCK_SIZE != 0) {
+			uint32_t block_lba = extent_map(part, in, first_block, NULL);
+			ASSERT(block_lba != 0);
+			ide_read(part->my_disk, block_lba, d->buf, 1);
+		}
+		delay_mark_dirty(part, d);
+	}
+	memcpy(d->buf + (in->i_size - first_block * BLOCK_SIZE), src, count);
+	in->i_size += count;
+	return 1;
+}
 
-			// 指向旧数据所在的最后一个扇区
-			all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
+static int32_t do_file_write(file* file, const void*buf, uint32_t count);
+
+/*
+追加的第一步，调用者持有日志锁和 inode 的写锁
+较小的写入放进内联区或延迟分配缓冲后就完成了，返回 1；
+放不下的大块写入先写回缓冲，再为新数据分配好块，返回 0，数据由 append_data 在不持有日志锁时写入；失败返回 -1
+*/
+static int32_t append_prepare(file* file, const void* buf, uint32_t count) {
+	inode* f_inode = file->fd_inode;
+	partition* part = f_inode->i_part;
+	if (f_inode->i_size + count < f_inode->i_size) {
+		printk("exceed max file_size, write file failed\n");
+		return -1;
+	}
 
-			/* 创建一级间接块表 */
-			block_lba = block_bitmap_alloc(cur_part);
-			if (block_lba == -1) {
-				printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-				return -1;
-			}
-			ASSERT(file->fd_inode->i_sectors[12] == 0); // 确保一级间接块表未分配
+	if (f_inode->i_flags & INODE_INLINE) {
+		if (f_inode->i_size + count <= INODE_INLINE_SIZE) {
+			memcpy(f_inode->i_inline + f_inode->i_size, buf, count);
+			f_inode->i_size += count;
+			file->fd_pos = f_inode->i_size;
+			return inode_sync_alloc(part, f_inode) ? 1 : -1;
+		}
+		// 放不下时转换为用块存放，原有的数据作为普通的追加写入
+		uint8_t inline_data[INODE_INLINE_SIZE];
+		uint32_t inline_size = f_inode->i_size;
+		memcpy(inline_data, f_inode->i_inline, inline_size);
+		f_inode->i_flags &= ~INODE_INLINE;
+		extent_init(f_inode);
+		f_inode->i_size = 0;
+		if (inline_size > 0 && do_file_write(file, inline_data, inline_size) == -1) {
+			return -1;
+		}
+	}
 
-			/* 分配一级间接块索引表 */
-			indirect_block_table = file->fd_inode->i_sectors[12] = block_lba;
+	if (delay_append(part, f_inode, buf, count)) {
+		file->fd_pos = f_inode->i_size;
+		// 脏文件过多时由写者分担写回，否则留给后台线程
+		if (part->dirty_cnt > WRITEBACK_DIRTY_MAX) {
+			writeback_inodes(part, 0);
+		}
+		return 1;
+	}
+	delay_flush(part, f_inode);
+	if (f_inode->i_delay != NULL) {
+		// 直接分配时会紧接着文件末尾，先把窗口还回去，使这些块可以被继续使用
+		prealloc_drop(part, f_inode->i_delay);
+	}
 
-			block_idx = file_has_used_blocks; // 第一个未使用的块，即本文件最后一个已经使用的直接块的下一块
-			while (block_idx < file_will_use_blocks) {
-				block_lba = block_bitmap_alloc(cur_part);
-				if (block_lba == -1) {
-					printk("file_write: block_bitmap_alloc for situation 2 failed\n");
-					return -1;
-				}
+	uint32_t file_has_used_blocks = DIV_ROUND_UP(f_inode->i_size, BLOCK_SIZE);
+	uint32_t file_will_use_blocks = DIV_ROUND_UP(f_inode->i_size + count, BLOCK_SIZE);
+	if (
+		file_will_use_blocks > file_has_used_blocks
+		&& extent_alloc(
+			part, f_inode, file_has_used_blocks,
+			file_will_use_blocks - file_has_used_blocks
+		) == -1
+	) {
+		printk("file_write: allocate blocks failed\n");
+		// 已经分配的块留在 extent 树中，下次写入时会被直接使用
+		inode_sync_alloc(part, f_inode);
+		return -1;
+	}
+	return 0;
+}
 
-				if (block_idx < 12) { // 新创建的 0~11 块直接存入 all_blocks 数组
-					ASSERT(file->fd_inode->i_sectors[block_idx] == 0); // 确保尚未分配扇区地址
-					file->fd_inode->i_sectors[block_idx] = \
-					all_blocks[block_idx] = block_lba;
-				} else {
-					// 间接块只写入到 all_block 数组中，待全部分配完成后一次性同步到硬盘
-					all_blocks[block_idx] = block_lba;
-				}
+/*
+追加的第二步，把 buf 中的 count 个字节写入文件末尾之后已经分配好的块，扇区对齐的部分按连续的段直接在 buf 和硬盘间传输
+调用者只持有 inode 的读锁，此时文件大小还没有改变，读者不会读到这些块，成功返回 1，失败返回 0
+文件末尾所在的扇区不在 file_append_lock 锁住的范围内，覆盖写和写回可能同时在读改写它，改写它时单独锁住这个扇区
+*/
+static bool append_data(inode* f_inode, const void* buf, uint32_t count) {
+	partition* part = f_inode->i_part;
+	uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+	if (io_buf == NULL) {
+		printk("file_write: sys_malloc for io_buf failed\n");
+		return 0;
+	}
 
-				/* 每分配一个块就将位图同步到硬盘 */
-				block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-				bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
-				block_idx++; // 下一个新扇区
+	const uint8_t* src = buf;
+	uint32_t pos = f_inode->i_size;
+	uint32_t bytes_written = 0;
+	uint32_t sec_idx, sec_lba, run_len, sec_off_bytes, chunk_size;
+	range_lock tail_range;
+	while (bytes_written < count) {
+		sec_idx = pos / BLOCK_SIZE;
+		sec_lba = extent_map(part, f_inode, sec_idx, &run_len);
+		ASSERT(sec_lba != 0);
+		sec_off_bytes = pos % BLOCK_SIZE;
+
+		if (sec_off_bytes == 0 && count - bytes_written >= BLOCK_SIZE) {
+			// 整扇区的部分，一次写完这段 extent 中能写的所有扇区
+			uint32_t secs = (count - bytes_written) / BLOCK_SIZE;
+			secs = secs < run_len ? secs : run_len;
+			ide_write(part->my_disk, sec_lba, (void*)src, secs);
+			chunk_size = secs * BLOCK_SIZE;
+		} else {
+			// 不足一个扇区的部分要先读出原有的内容
+			chunk_size = BLOCK_SIZE - sec_off_bytes;
+			if (chunk_size > count - bytes_written) {
+				chunk_size = count - bytes_written;
 			}
-			ide_write(
-				cur_part->my_disk, indirect_block_table,
-				all_blocks + 12, 1
-			); // 同步一级间接块表到硬盘
-		} else if (file_has_used_blocks > 12) {
-/* 第三种情况:新数据占据间接块*/
-
-			ASSERT(file->fd_inode->i_sectors[12] != 0); // 已经具备了一级间接块表
-			indirect_block_table = file->fd_inode->i_sectors[12]; // 获取一级间接表地址
-
-			/* 已使用的间接块也将被读入 all_blocks，无需单独收录 */
-			ide_read(
-				cur_part->my_disk, indirect_block_table,
-				all_blocks + 12, 1
-			); // 获取所有间接块地址
-
-			block_idx = file_has_used_blocks; // 第一个未使用的间接块，即已经使用的间接块的下一块
-			while (block_idx < file_will_use_blocks) {
-				block_lba = block_bitmap_alloc(cur_part);
-				if (block_lba == -1) {
-					printk("file_write: block_bitmap_alloc for situation 3 failed\n");
-					return -1;
-				}
-				all_blocks[block_idx++] = block_lba;
-				/* 每分配一个块就将位图同步到硬盘 */
-				block_bitmap_idx = block_lba - cur_part->sb->data_start_lba;
-				bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
+			if (sec_off_bytes != 0) {
+				inode_range_lock(f_inode, &tail_range, pos, chunk_size, 1);
+				ide_read(part->my_disk, sec_lba, io_buf, 1);
+				memcpy(io_buf + sec_off_bytes, src, chunk_size);
+				ide_write(part->my_disk, sec_lba, io_buf, 1);
+				inode_range_unlock(f_inode, &tail_range);
+			} else {
+				memset(io_buf, 0, BLOCK_SIZE);
+				memcpy(io_buf, src, chunk_size);
+				ide_write(part->my_disk, sec_lba, io_buf, 1);
 			}
-
-			ide_write(
-				cur_part->my_disk, indirect_block_table,
-				all_blocks + 12, 1
-			); // 同步一级间接块表到硬盘
 		}
+
+		src += chunk_size;
+		pos += chunk_size;
+		bytes_written += chunk_size;
 	}
+	sys_free(io_buf);
+	return 1;
+}
 
-/* 用到的块地址已经收集到 all_blocks 中，下面开始写数据 */
-	bool first_write_block = 1; // 含有剩余空间的块标识
-	file->fd_pos = file->fd_inode->i_size - 1; // 置 fd_pos 为文件大小-1，下面在写数据时随时更新
-	while (bytes_written < count) { // 直到写完所有数据
-		memset(io_buf, 0, BLOCK_SIZE);
-		sec_idx = file->fd_inode->i_size / BLOCK_SIZE;
-		sec_lba = all_blocks[sec_idx];
-		sec_off_bytes = file->fd_inode->i_size % BLOCK_SIZE;
-		sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
+/* 追加的最后一步，数据已经写到盘上，调用者持有日志锁和 inode 的写锁，更新文件大小并写入日志 */
+static int32_t append_finish(file* file, uint32_t count) {
+	inode* f_inode = file->fd_inode;
+	f_inode->i_size += count;
+	file->fd_pos = f_inode->i_size;
+	return inode_sync_alloc(f_inode->i_part, f_inode) ? (int32_t)count : -1;
+}
 
-		/* 判断此次写入硬盘的数据大小 */
-		chunk_size = size_left < sec_left_bytes
-		 ? size_left
-		 : sec_left_bytes;
+/* 在持有日志锁和 inode 写锁时一次完成追加，用于内联的数据转换为用块存放时重写原有的内容 */
+static int32_t do_file_write(file* file, const void*buf, uint32_t count) {
+	int32_t ret = append_prepare(file, buf, count);
+	if (ret == 0) {
+		ret = append_data(file->fd_inode, buf, count) ? append_finish(file, count) : -1;
+	} else if (ret == 1) {
+		ret = count;
+	}
+	return ret;
+}
 
-		if (first_write_block) {
-			ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-			first_write_block = 0;
-		}
+/*
+用 buf 中的 count 个字节覆盖文件 file 从 fd_pos 开始的已有内容，不改变文件大小，不分配新的块
+成功返回写入的字节数，调用者已经检查过范围不超出文件末尾
+*/
+static int32_t do_file_overwrite(file* file, const void* buf, uint32_t count) {
+	inode* f_inode = file->fd_inode;
+	partition* part = f_inode->i_part;
+	if (f_inode->i_flags & INODE_INLINE) {
+		memcpy(f_inode->i_inline + file->fd_pos, buf, count);
+		file->fd_pos += count;
+		return inode_sync_alloc(part, f_inode) ? (int32_t)count : -1;
+	}
+
+	uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+	if (io_buf == NULL) {
+		printk("file_overwrite: sys_malloc for io_buf failed\n");
+		return -1;
+	}
 
-		memcpy(io_buf + sec_off_bytes, src, chunk_size);
-		ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
-		printk("file write at lba 0x%x\n", sec_lba); // 调试，完成后去掉
+	const uint8_t* src = buf;
+	uint32_t sec_idx, sec_lba, run_len, sec_off_bytes, chunk_size;
+	uint32_t bytes_written = 0;
+	inode_delay* d = f_inode->i_delay;
+	while (bytes_written < count) {
+		sec_idx = file->fd_pos / BLOCK_SIZE;
+		sec_off_bytes = file->fd_pos % BLOCK_SIZE;
+		if (d != NULL && d->dirty && sec_idx >= d->first_block) {
+			// 这部分还在延迟分配缓冲中，改缓冲即可
+			chunk_size = count - bytes_written;
+			memcpy(d->buf + (file->fd_pos - d->first_block * BLOCK_SIZE), src, chunk_size);
+		} else {
+			sec_lba = extent_map(part, f_inode, sec_idx, &run_len);
+			ASSERT(sec_lba != 0);
+			if (sec_off_bytes == 0 && count - bytes_written >= BLOCK_SIZE) {
+				uint32_t secs = (count - bytes_written) / BLOCK_SIZE;
+				secs = secs < run_len ? secs : run_len;
+				// 不能越过延迟分配缓冲的起点，缓冲中的内容会在写回时覆盖硬盘
+				if (d != NULL && d->dirty && secs > d->first_block - sec_idx) {
+					secs = d->first_block - sec_idx;
+				}
+				ide_write(part->my_disk, sec_lba, (void*)src, secs);
+				chunk_size = secs * BLOCK_SIZE;
+			} else {
+				chunk_size = BLOCK_SIZE - sec_off_bytes;
+				if (chunk_size > count - bytes_written) {
+					chunk_size = count - bytes_written;
+				}
+				ide_read(part->my_disk, sec_lba, io_buf, 1);
+				memcpy(io_buf + sec_off_bytes, src, chunk_size);
+				ide_write(part->my_disk, sec_lba, io_buf, 1);
+			}
+		}
 
-		src += chunk_size; // 将指针推移到下个新数据
-		file->fd_inode->i_size += chunk_size; // 更新文件大小
+		src += chunk_size;
 		file->fd_pos += chunk_size;
 		bytes_written += chunk_size;
-		size_left -= chunk_size;
 	}
 
-	inode_sync(cur_part, file->fd_inode, io_buf);
-	sys_free(all_blocks);
 	sys_free(io_buf);
 	return bytes_written;
 }
 
-/* 从文件 file 中读取 count 个字节写入 buf，返回读出的字节，若到结尾则返回 -1 */
-int32_t file_read(file* file, void* buf, uint32_t count) {
-	// TODO: 依然存在如 file_read 一样的问题
-
+/* file_read 的实现，调用者持有 inode 的读锁和这段范围的共享锁 */
+static int32_t do_file_read(file* file, void* buf, uint32_t count) {
+	partition* part = file->fd_inode->i_part;
 	uint8_t* buf_dst = (uint8_t*)buf;
-	uint32_t size = count, size_left = size;
+	uint32_t size = count;
 
 	/* 若要读取的字节数超过了文件可读的剩余量， 就用剩余量作为待读取的字节数 */
-	if ((file->fd_pos + count) > file->fd_inode->i_size) {
+	if (file->fd_pos >= file->fd_inode->i_size) {
+		return -1; // 若到文件尾，则返回-1
+	}
+	if (count > file->fd_inode->i_size - file->fd_pos) {
 		size = file->fd_inode->i_size - file->fd_pos;
-		size_left = size;
-		if (size == 0) {
-			return -1; // 若到文件尾，则返回-1
-		}
+	}
+	// 内联的数据直接从缓存的 inode 中复制，不用读盘
+	if (file->fd_inode->i_flags & INODE_INLINE) {
+		memcpy(buf_dst, file->fd_inode->i_inline + file->fd_pos, size);
+		file->fd_pos += size;
+		return size;
 	}
 
 	uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
@@ -482,82 +1033,161 @@ int32_t file_read(file* file, void* buf, uint32_t count) {
 		printk("file_read: sys_malloc for io_buf failed\n");
 		return -1;
 	}
-	uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48); // 用来记录文件所有的块地址
-	if (all_blocks == NULL) {
-		printk("file_read: sys_malloc for all_blocks failed\n");
-		return -1;
-	}
-
-	uint32_t block_read_start_idx = file->fd_pos / BLOCK_SIZE; // 数据所在块的起始地址
-	uint32_t block_read_end_idx = (file->fd_pos + size) / BLOCK_SIZE; // 数据所在块的终止地址
-	uint32_t read_blocks = block_read_start_idx - block_read_end_idx; // 如增量为 0，表示数据在同一扇区
-	ASSERT(block_read_start_idx < 139 && block_read_end_idx < 139);
-
-	int32_t indirect_block_table; // 用来获取一级间接表地址
-	uint32_t block_idx; // 获取待读的块地址
-
-/* 以下开始构建 all_blocks 块地址数组， 专门存储用到的块地址(本程序中块大小同扇区大小)*/
-	if (read_blocks == 0) { // 在同一扇区内读数据，不涉及到跨扇区读取
-		ASSERT(block_read_end_idx == block_read_start_idx);
-
-		if (block_read_end_idx < 12) { // 待读的数据在 12 个直接块之内
-			block_idx = block_read_end_idx;
-			all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-		} else { // 若用到了一级间接块表，需要将表中间接块读进来
-			indirect_block_table = file->fd_inode->i_sectors[12];
-			ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-		}
-	} else { // 若要读多个块
-/* 第一种情况: 起始块和终止块属于直接块*/
-		if (block_read_end_idx < 12) { // 数据结束所在的块属于直接块
-			block_idx = block_read_start_idx;
-			while (block_idx <= block_read_end_idx) {
-				all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-				block_idx++;
-			}
-		} else if (block_read_start_idx < 12 && block_read_end_idx >= 12) {
-/* 第二种情况: 待读入的数据跨越直接块和间接块两类*/
-			/* 先将直接块地址写入 all_blocks */
-			block_idx = block_read_start_idx;
-			while (block_idx < 12) {
-				all_blocks[block_idx] = file->fd_inode->i_sectors[block_idx];
-				block_idx++;
-			}
-			ASSERT(file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
-			/* 再将间接块地址写入 all_blocks */
-			indirect_block_table = file->fd_inode->i_sectors[12];
-			// 将一级间接块表读进来写入到第 13 个块的位置之后
-			ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-		} else {
-/* 第三种情况: 数据在间接块中*/
-			ASSERT(file->fd_inode->i_sectors[12] != 0); // 确保已经分配了一级间接块表
-			indirect_block_table = file->fd_inode->i_sectors[12]; // 获取一级间接表地址
-			// 将一级间接块表读进来写入到第 13 个块的位置之后
-			ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
-		}
-	}
 
-/* 用到的块地址已经收集到 all_blocks 中，下面开始读数据 */
-	uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
+	uint32_t sec_idx, sec_lba, run_len, sec_off_bytes, chunk_size;
 	uint32_t bytes_read = 0;
+	inode_delay* d = file->fd_inode->i_delay;
 	while (bytes_read < size) { // 直到读完为止
 		sec_idx = file->fd_pos / BLOCK_SIZE;
-		sec_lba = all_blocks[sec_idx];
 		sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-		sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-		chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
-		// 待读入的数据大小
-		memset(io_buf, 0, BLOCK_SIZE); // 不清空也可以
-		ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-		memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+		if (d != NULL && d->dirty && sec_idx >= d->first_block) {
+			// 从这一块到文件末尾都还在延迟分配缓冲中
+			chunk_size = size - bytes_read;
+			memcpy(buf_dst, d->buf + (file->fd_pos - d->first_block * BLOCK_SIZE), chunk_size);
+			buf_dst += chunk_size;
+			file->fd_pos += chunk_size;
+			bytes_read += chunk_size;
+			continue;
+		}
+		sec_lba = extent_map(part, file->fd_inode, sec_idx, &run_len);
+		ASSERT(sec_lba != 0);
+
+		if (sec_off_bytes == 0 && size - bytes_read >= BLOCK_SIZE) {
+			// 整扇区的部分直接读到 buf 中
+			uint32_t secs = (size - bytes_read) / BLOCK_SIZE;
+			secs = secs < run_len ? secs : run_len;
+			// 缓冲中的末块可能已经分配，但硬盘上的内容是旧的
+			if (d != NULL && d->dirty && secs > d->first_block - sec_idx) {
+				secs = d->first_block - sec_idx;
+			}
+			ide_read(part->my_disk, sec_lba, buf_dst, secs);
+			chunk_size = secs * BLOCK_SIZE;
+		} else {
+			chunk_size = BLOCK_SIZE - sec_off_bytes;
+			if (chunk_size > size - bytes_read) {
+				chunk_size = size - bytes_read;
+			}
+			ide_read(part->my_disk, sec_lba, io_buf, 1);
+			memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
+		}
 
 		buf_dst += chunk_size;
 		file->fd_pos += chunk_size;
 		bytes_read += chunk_size;
-		size_left -= chunk_size;
 	}
 
-	sys_free(all_blocks);
 	sys_free(io_buf);
 	return bytes_read;
-}
\ No newline at end of file
+}
+
+/*
+锁住文件 in 从末尾所在扇区之后到最大偏移量的字节范围，追加的写者之间由它互斥，返回加锁时的文件大小
+读者和覆盖写只锁到文件末尾所在的扇区为止，与它不冲突，持有期间只有持有者能改变文件大小
+它在日志锁和 inode 的锁之前获取，追加的写者因此可以在追加的中途释放日志锁，
+但持有 inode 读锁的读者不能等它，所以末尾所在的扇区不包含在内，见 append_data
+*/
+uint32_t file_append_lock(inode* in, range_lock* range) {
+	while (1) {
+		uint32_t size = in->i_size;
+		inode_range_lock(in, range, DIV_ROUND_UP(size, BLOCK_SIZE) * BLOCK_SIZE, 0xffffffff, 1);
+		// 加锁前文件可能又被追加过，此时锁住的范围包含了末尾之前的部分，读者可能正在等它
+		if (in->i_size <= size) {
+			return size;
+		}
+		inode_range_unlock(in, range);
+	}
+}
+
+/*
+把 buf 中的 count 个字节追加写入 file，调用者持有 file_append_lock，成功返回写入的字节数，失败返回 -1
+日志锁只在修改元数据时持有：先分配块，再只持有 inode 的读锁写数据，最后更新文件大小，
+这样写数据时其他文件的写者和后台写回都不必等待
+*/
+int32_t file_append(file* file, const void* buf, uint32_t count) {
+	inode* in = file->fd_inode;
+	partition* part = in->i_part;
+	journal_begin(part);
+	rwlock_write_acquire(&in->i_rwlock);
+	int32_t ret = append_prepare(file, buf, count);
+	rwlock_write_release(&in->i_rwlock);
+	journal_end(part);
+	if (ret != 0) {
+		return ret == 1 ? (int32_t)count : -1;
+	}
+
+	// 分配了块而文件大小没有改变时崩溃，这些块留在 extent 树中，下次追加时会被直接使用
+	rwlock_read_acquire(&in->i_rwlock);
+	bool written = append_data(in, buf, count);
+	rwlock_read_release(&in->i_rwlock);
+	if (! written) {
+		return -1;
+	}
+
+	journal_begin(part);
+	rwlock_write_acquire(&in->i_rwlock);
+	ret = append_finish(file, count);
+	rwlock_write_release(&in->i_rwlock);
+	journal_end(part);
+	return ret;
+}
+
+/* 把 buf 中的 count 个字节追加写入 file，被映射的页可能已经在页缓存中，同时更新它们，成功返回写入的字节数，失败返回 -1 */
+int32_t file_write(file* file, const void* buf, uint32_t count) {
+	inode* in = file->fd_inode;
+	range_lock range;
+	uint32_t pos = file_append_lock(in, &range);
+	int32_t ret = file_append(file, buf, count);
+	inode_range_unlock(in, &range);
+	// 页缓存锁在 inode 的锁之前获取，解锁范围后再更新
+	if (ret > 0) {
+		page_cache_update(in, pos, buf, ret);
+	}
+	return ret;
+}
+
+/*
+file_overwrite 的加锁版本，覆盖不同范围的写者可以并行，只有内联文件的覆盖要写日志
+文件转换为用块存放后不会再变回内联，所以不持有锁检查标志也不会漏掉
+*/
+int32_t file_overwrite(file* file, const void* buf, uint32_t count) {
+	inode* in = file->fd_inode;
+	range_lock range;
+	bool journaled = in->i_flags & INODE_INLINE;
+	if (journaled) {
+		journal_begin(in->i_part);
+	}
+	rwlock_read_acquire(&in->i_rwlock);
+	int32_t ret = -1;
+	// 超出文件末尾的范围可能被追加的写者锁住，先检查再加锁
+	if (file->fd_pos > in->i_size || count > in->i_size - file->fd_pos) {
+		printk("file_overwrite: beyond the end of file\n");
+	} else {
+		inode_range_lock(in, &range, file->fd_pos, count, 1);
+		ret = do_file_overwrite(file, buf, count);
+		inode_range_unlock(in, &range);
+	}
+	rwlock_read_release(&in->i_rwlock);
+	if (journaled) {
+		journal_end(in->i_part);
+	}
+	return ret;
+}
+
+/* 从文件 file 中读取 count 个字节写入 buf，返回读出的字节，若到结尾则返回 -1 */
+int32_t file_read(file* file, void* buf, uint32_t count) {
+	inode* in = file->fd_inode;
+	range_lock range;
+	// 读者之间可以并行，与覆盖写只在范围重叠时互斥
+	rwlock_read_acquire(&in->i_rwlock);
+	if (file->fd_pos >= in->i_size) {
+		rwlock_read_release(&in->i_rwlock);
+		return -1;
+	}
+	// 只锁到文件末尾所在的扇区为止，之后由追加的写者锁住，见 file_append_lock
+	uint32_t cnt = in->i_size - file->fd_pos < count ? in->i_size - file->fd_pos : count;
+	inode_range_lock(in, &range, file->fd_pos, cnt, 0);
+	int32_t ret = do_file_read(file, buf, count);
+	inode_range_unlock(in, &range);
+	rwlock_read_release(&in->i_rwlock);
+	return ret;
+}
@@ -10,9 +10,7 @@ extern void intr_exit(void);
 static int32_t copy_pcb_vaddrbitmap_stack0 (
 	task_struct* child_thread, task_struct* parent_thread
 ) {
-	// TODO: 复制了进程文件表 fd_table，如果里面有可写的文件描述符会有问题？
-
-/* 复制 pcb 所在的整个页，里面包括 pcb 信息及特权 0 即栈和返回地址 */
+	// 复制 pcb 所在的整个页，里面包括 pcb 信息及特权 0 即栈和返回地址
 	memcpy(child_thread, parent_thread, PG_SIZE);
 
 	// 下面分别单独修改一些内容
@@ -26,6 +24,12 @@ static int32_t copy_pcb_vaddrbitmap_stack0 (
 	child_thread->all_list_tag.prev =\
 	child_thread->all_list_tag.next = NULL;
 	block_desc_init(child_thread->u_block_desc);
+	/*
+	映射区域中已经读入的页会和其他数据一起被复制，子进程得到的是它们的私有副本，
+	因此不继承父进程的映射区域，这些页也不会再写回文件
+	*/
+	list_init(&child_thread->vm_areas);
+	child_thread->rwlock_reads = 0;
 
 /* 复制父进程的虚拟地址池的位图 */
 	uint32_t bitmap_pg_cnt = DIV_ROUND_UP(
@@ -117,21 +121,6 @@ static int32_t build_child_stack(task_struct* child_thread) {
 	return 0;
 }
 
-extern file* file_table;
-
-/* 更新 inode 打开数 */
-static void update_inode_open_cnts(task_struct* thread) {
-	int32_t local_fd = 3, global_fd = 0;
-	while (local_fd < MAX_FILES_OPEN_PER_PROC) {
-		global_fd = thread->fd_table[local_fd];
-		ASSERT(global_fd < MAX_FILE_OPEN);
-		if (global_fd != -1) {
-			file_table[global_fd].fd_inode->i_open_cnts++;
-		}
-		local_fd++;
-	}
-}
-
 /* 拷贝父进程本身所占资源给子进程 */
 static int32_t copy_process(
 	task_struct* child_thread, task_struct* parent_thread
@@ -144,12 +133,14 @@ static int32_t copy_process(
 
 // 复制父进程的 pcb、虚拟地址位图、内核栈
 	if (copy_pcb_vaddrbitmap_stack0(child_thread, parent_thread) == -1) {
+		mfree_page(PF_KERNEL, buf_page, 1);
 		return -1;
 	}
 
 // 为子进程创建页表
 	child_thread->pgdir = create_page_dir();
 	if (child_thread->pgdir == NULL) {
+		mfree_page(PF_KERNEL, buf_page, 1);
 		return -1;
 	}
 
@@ -159,8 +150,11 @@ static int32_t copy_process(
 // 构建子进程 thread_stack 和修改返回值 pid
 	build_child_stack(child_thread);
 
-// 更新文件 inode 的打开次数
-	update_inode_open_cnts(child_thread);
+// 复制描述符表，父子进程共享打开的文件
+	if (fd_table_copy(child_thread, parent_thread) == -1) {
+		mfree_page(PF_KERNEL, buf_page, 1);
+		return -1;
+	}
 
 	mfree_page(PF_KERNEL, buf_page, 1);
 	return 0;
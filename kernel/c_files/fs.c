@@ -7,6 +7,10 @@
 #include "memory.h"
 #include "debug.h"
 #include "stdio.h"
+#include "dcache.h"
+#include "journal.h"
+#include "page_cache.h"
+#include "writeback.h"
 #include "inode.h"
 #include "list.h"
 #include "file.h"
@@ -15,28 +19,69 @@
 #include "fs.h"
 
 extern struct list partition_list;
-extern file file_table[MAX_FILE_OPEN];
 
 /*
 格式化分区，也就是初始化分区的元信息，创建文件系统
 分区格式如下:
 	引导块，超级块，空闲块位图，inode 位图，inode 数组，根目录，空闲块
 */
+/* 将从 lba 开始的 sec_cnt 个扇区清零，buf 为 FORMAT_BUF_SECTS 个扇区的全零缓冲区 */
+static void zero_sectors(disk* hd, uint32_t lba, uint32_t sec_cnt, void* buf) {
+	uint32_t secs_op;
+	while (sec_cnt > 0) {
+		secs_op = sec_cnt < FORMAT_BUF_SECTS ? sec_cnt : FORMAT_BUF_SECTS;
+		ide_write(hd, lba, buf, secs_op);
+		lba += secs_op;
+		sec_cnt -= secs_op;
+	}
+}
+
+/* 第 group 个分配组中的块数或 inode 数，每组 per_group 个，共 total 个，最后一组可能不满 */
+static uint32_t group_size(uint32_t group, uint32_t per_group, uint32_t total) {
+	if (group * per_group >= total) {
+		return 0;
+	}
+	uint32_t left = total - group * per_group;
+	return left < per_group ? left : per_group;
+}
+
+/*
+按 block_cnt 个数据块把分区划分为分配组，每组的块数是位图扇区的整数倍，组数不超过 MAX_GROUPS
+inode 平均分到各组，每组的 inode 占整数个扇区
+*/
+static void group_layout(struct super_block* sb, uint32_t block_cnt) {
+	uint32_t bitmap_sects = DIV_ROUND_UP(block_cnt, BITS_PER_SECTOR);
+	sb->blocks_per_group = DIV_ROUND_UP(bitmap_sects, MAX_GROUPS) * BITS_PER_SECTOR;
+	sb->group_cnt = DIV_ROUND_UP(block_cnt, sb->blocks_per_group);
+	sb->inodes_per_group = DIV_ROUND_UP(
+		DIV_ROUND_UP(sb->inode_cnt, sb->group_cnt), INODES_PER_SECTOR
+	) * INODES_PER_SECTOR;
+}
+
+/* 在分区 part 上建立文件系统，宿主机上的 tools/mkfs.c 按相同的布局生成镜像，两边要一起修改 */
 static void partition_format(partition* part) {
 	printk("%s format start\n", part->name);
 	uint32_t boot_sector_sects = 1;
 	uint32_t super_block_sects = 1;
-	// inode 位图占用的扇区数，最多支持 4096 个文件
-	uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR);
+	// inode 数按分区大小计算，并向上对齐到整扇区的位图
+	uint32_t inode_cnt = part->sec_cnt / SECTORS_PER_INODE;
+	if (inode_cnt < MIN_FILES_PER_PART) {
+		inode_cnt = MIN_FILES_PER_PART;
+	} else if (inode_cnt > MAX_FILES_PER_PART) {
+		inode_cnt = MAX_FILES_PER_PART;
+	}
+	inode_cnt = DIV_ROUND_UP(inode_cnt, BITS_PER_SECTOR) * BITS_PER_SECTOR;
+	// inode 位图占用的扇区数
+	uint32_t inode_bitmap_sects = inode_cnt / BITS_PER_SECTOR;
 	// inode 数组占用的扇区数
 	uint32_t inode_table_sects = DIV_ROUND_UP(\
-		(sizeof(inode) * MAX_FILES_PER_PART),
+		(sizeof(disk_inode) * inode_cnt),
 		SECTOR_SIZE
 	);
 	uint32_t used_sects = boot_sector_sects + super_block_sects +\
-	inode_bitmap_sects + inode_bitmap_sects;
+	inode_bitmap_sects + inode_table_sects + JOURNAL_SECTS;
+	ASSERT(part->sec_cnt > used_sects);
 	uint32_t free_sects = part->sec_cnt - used_sects;
-	ASSERT(free_sects >= 0);
 
 	uint32_t block_bitmap_sects;
 	block_bitmap_sects = DIV_ROUND_UP(free_sects, BITS_PER_SECTOR);
@@ -44,9 +89,10 @@ static void partition_format(partition* part) {
 	block_bitmap_sects = DIV_ROUND_UP(block_bitmap_bit_len, BITS_PER_SECTOR);
 
 	struct super_block sb;
-	sb.magic = *((uint32_t*) "iLym");
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = FS_MAGIC;
 	sb.sec_cnt = part->sec_cnt;
-	sb.inode_cnt = MAX_FILES_PER_PART;
+	sb.inode_cnt = inode_cnt;
 	sb.part_lba_base = part->start_lba;
 
 	// 第 0 块是引导块，第 1 块是超级块
@@ -59,9 +105,28 @@ static void partition_format(partition* part) {
 	sb.inode_table_lba = sb.inode_bitmap_lba + sb.inode_bitmap_sects;
 	sb.inode_table_sects = inode_table_sects;
 
-	sb.data_start_lba = sb.inode_table_lba + sb.inode_table_sects;
+	sb.journal_lba = sb.inode_table_lba + sb.inode_table_sects;
+	sb.journal_sects = JOURNAL_SECTS;
+
+	sb.data_start_lba = sb.journal_lba + sb.journal_sects;
 	sb.root_inode_no = 0;
 	sb.dir_entry_size = sizeof(dir_entry);
+	// 根目录占用了第 0 个 inode 和第 0 个块
+	sb.free_block_cnt = block_bitmap_bit_len - 1;
+	sb.free_inode_cnt = inode_cnt - 1;
+	sb.state = FS_CLEAN;
+	sb.version = FS_VERSION;
+
+	group_layout(&sb, block_bitmap_bit_len);
+	uint32_t group = 0;
+	for (; group < sb.group_cnt; group++) {
+		sb.groups[group].free_blocks = group_size(group, sb.blocks_per_group, block_bitmap_bit_len);
+		sb.groups[group].free_inodes = group_size(group, sb.inodes_per_group, inode_cnt);
+	}
+	sb.groups[0].free_blocks--;
+	sb.groups[0].free_inodes--;
+	// 只初始化根目录 inode 所在的扇区，其余的扇区在第一次写入 inode 时才清零
+	sb.groups[0].inode_table_inited = 1;
 
 	printk(
 		"%s info:\n"
@@ -75,12 +140,13 @@ static void partition_format(partition* part) {
 		"   inode_bitmap_sectors: %x\n"
 		"   inode_table_lba:      %x\n"
 		"   inode_table_sectors:  %x\n"
+		"   journal_lba:          %x\n"
 		"   data_start_lba:       %x\n",
 		part->name, sb.magic, sb.part_lba_base,
 		sb.sec_cnt, sb.inode_cnt, sb.block_bitmap_lba,
 		sb.block_bitmap_sects, sb.inode_bitmap_lba,
 		sb.inode_bitmap_sects, sb.inode_table_lba,
-		sb.inode_table_sects, sb.data_start_lba
+		sb.inode_table_sects, sb.journal_lba, sb.data_start_lba
 	);
 
 	disk* hd = part->my_disk;
@@ -88,56 +154,56 @@ static void partition_format(partition* part) {
 	ide_write(hd, part->start_lba + 1, &sb, 1);
 	printk("   super_block_lba:      %x\n", part->start_lba + 1);
 
-	// 找出数据量最大的元信息，用其尺寸做存储缓冲区
-	uint32_t buf_size = (
-		sb.block_bitmap_sects >= sb.inode_bitmap_sects\
-		? sb.block_bitmap_sects
-		: sb.inode_bitmap_sects
-	);
-	buf_size = (
-		buf_size >= sb.inode_table_sects\
-		? buf_size
-		: sb.inode_table_sects
-	);
-
-	uint8_t* buf = (uint8_t*) sys_malloc(buf_size * SECTOR_SIZE);
+	// 大分区的元信息可能有几 MB，所以用固定大小的缓冲区分批写入
+	uint8_t* buf = (uint8_t*) sys_malloc(FORMAT_BUF_SECTS * SECTOR_SIZE);
+	memset(buf, 0, FORMAT_BUF_SECTS * SECTOR_SIZE);
+	zero_sectors(hd, sb.block_bitmap_lba, sb.block_bitmap_sects, buf);
+	zero_sectors(hd, sb.inode_bitmap_lba, sb.inode_bitmap_sects, buf);
+	// 清空日志区，挂载时就不会重放旧的事务
+	zero_sectors(hd, sb.journal_lba, sb.journal_sects, buf);
 
-/* 将块位图初始化并写入 sb.block_bitmap_lba */
-	buf[0] |= 0x01; // 第 0 个块预留给根目录，位图中占位
+/* 块位图中超出 block_bitmap_bit_len 的位置 1，防止分配到分区之外的块 */
 	uint32_t block_bitmap_last_byte = block_bitmap_bit_len / 8;
 	uint8_t block_bitmap_last_bit   = block_bitmap_bit_len % 8;
-	// last_size 是位图最后一个扇区中，不足一扇区的部分
-	uint32_t last_size = SECTOR_SIZE - (block_bitmap_last_byte % SECTOR_SIZE);
-	// 将位图最后一字节到其所在扇区结束全置为 1
-
-	memset(&buf[block_bitmap_last_byte], 0xff, last_size);
-
-	// 再将上一步中覆盖的最后一字节内有效位重新置 0
-	uint8_t bit_idx = 0;
-
-	while (bit_idx <= block_bitmap_last_bit) {
-		buf[block_bitmap_last_byte] &= ~(1 << bit_idx++);
+	uint32_t last_sec = block_bitmap_last_byte / SECTOR_SIZE;
+	if (last_sec < sb.block_bitmap_sects) {
+		uint32_t last_byte_in_sec = block_bitmap_last_byte % SECTOR_SIZE;
+		// 将位图最后一字节到其所在扇区结束全置为 1
+		memset(&buf[last_byte_in_sec], 0xff, SECTOR_SIZE - last_byte_in_sec);
+		// 再将上一步中覆盖的最后一字节内有效位重新置 0
+		uint8_t bit_idx = 0;
+		while (bit_idx < block_bitmap_last_bit) {
+			buf[last_byte_in_sec] &= ~(1 << bit_idx++);
+		}
+		if (last_sec == 0) {
+			buf[0] |= 0x01;
+		}
+		ide_write(hd, sb.block_bitmap_lba + last_sec, buf, 1);
+		memset(buf, 0, SECTOR_SIZE);
+	}
+	if (last_sec != 0) {
+		buf[0] |= 0x01; // 第 0 个块预留给根目录，位图中占位
+		ide_write(hd, sb.block_bitmap_lba, buf, 1);
+		buf[0] = 0;
 	}
-
-	ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
 
 /* 将 inode 位图初始化并写入 sb.inode_bitmap_lba */
-	memset(buf, 0, buf_size);
 	buf[0] |= 0x01;
-	// inode 位图刚好占用 1 扇区
-	ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+	ide_write(hd, sb.inode_bitmap_lba, buf, 1);
+	buf[0] = 0;
 
-/* 将 inode 数组初始化并写入 sb.inode_table_lba */
-	memset(buf, 0, buf_size);
+/* 将 inode 数组中根目录 inode 所在的扇区写入 sb.inode_table_lba */
 	// 准备填写根目录的 inode
-	inode* i = (inode*) buf;
+	disk_inode* i = (disk_inode*) buf;
 	i->i_size = sb.dir_entry_size * 2; // . 和 ..
-	i->i_no = 0;
-	i->i_sectors[0] = sb.data_start_lba;
-	ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+	i->i_extent_cnt = 1;
+	i->i_extents[0].ee_block = 0;
+	i->i_extents[0].ee_start = sb.data_start_lba;
+	i->i_extents[0].ee_len = 1;
+	ide_write(hd, sb.inode_table_lba, buf, 1);
 
 /* 将根目录写入 sb.data_start_lba */
-	memset(buf, 0, buf_size);
+	memset(buf, 0, SECTOR_SIZE);
 	// 准备填写 . 的目录项
 	dir_entry* p_de = (dir_entry*)buf;
 	memcpy(p_de->filename, ".", 1);
@@ -159,64 +225,192 @@ static void partition_format(partition* part) {
 	sys_free(buf);
 }
 
-// TODO: 默认情况下操作的是哪个分区（有啥用？）
-partition* cur_part;
+// 挂载表，第 0 项是挂载在 "/" 上的分区
+static mount_point mount_table[MAX_MOUNTS];
+static uint32_t mount_cnt;
 // sys_malloc 返回失败的错误信息
 const char* malloc_error = "malloc memory failed!";
-/* 在分区链表中找到名为 part_name 的分区，并将其指针赋值给 cur_part */
-static bool mount_partition(struct list_elem* pelem, int arg) {
-	char* part_name = (char*) arg;
-	partition* part = elem2entry(partition, part_tag, pelem);
-	if (strcmp(part->name, part_name)) {
-		// 返回 0 来使 list_traversal 继续扫描
-		return 0;
+/* 统计位图 btmp 中从 bit_idx 开始的 bit_cnt 位中为 0 的位数，bit_idx 按字节对齐 */
+static uint32_t bitmap_count_free(bitmap* btmp, uint32_t bit_idx, uint32_t bit_cnt) {
+	uint32_t cnt = 0, idx = bit_idx / 8;
+	for (; idx < DIV_ROUND_UP(bit_idx + bit_cnt, 8); idx++) {
+		uint8_t byte = btmp->bits[idx];
+		while (byte != 0xff) {
+			// 把最低的一个 0 位置 1
+			byte |= byte + 1;
+			cnt++;
+		}
 	}
+	return cnt;
+}
+
+/* 把分区 part 的超级块以挂载状态 state 记入日志，内存中的超级块始终是 FS_DIRTY */
+void super_block_sync(partition* part, uint32_t state) {
+	// 预分配窗口中剩余的块在磁盘上算作空闲的，写入的是加回这些块后的副本
+	uint8_t sb_buf[SECTOR_SIZE];
+	struct super_block* sb = (struct super_block*)sb_buf;
+	memcpy(sb, part->sb, SECTOR_SIZE);
+	sb->state = state;
+	prealloc_unreserve_counts(part, sb);
+	journal_write(part, part->start_lba + 1, sb, 1);
+}
+
+/*
+把版本 1 的分区划分为分配组，原来整个 inode 数组的初始化进度分到各组
+各组的空闲计数要从位图中统计，因此把分区标记为没有干净地卸载
+*/
+static void group_migrate(struct super_block* sb) {
+	group_layout(sb, sb->sec_cnt - (sb->data_start_lba - sb->part_lba_base));
+	memset(sb->groups, 0, sizeof(sb->groups));
+	uint32_t group = 0;
+	for (; group < sb->group_cnt; group++) {
+		uint32_t first_sec = group * sb->inodes_per_group / INODES_PER_SECTOR;
+		uint32_t sects = group_size(group, sb->inodes_per_group, sb->inode_cnt) / INODES_PER_SECTOR;
+		if (sb->inode_table_inited > first_sec) {
+			uint32_t inited = sb->inode_table_inited - first_sec;
+			sb->groups[group].inode_table_inited = inited < sects ? inited : sects;
+		}
+	}
+	sb->version = 2;
+	sb->state = FS_DIRTY;
+}
 
-	cur_part = part;
+/* 把分区 part 挂载到路径 path 上，并启动它的写回线程 */
+static void mount_partition(partition* part, const char* path) {
+	if (mount_cnt == MAX_MOUNTS) {
+		printk("mount table is full, %s is not mounted\n", part->name);
+		return;
+	}
 	disk* hd = part->my_disk;
 
 /* 处理超级块 */
-	struct super_block* sb_buf = cur_part->sb = sys_malloc(SECTOR_SIZE);
+	struct super_block* sb_buf = part->sb = sys_malloc(SECTOR_SIZE);
 	if (sb_buf == NULL) {
 		ASSERT(! malloc_error);
 	}
-	ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
+	ide_read(hd, part->start_lba + 1, sb_buf, 1);
 
-/* 处理块位图 */
-	cur_part->block_bitmap.bits =\
-	sys_malloc(sb_buf->block_bitmap_sects * SECTOR_SIZE);
-	if (cur_part->block_bitmap.bits == NULL) {
-		ASSERT(! malloc_error);
+/* 重放日志，之后读到的超级块和位图才是最新的 */
+	journal_init(part);
+	ide_read(hd, part->start_lba + 1, sb_buf, 1);
+
+/* 旧版本的分区先把磁盘格式转换为当前版本 */
+	ASSERT(sb_buf->version <= FS_VERSION);
+	if (sb_buf->version < 1) {
+		inode_table_migrate(part);
+	}
+	if (sb_buf->version < 2) {
+		group_migrate(sb_buf);
 	}
 
-	cur_part->block_bitmap.btmp_bytes_len =\
-	sb_buf->block_bitmap_sects * SECTOR_SIZE;
-	ide_read(
-		hd, sb_buf->block_bitmap_lba,
-		cur_part->block_bitmap.bits,
-		sb_buf->block_bitmap_sects
-	);
+/*
+为块位图和 inode 位图分配空间，各扇区在第一次使用时才从磁盘读入，见 bitmap_load
+内存仍按整个位图一次分配，不按块组换入换出：80MB 的分区块位图只有 20KB，
+分配时清零这些内存的开销远小于读盘，按组管理内存则要改动所有扫描位图的地方
+*/
+	bitmap* btmps[2] = {&part->block_bitmap, &part->inode_bitmap};
+	uint32_t sects[2] = {sb_buf->block_bitmap_sects, sb_buf->inode_bitmap_sects};
+	for (int i = 0; i < 2; i++) {
+		btmps[i]->btmp_bytes_len = sects[i] * SECTOR_SIZE;
+		btmps[i]->bits = sys_malloc(btmps[i]->btmp_bytes_len);
+		if (btmps[i]->bits == NULL) {
+			ASSERT(! malloc_error);
+		}
+	}
 
-/* 处理 inode 位图 */
-	cur_part->inode_bitmap.bits =\
-	sys_malloc(sb_buf->inode_bitmap_sects * SECTOR_SIZE);
-	if (cur_part->inode_bitmap.bits == NULL) {
-		ASSERT(! malloc_error);
+/* 处理位图的已读入和脏扇区标记，每个位图扇区对应一位 */
+	bitmap* marks[4] = {
+		&part->block_bitmap_loaded, &part->inode_bitmap_loaded,
+		&part->block_bitmap_dirty, &part->inode_bitmap_dirty
+	};
+	for (int i = 0; i < 4; i++) {
+		marks[i]->btmp_bytes_len = DIV_ROUND_UP(sects[i % 2], 8);
+		marks[i]->bits = sys_malloc(marks[i]->btmp_bytes_len);
+		if (marks[i]->bits == NULL) {
+			ASSERT(! malloc_error);
+		}
+		bitmap_init(marks[i]);
+	}
+	lock_init(&part->bitmap_load_lock);
+	lock_init(&part->bitmap_flush_lock);
+	writeback_init(part);
+
+/* 上次没有 sync 就停止运行时，空闲计数可能与位图不一致 */
+	if (sb_buf->state != FS_CLEAN) {
+		printk("%s was not cleanly unmounted, recounting free blocks and inodes\n", part->name);
+		// 只有这时才需要读入整个位图
+		bitmap_load(part, BLOCK_BITMAP, 0, sects[0] * BITS_PER_SECTOR);
+		bitmap_load(part, INODE_BITMAP, 0, sects[1] * BITS_PER_SECTOR);
+		sb_buf->free_block_cnt = sb_buf->free_inode_cnt = 0;
+		uint32_t group = 0;
+		for (; group < sb_buf->group_cnt; group++) {
+			group_desc* gd = &sb_buf->groups[group];
+			// 块位图末尾不对应数据块的位在格式化时已经置 1，按位图的长度统计即可
+			gd->free_blocks = bitmap_count_free(
+				&part->block_bitmap, group * sb_buf->blocks_per_group,
+				group_size(group, sb_buf->blocks_per_group, sects[0] * BITS_PER_SECTOR)
+			);
+			gd->free_inodes = bitmap_count_free(
+				&part->inode_bitmap, group * sb_buf->inodes_per_group,
+				group_size(group, sb_buf->inodes_per_group, sb_buf->inode_cnt)
+			);
+			sb_buf->free_block_cnt += gd->free_blocks;
+			sb_buf->free_inode_cnt += gd->free_inodes;
+		}
 	}
+	// 挂载期间磁盘上的超级块一直是脏的，直到 sync 把它标记为干净
+	sb_buf->state = FS_DIRTY;
+	ide_write(hd, part->start_lba + 1, sb_buf, 1);
+
+	inode_cache_init(part);
+
+	mount_point* mp = &mount_table[mount_cnt++];
+	strcpy(mp->path, path);
+	mp->part = part;
+	mp->root = dir_open(part, sb_buf->root_inode_no);
+	// 每个分区有自己的写回线程，定期写回文件数据、位图并提交日志
+	thread_start("writeback", 10, writeback_daemon, part);
+	printk("mount %s on %s done!\n", part->name, path);
+}
 
-	cur_part->inode_bitmap.btmp_bytes_len =\
-	sb_buf->inode_bitmap_sects * SECTOR_SIZE;
-	ide_read(
-		hd, sb_buf->inode_bitmap_lba,
-		cur_part->inode_bitmap.bits,
-		sb_buf->inode_bitmap_sects
-	);
+/*
+找到 pathname 所在的挂载点，即路径前缀与 pathname 按整级目录匹配的最长的一项
+*sub_path 指向 pathname 中挂载点之后的部分，挂载点本身时为空串
+*/
+static mount_point* mount_lookup(const char* pathname, const char** sub_path) {
+	mount_point* found = &mount_table[0];
+	uint32_t found_len = 0;
+	uint32_t idx = 1;
+	for (; idx < mount_cnt; idx++) {
+		mount_point* mp = &mount_table[idx];
+		uint32_t len = strlen(mp->path);
+		if (
+			len > found_len && !memcmp(pathname, mp->path, len)
+			&& (pathname[len] == 0 || pathname[len] == '/')
+		) {
+			found = mp;
+			found_len = len;
+		}
+	}
+	*sub_path = pathname + found_len;
+	return found;
+}
 
-	list_init(&cur_part->open_inodes);
-	printk("mount %s done!\n", part->name);
+/* 判断 d 是否是某个挂载点一直打开着的根目录 */
+bool is_mount_root(dir* d) {
+	uint32_t idx = 0;
+	for (; idx < mount_cnt; idx++) {
+		if (mount_table[idx].root == d) {
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	// 返回 1 来使 list_traversal 停止
-	return 1;
+/* 返回 path 所在挂载点的根目录 */
+dir* mount_root_dir(const char* path) {
+	const char* sub_path;
+	return mount_lookup(path, &sub_path)->root;
 }
 
 /* 将最上层的路径名称解析出来，把名字保存在 name_store，并返回名字后面的位置 */
@@ -257,22 +451,35 @@ uint32_t path_depth_cnt(char* pathname) {
 	return depth;
 }
 
-extern dir root_dir;
-/* 搜索文件 pathname，若找到则返回其 inode 号，否则返回 -1 */
+/*
+搜索文件 pathname，若找到则返回其 inode 号，否则返回 -1
+查找在 pathname 所在挂载点的分区内进行，结果所在的分区就是 searched_record->parent_dir->inode->i_part
+*/
 static int search_file(const char* pathname, path_search_record* searched_record) {
-	// 如果待查找的是根目录，那么直接返回已知的根目录信息
-	if (!strcmp(pathname, "/") || !strcmp(pathname, "/.") || !strcmp(pathname, "/..")) {
-		searched_record->parent_dir = &root_dir;
+	uint32_t path_len = strlen(pathname);
+	ASSERT(pathname[0] == '/' && path_len < MAX_PATH_LEN);
+	const char* mnt_sub_path;
+	mount_point* mp = mount_lookup(pathname, &mnt_sub_path);
+	partition* part = mp->part;
+
+	// 如果待查找的是挂载点的根目录，那么直接返回已知的根目录信息
+	if (
+		mnt_sub_path[0] == 0 || !strcmp(mnt_sub_path, "/")
+		|| !strcmp(mnt_sub_path, "/.") || !strcmp(mnt_sub_path, "/..")
+	) {
+		searched_record->parent_dir = mp->root;
 		searched_record->file_type = FT_DIRECTORY;
 		searched_record->searched_path[0] = 0;
-		return 0;
+		return part->sb->root_inode_no;
 	}
 
-	uint32_t path_len = strlen(pathname);
-	// 保证 pathname 至少是这样的路径 /x，且小于最大长度
-	ASSERT(pathname[0] == '/' && path_len > 1 && path_len < MAX_PATH_LEN);
-	char* sub_path = (char*)pathname;
-	dir* parent_dir = &root_dir;
+	char* sub_path = (char*)mnt_sub_path;
+	/*
+	dir_ino 是当前正在查找的目录，parent_dir 是它打开后的 dir 结构
+	只有目录项缓存未命中、需要读目录时才打开它，因此缓存命中时中间各级目录不会被打开
+	*/
+	uint32_t dir_ino = mp->root->inode->i_no;
+	dir* parent_dir = mp->root;
 	dir_entry dir_e;
 
 	// 记录路径解析出来的各级名称，如 /a/b/c 那么每次拆分出的值分别是 a, b, c
@@ -280,7 +487,11 @@ static int search_file(const char* pathname, path_search_record* searched_record
 
 	searched_record->parent_dir = parent_dir;
 	searched_record->file_type = FT_UNKNOWN;
-	uint32_t parent_inode_no = 0;
+	uint32_t parent_inode_no = dir_ino;
+	// 挂载点本身也算作走过的路径，使 searched_path 与 pathname 的深度一致
+	if (mp != &mount_table[0]) {
+		strcpy(searched_record->searched_path, mp->path);
+	}
 
 	sub_path = path_parse(sub_path, name);
 	while (name[0]) {
@@ -290,7 +501,24 @@ static int search_file(const char* pathname, path_search_record* searched_record
 		strcat(searched_record->searched_path, "/");
 		strcat(searched_record->searched_path, name);
 
-		if (search_dir_entry(cur_part, parent_dir, name, &dir_e)) {
+		bool found;
+		// "." 和 ".." 的目标取决于目录所在的位置，目录被删除后 inode 号重用时会变，不放入缓存
+		bool cacheable = strcmp(name, ".") && strcmp(name, "..");
+		if (cacheable && dcache_lookup(part, dir_ino, name, &dir_e)) {
+			found = (dir_e.f_type != FT_UNKNOWN);
+		} else {
+			if (parent_dir == NULL) {
+				parent_dir = dir_open(part, dir_ino);
+			}
+			// 读目录时不持有日志锁，与之并发的创建、删除会改变目录的版本号，使这次的结果不被缓存
+			uint32_t ver = dcache_version(part, dir_ino);
+			found = search_dir_entry(part, parent_dir, name, &dir_e);
+			if (cacheable) {
+				dcache_fill(part, dir_ino, name, found ? &dir_e : NULL, ver);
+			}
+		}
+
+		if (found) {
 			memset(name, 0, MAX_FILE_NAME_LEN);
 
 			// 如果 sub_path 不为 NULL，那么继续拆分路径
@@ -299,28 +527,37 @@ static int search_file(const char* pathname, path_search_record* searched_record
 			}
 
 			if (FT_DIRECTORY == dir_e.f_type) {
-				// 如果被打开的是目录
-				parent_inode_no = parent_dir->inode->i_no;
-				dir_close(parent_dir);
-				searched_record->parent_dir = parent_dir = dir_open(cur_part, dir_e.i_no);
+				// 如果被打开的是目录，进入下一级，暂时不打开它
+				parent_inode_no = dir_ino;
+				if (parent_dir != NULL) {
+					dir_close(parent_dir);
+					parent_dir = NULL;
+				}
+				dir_ino = dir_e.i_no;
 			} else if (FT_REGULAR == dir_e.f_type) {
 				// 如果是普通文件
+				searched_record->parent_dir =
+					parent_dir != NULL ? parent_dir : dir_open(part, dir_ino);
 				searched_record->file_type = FT_REGULAR;
 				return dir_e.i_no;
 			}
 		} else {
 			// TODO: 如果没找到那么直接返回 -1，但先不关闭 parent_dir，方便创建文件
+			searched_record->parent_dir =
+				parent_dir != NULL ? parent_dir : dir_open(part, dir_ino);
 			return -1;
 		}
 	}
 
 	/*
 	如果能执行到这里，那么说明遍历完了全部路径，并且查找的文件或目录只有同名目录存在
-	此时 searched_record->parent_dir 是最后一级目录，所以需要将其更新成倒数第二级的目录
+	此时 searched_record->parent_dir 应该是倒数第二级的目录
 	*/
-	dir_close(searched_record->parent_dir);
+	if (parent_dir != NULL) {
+		dir_close(parent_dir);
+	}
 
-	searched_record->parent_dir = dir_open(cur_part, parent_inode_no);
+	searched_record->parent_dir = dir_open(part, parent_inode_no);
 	searched_record->file_type = FT_DIRECTORY;
 	return dir_e.i_no;
 }
@@ -374,23 +611,28 @@ int32_t sys_open(const char* pathname, uint8_t flags) {
 		return -1;
 	}
 
+	partition* part = searched_record.parent_dir->inode->i_part;
 	// TODO: 这个 switch 为什么不换成 if
 	switch (flags & O_CREAT) {
 	case O_CREAT:
+		// 创建文件涉及的位图、inode 和目录项修改要在同一个事务中
+		journal_begin(part);
 		fd = file_create(searched_record.parent_dir, (strrchr(pathname, '/')+1), flags);
+		journal_end(part);
 		dir_close(searched_record.parent_dir);
 		break;
 	// 其余为打开文件
 	default:
-		fd = file_open(inode_no, flags);
+		fd = file_open(part, inode_no, flags);
 	}
 	// 此 fd 是指任务 pcb->file_table 数组中的下标，而不是全局 file_table 的下标
 	return fd;
 }
 
 /* 将文件描述符转换为全局文件表 file_table 的下标 */
-static uint32_t fd_local2global(uint32_t local_fd) {
+uint32_t fd_local2global(uint32_t local_fd) {
 	task_struct* cur = running_thread();
+	ASSERT(local_fd < cur->fd_table_size);
 	int32_t global_fd = cur->fd_table[local_fd];
 	ASSERT(global_fd >= 0 && global_fd < MAX_FILE_OPEN);
 	return (uint32_t)global_fd;
@@ -400,10 +642,26 @@ static uint32_t fd_local2global(uint32_t local_fd) {
 int32_t sys_close(int32_t fd) {
 	int32_t ret = -1;
 	if (fd > 2) {
+		task_struct* cur = running_thread();
 		uint32_t _fd = fd_local2global(fd);
-		ret = file_close(&file_table[_fd]);
+		file* f = file_get(_fd);
+		ret = 0;
+		// fork 后父子进程共享文件表项，最后一个描述符关闭时才真正关闭文件
+		intr_status old_status = intr_disable();
+		bool last = --f->fd_refs == 0;
+		intr_set_status(old_status);
+		if (last) {
+			partition* part = f->fd_inode->i_part;
+			journal_begin(part);
+			ret = file_close(f);
+			journal_end(part);
+			put_free_slot_in_global(_fd);
+		}
 		// 使该文件描述符可用
-		running_thread()->fd_table[fd] = -1;
+		cur->fd_table[fd] = -1;
+		if ((uint32_t)fd < cur->fd_free_hint) {
+			cur->fd_free_hint = fd;
+		}
 	}
 	return ret;
 }
@@ -424,7 +682,7 @@ int32_t sys_write(int32_t fd, const void* buf, uint32_t count) {
 	}
 
 	uint32_t _fd = fd_local2global(fd);
-	file* wr_file = &file_table[_fd];
+	file* wr_file = file_get(_fd);
 	if (wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR) {
 		return file_write(wr_file, buf, count);
 	} else {
@@ -451,7 +709,7 @@ int32_t sys_read(int32_t fd, void* buf, uint32_t count) {
 	}
 
 	uint32_t _fd = fd_local2global(fd);
-	file* rd_file = &file_table[_fd];
+	file* rd_file = file_get(_fd);
 	if (rd_file->fd_flag & O_CREAT || rd_file->fd_flag & O_WRONLY) {
 		printk("sys_read: not allowed to read file with O_CREAT or O_WRONLY\n");
 		return -1;
@@ -469,7 +727,7 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
 	ASSERT(whence > 0 && whence < 4);
 
 	uint32_t _fd = fd_local2global(fd);
-	file* pf = &file_table[_fd];
+	file* pf = file_get(_fd);
 
 	// 新的偏移量必须位于文件大小之内
 	int32_t new_pos = 0;
@@ -496,13 +754,234 @@ int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence) {
 	return pf->fd_pos;
 }
 
+/*
+从文件描述符 fd 指向的文件的 offset 处读取 count 个字节到 buf，不改变 fd 的读写位置
+成功返回字节数，offset 在文件末尾或之后时返回 -1
+*/
+int32_t sys_pread(int32_t fd, void* buf, uint32_t count, uint32_t offset) {
+	ASSERT(buf != NULL);
+	if (fd <= stderr_no) {
+		printk("sys_pread: fd error\n");
+		return -1;
+	}
+
+	file* rd_file = file_get(fd_local2global(fd));
+	if (rd_file->fd_flag & O_CREAT || rd_file->fd_flag & O_WRONLY) {
+		printk("sys_pread: not allowed to read file with O_CREAT or O_WRONLY\n");
+		return -1;
+	}
+	// 用临时的 file 读，共享同一个全局描述符的任务互不影响
+	file pos_file = {.fd_pos = offset, .fd_flag = rd_file->fd_flag, .fd_inode = rd_file->fd_inode, .fd_refs = 0};
+	return file_read(&pos_file, buf, count);
+}
+
+/*
+把 buf 中 count 个字节写入文件描述符 fd 指向的文件的 offset 处，不改变 fd 的读写位置
+文件末尾之前的部分原地覆盖，超出的部分追加，offset 不能超过文件大小，成功返回写入的字节数，失败返回 -1
+*/
+int32_t sys_pwrite(int32_t fd, const void* buf, uint32_t count, uint32_t offset) {
+	ASSERT(buf != NULL);
+	if (fd <= stderr_no) {
+		printk("sys_pwrite: fd error\n");
+		return -1;
+	}
+
+	file* wr_file = file_get(fd_local2global(fd));
+	if (!(wr_file->fd_flag & O_WRONLY || wr_file->fd_flag & O_RDWR)) {
+		printk("sys_pwrite: not allowed to write file without O_RDWR or O_WRONLY\n");
+		return -1;
+	}
+	inode* wr_inode = wr_file->fd_inode;
+	file pos_file = {.fd_pos = offset, .fd_flag = wr_file->fd_flag, .fd_inode = wr_inode, .fd_refs = 0};
+	int32_t ret = 0;
+
+	/*
+	完全落在文件末尾之前的写只是覆盖，只锁它覆盖的范围，覆盖不同范围的写者可以并行
+	这里不持锁地看一眼文件大小，file_overwrite 会在 inode 的读锁下再检查一次
+	*/
+	uint32_t size = wr_inode->i_size;
+	if (offset <= size && count <= size - offset) {
+		ret = file_overwrite(&pos_file, buf, count);
+		if (ret > 0) {
+			page_cache_update(wr_inode, offset, buf, ret);
+		}
+		return ret;
+	}
+
+	// 要扩展文件时锁住文件末尾之后的范围，持有期间文件大小不会变，覆盖和追加的分界也就不会变
+	range_lock append_range;
+	file_append_lock(wr_inode, &append_range);
+	if (offset > wr_inode->i_size) {
+		inode_range_unlock(wr_inode, &append_range);
+		printk("sys_pwrite: offset beyond the end of file\n");
+		return -1;
+	}
+
+	uint32_t overwrite_cnt = wr_inode->i_size - offset;
+	overwrite_cnt = overwrite_cnt < count ? overwrite_cnt : count;
+	if (overwrite_cnt > 0) {
+		ret = file_overwrite(&pos_file, buf, overwrite_cnt);
+	}
+	if (ret != -1 && count > overwrite_cnt) {
+		int32_t appended = file_append(&pos_file, (const uint8_t*)buf + overwrite_cnt, count - overwrite_cnt);
+		ret = appended == -1 ? -1 : ret + appended;
+	}
+	inode_range_unlock(wr_inode, &append_range);
+	if (ret > 0) {
+		page_cache_update(wr_inode, offset, buf, ret);
+	}
+	return ret;
+}
+
+/*
+依次读入 iovcnt 个缓冲区，一次系统调用完成多次 sys_read，读到文件末尾时提前结束
+返回读出的总字节数，第一个缓冲区就读取失败时返回 -1
+*/
+int32_t sys_readv(int32_t fd, const iovec* iov, uint32_t iovcnt) {
+	if (iovcnt > IOV_MAX) {
+		printk("sys_readv: too many iovecs\n");
+		return -1;
+	}
+	int32_t total = 0;
+	uint32_t idx = 0;
+	for (; idx < iovcnt; idx++) {
+		int32_t ret = sys_read(fd, iov[idx].iov_base, iov[idx].iov_len);
+		if (ret == -1) {
+			return idx == 0 ? -1 : total;
+		}
+		total += ret;
+		if ((uint32_t)ret < iov[idx].iov_len) {
+			break;
+		}
+	}
+	return total;
+}
+
+/* 依次写出 iovcnt 个缓冲区，一次系统调用完成多次 sys_write，返回写入的总字节数，第一个缓冲区就写入失败时返回 -1 */
+int32_t sys_writev(int32_t fd, const iovec* iov, uint32_t iovcnt) {
+	if (iovcnt > IOV_MAX) {
+		printk("sys_writev: too many iovecs\n");
+		return -1;
+	}
+	int32_t total = 0;
+	uint32_t idx = 0;
+	for (; idx < iovcnt; idx++) {
+		int32_t ret = sys_write(fd, iov[idx].iov_base, iov[idx].iov_len);
+		if (ret == -1) {
+			return idx == 0 ? -1 : total;
+		}
+		total += ret;
+	}
+	return total;
+}
+
+/*
+把 fd_in 当前位置起的 count 个字节追加到 fd_out，数据在内核中按 COPY_CHUNK_SECTS 个扇区一批搬运，不经过用户空间
+两个描述符的读写位置都向后移动，成功返回复制的字节数，fd_in 已在文件末尾时返回 0，失败返回 -1
+*/
+int32_t sys_copy_file_range(int32_t fd_in, int32_t fd_out, uint32_t count) {
+	task_struct* cur = running_thread();
+	if (
+		fd_in <= stderr_no || (uint32_t)fd_in >= cur->fd_table_size || cur->fd_table[fd_in] == -1
+		|| fd_out <= stderr_no || (uint32_t)fd_out >= cur->fd_table_size || cur->fd_table[fd_out] == -1
+	) {
+		printk("sys_copy_file_range: fd error\n");
+		return -1;
+	}
+	file* in_file = file_get(fd_local2global(fd_in));
+	file* out_file = file_get(fd_local2global(fd_out));
+	if (in_file->fd_flag & O_CREAT || in_file->fd_flag & O_WRONLY) {
+		printk("sys_copy_file_range: not allowed to read file with O_CREAT or O_WRONLY\n");
+		return -1;
+	}
+	if (!(out_file->fd_flag & O_WRONLY || out_file->fd_flag & O_RDWR)) {
+		printk("sys_copy_file_range: not allowed to write file without O_RDWR or O_WRONLY\n");
+		return -1;
+	}
+
+	// 整段 extent 一次读出、连续的新块一次写入，都是多扇区的传输
+	uint8_t* copy_buf = sys_malloc(COPY_CHUNK_SECTS * SECTOR_SIZE);
+	if (copy_buf == NULL) {
+		printk("sys_copy_file_range: sys_malloc for copy_buf failed\n");
+		return -1;
+	}
+
+	int32_t copied = 0;
+	while ((uint32_t)copied < count) {
+		uint32_t chunk = count - copied;
+		if (chunk > COPY_CHUNK_SECTS * SECTOR_SIZE) {
+			chunk = COPY_CHUNK_SECTS * SECTOR_SIZE;
+		}
+		int32_t bytes_read = file_read(in_file, copy_buf, chunk);
+		if (bytes_read == -1) {
+			break;
+		}
+
+		int32_t bytes_written = file_write(out_file, copy_buf, bytes_read);
+		if (bytes_written == -1) {
+			copied = copied == 0 ? -1 : copied;
+			break;
+		}
+		copied += bytes_written;
+		if ((uint32_t)bytes_read < chunk) {
+			break;
+		}
+	}
+
+	sys_free(copy_buf);
+	return copied;
+}
+
+/*
+把 fd 对应文件还在内存中的数据和所有未提交的元数据写到磁盘上，成功返回 0，失败返回 -1
+普通的写入只进入延迟分配缓冲和日志，需要持久化的调用者用它等待写盘完成
+*/
+int32_t sys_fsync(int32_t fd) {
+	task_struct* cur = running_thread();
+	if (fd <= stderr_no || (uint32_t)fd >= cur->fd_table_size || cur->fd_table[fd] == -1) {
+		printk("sys_fsync: fd error\n");
+		return -1;
+	}
+	file* f = file_get(fd_local2global(fd));
+	partition* part = f->fd_inode->i_part;
+	journal_begin(part);
+	delay_flush(part, f->fd_inode);
+	journal_end(part);
+	// 文件的块分配和 inode 可能与其他操作在同一个事务中，只能整个提交
+	bitmap_flush(part);
+	journal_commit(part);
+	// 事务为空时 journal_commit 不会刷新写缓存，而原地写入的文件数据可能还在硬盘的写缓存中
+	disk_flush(part->my_disk);
+	return 0;
+}
+
+/* 把所有挂载的分区上还在内存中的数据和元数据写到磁盘上 */
+void sys_sync(void) {
+	uint32_t idx = 0;
+	for (; idx < mount_cnt; idx++) {
+		writeback_sync(mount_table[idx].part);
+	}
+}
+
+/* 把 path 所在文件系统的容量和使用情况填入 buf，成功返回 0，失败返回 -1 */
+int32_t sys_statfs(const char* path, fs_stat* buf) {
+	// path 只需是绝对路径，不要求存在，按前缀找到所在的挂载点即可
+	if (path == NULL || path[0] != '/' || buf == NULL) {
+		return -1;
+	}
+	const char* sub_path;
+	struct super_block* sb = mount_lookup(path, &sub_path)->part->sb;
+	buf->f_bsize = BLOCK_SIZE;
+	buf->f_blocks = sb->sec_cnt - (sb->data_start_lba - sb->part_lba_base);
+	buf->f_bfree = sb->free_block_cnt;
+	buf->f_files = sb->inode_cnt;
+	buf->f_ffree = sb->free_inode_cnt;
+	return 0;
+}
+
 /* 打开一个目录，成功返回目录指针，失败返回 NULL */
 dir* sys_opendir(const char* name) {
 	ASSERT(strlen(name) < MAX_PATH_LEN);
-	if (name[0] == '/' && name[1] == 0) {
-		return &root_dir;
-	}
-
 	path_search_record searched_record;
 	memset(&searched_record, 0, sizeof(path_search_record));
 	int inode_no = search_file(name, &searched_record);
@@ -516,7 +995,7 @@ dir* sys_opendir(const char* name) {
 		if (searched_record.file_type == FT_REGULAR) {
 			printk("%s is a regular file\n", name);
 		} else if (searched_record.file_type == FT_DIRECTORY) {
-			ret = dir_open(cur_part, inode_no);
+			ret = dir_open(searched_record.parent_dir->inode->i_part, inode_no);
 		}
 	}
 	dir_close(searched_record.parent_dir);
@@ -540,36 +1019,27 @@ int32_t sys_unlink(const char* pathname) {
 	path_search_record searched_record;
 	memset(&searched_record, 0, sizeof(path_search_record));
 	int inode_no = search_file(pathname, &searched_record);
-	ASSERT(inode_no != 0);
 	if (inode_no == -1) {
 		printk("file %s not found\n", pathname);
 		dir_close(searched_record.parent_dir);
 		return -1;
 	}
 
-	if (searched_record.file_type == FT_DIRECTORY) {
+	// 各挂载点的根目录（如 / 和 /sdb5）的 inode 号都是 0，要在断言之前拦下
+	partition* part = searched_record.parent_dir->inode->i_part;
+	if (searched_record.file_type == FT_DIRECTORY || (uint32_t)inode_no == part->sb->root_inode_no) {
 		printk("can't delete a direcotry now");
 		dir_close(searched_record.parent_dir);
 		return -1;
 	}
+	ASSERT(inode_no != 0);
 
-	/* 检查是否在已经打开的文件列表中 */
-	uint32_t file_idx = 0;
-	while (file_idx < MAX_FILE_OPEN) {
-		if (
-			file_table[file_idx].fd_inode != NULL
-			&& (uint32_t)inode_no == file_table[file_idx].fd_inode->i_no
-		) {
-			break;
-		}
-		file_idx++;
-	}
-	if (file_idx < MAX_FILE_OPEN) {
+	/* 检查文件是否被打开，打开的文件和 mmap 建立的映射都持有 inode，不必再扫描整个文件表 */
+	if (inode_is_open(part, inode_no)) {
 		dir_close(searched_record.parent_dir);
 		printk("file %s is in use, not allow to delete\n", pathname);
 		return -1;
 	}
-	ASSERT(file_idx == MAX_FILE_OPEN);
 
 	void* io_buf = sys_malloc(SECTOR_SIZE * 2);
 	if (io_buf == NULL) {
@@ -579,14 +1049,17 @@ int32_t sys_unlink(const char* pathname) {
 	}
 
 	dir* parent_dir = searched_record.parent_dir;
-	delete_dir_entry(cur_part, parent_dir, inode_no, io_buf);
-	inode_release(cur_part, inode_no);
+	journal_begin(part);
+	delete_dir_entry(part, parent_dir, inode_no, io_buf);
+	inode_release(part, inode_no);
+	journal_end(part);
 	sys_free(io_buf);
 	dir_close(searched_record.parent_dir);
 	return 0;
 }
 
 static bool for_each_partition(struct list_elem* tag, int unused) {
+	(void)unused;
 	partition* part = elem2entry(partition, part_tag, tag);
 	struct super_block sb_buf[1] = {0};
 
@@ -594,7 +1067,7 @@ static bool for_each_partition(struct list_elem* tag, int unused) {
 	ide_read(part->my_disk, part->start_lba + 1, sb_buf, 1);
 
 	// 只支持自建的文件系统
-	if (sb_buf->magic == *((uint32_t*) "iLym")) {
+	if (sb_buf->magic == FS_MAGIC) {
 		printk("%s has filesystem\n", part->name);
 	} else {
 		partition_format(part);
@@ -603,17 +1076,41 @@ static bool for_each_partition(struct list_elem* tag, int unused) {
 	return 0;
 }
 
+/* 在分区链表中找到名为 part_name 的分区，挂载到 "/" 上 */
+static bool mount_root_partition(struct list_elem* pelem, int arg) {
+	char* part_name = (char*) arg;
+	partition* part = elem2entry(partition, part_tag, pelem);
+	if (strcmp(part->name, part_name)) {
+		// 返回 0 来使 list_traversal 继续扫描
+		return 0;
+	}
+	mount_partition(part, "/");
+	// 返回 1 来使 list_traversal 停止
+	return 1;
+}
+
+/* 把根分区以外的分区挂载到根目录下以分区名命名的路径上，如 /sdb5 */
+static bool mount_other_partition(struct list_elem* pelem, int unused) {
+	(void)unused;
+	partition* part = elem2entry(partition, part_tag, pelem);
+	if (part != mount_table[0].part) {
+		char path[MAX_MOUNT_PATH_LEN] = "/";
+		strcat(path, part->name);
+		mount_partition(part, path);
+	}
+	return 0;
+}
+
 /* 在磁盘上搜索文件系统，若没有则格式化分区来创建之 */
 void filesys_init() {
 	printk("searching filesystem...\n");
+	dcache_init();
 	// 格式化硬盘中的每个分区
 	list_traversal(&partition_list, for_each_partition, 0);
-	// 将 sdb1 挂载到内存
-	list_traversal(&partition_list, mount_partition, (int)"sdb1");
-	// 打开挂载的分区的根目录
-	open_root_dir(cur_part);
+	// 将 sdb1 挂载为根，其余分区挂载在它的根目录下
+	list_traversal(&partition_list, mount_root_partition, (int)"sdb1");
+	ASSERT(mount_cnt == 1);
+	list_traversal(&partition_list, mount_other_partition, 0);
 	// 初始化文件表
-	for(int i=0; i<MAX_FILE_OPEN; i++) {
-		file_table[i].fd_inode = NULL;
-	}
+	file_table_init();
 }
\ No newline at end of file
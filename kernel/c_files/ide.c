@@ -2,6 +2,7 @@
 #include "ide.h"
 #include "stdio.h"
 #include "timer.h"
+#include "thread.h"
 #include "memory.h"
 #include "string.h"
 
@@ -48,6 +49,8 @@
 #define BIT_ALT_STAT_DRDY 0x40
 // 数据传输准备好
 #define BIT_ALT_STAT_DRQ  0x8
+// 上一条命令出错
+#define BIT_ALT_STAT_ERR  0x1
 
 /* device 寄存器的一些关键位 */
 #define BIT_DEV_MBS 0xa0
@@ -55,12 +58,17 @@
 #define BIT_DEV_DEV 0x10
 
 /* 一些硬盘操作的指令 */
-#define CMD_IDENTIFY     0xec
-#define CMD_READ_SECTOR  0x20
-#define CMD_WRITE_SECTOR 0x30
-
-/* 调试用，定义可读写的最大扇区数，当前支持 80MB 的硬盘 */
-#define max_lba ((80*1024*1024/512)-1)
+#define CMD_IDENTIFY         0xec
+#define CMD_READ_SECTOR      0x20
+#define CMD_WRITE_SECTOR     0x30
+#define CMD_READ_SECTOR_EXT  0x24
+#define CMD_WRITE_SECTOR_EXT 0x34
+#define CMD_FLUSH_CACHE      0xe7
+#define CMD_FLUSH_CACHE_EXT  0xea
+
+/* 一条命令最多操作的扇区数，28 位 lba 的扇区数寄存器为 8 位，48 位 lba 为 16 位 */
+#define LBA28_MAX_SECTS 256
+#define LBA48_MAX_SECTS 65536
 
 // 按硬盘数计算的通道数
 uint8_t channel_cnt;
@@ -121,12 +129,29 @@ static void select_disk(disk* hd) {
 	outb(reg_dev(hd->my_channel), reg_device);
 }
 
-/* 向硬盘控制器写入起始扇区地址及要读写的扇区数，当 sec_cnt 为 0 时表示 256 个扇区 */
-static void select_sector(disk* hd, uint32_t lba, uint8_t sec_cnt) {
-	ASSERT(lba <= max_lba);
+/*
+向硬盘控制器写入起始扇区地址及要读写的扇区数，写入寄存器的扇区数为 0 时表示最大值
+48 位 lba 的扇区数和地址寄存器都是两字节的先入先出队列，要先写高字节再写低字节
+*/
+static void select_sector(disk* hd, uint32_t lba, uint32_t sec_cnt) {
+	ASSERT(lba < hd->sec_cnt);
 
 	ide_channel* channel = hd->my_channel;
 
+	if (hd->lba48) {
+		// lba 的第 32~47 位始终为 0
+		outb(reg_sect_cnt(channel), sec_cnt >> 8);
+		outb(reg_lba_l(channel), lba >> 24);
+		outb(reg_lba_m(channel), 0);
+		outb(reg_lba_h(channel), 0);
+		outb(reg_sect_cnt(channel), sec_cnt);
+		outb(reg_lba_l(channel), lba);
+		outb(reg_lba_m(channel), lba >> 8);
+		outb(reg_lba_h(channel), lba >> 16);
+		outb(reg_dev(channel), BIT_DEV_MBS | BIT_DEV_LBA | (hd->dev_no == 1? BIT_DEV_DEV : 0));
+		return;
+	}
+
 	// 写入要读取的扇区数
 	outb(reg_sect_cnt(channel), sec_cnt);
 
@@ -138,127 +163,313 @@ static void select_sector(disk* hd, uint32_t lba, uint8_t sec_cnt) {
 	(hd->dev_no == 1? BIT_DEV_DEV : 0) | lba >> 24);
 }
 
+/* 读 4 次 alt_status 约等待 400ns，硬盘收到命令或一个扇区的数据后要这么久才会更新状态 */
+static void ata_delay_400ns(ide_channel* channel) {
+	uint8_t idx = 0;
+	for (; idx < 4; idx++) {
+		inb(reg_alt_status(channel));
+	}
+}
+
 /* 向通道 channel 发送命令 cmd */
 static void cmd_out(ide_channel* channel, uint8_t cmd) {
 	// 只要向硬盘发送了命令就置为 1，方便中断处理程序
 	channel->expecting_intr = 1;
 	outb(reg_cmd(channel), cmd);
+	ata_delay_400ns(channel);
 }
 
-/* 将以扇区为单位的存储空间转换为以字节为单位 */
-static uint32_t sec_cnt2size_in_byte(uint8_t sec_cnt) {
-	uint32_t size_in_byte;
-	if (sec_cnt == 0) {
-		size_in_byte = 256 * 512;
-	} else {
-		size_in_byte = sec_cnt * 512;
+/*
+硬盘读入一个扇区到 buf，假设扇区大小为 512 字节
+PIO 每次 DRQ 只传输一个扇区，more 表示之后还有扇区，硬盘准备好下一个扇区时会再发中断
+*/
+static void read_from_sector(disk* hd, void* buf, bool more) {
+	// 取走最后一个字后硬盘就可能发出下一个中断，要在这之前登记
+	if (more) {
+		hd->my_channel->expecting_intr = 1;
+	}
+	insw(reg_data(hd->my_channel), buf, 512 / 2);
+	if (more) {
+		ata_delay_400ns(hd->my_channel);
 	}
-	return size_in_byte;
 }
 
-/* 硬盘读入 sec_cnt 个扇区到 buf，假设扇区大小为 512 字节 */
-static void read_from_sector(disk* hd, void* buf, uint8_t sec_cnt) {
-	uint32_t size_in_byte = sec_cnt2size_in_byte(sec_cnt);
-	insw(reg_data(hd->my_channel), buf, size_in_byte / 2);
+/* 将 buf 中一个扇区的数据写入硬盘，硬盘写完这个扇区后发出中断 */
+static void write2sector(disk* hd, void* buf) {
+	hd->my_channel->expecting_intr = 1;
+	outsw(reg_data(hd->my_channel), buf, 512 / 2);
+	ata_delay_400ns(hd->my_channel);
+}
+
+/* 自旋轮询 alt_status 的次数上限，每次端口读取约 1 微秒，超过后改为睡眠等待 */
+#define IDE_SPIN_LIMIT 1000
+/* 等待硬盘的最长时间，因为据说硬盘处理请求最多花费 31 秒 */
+#define IDE_TIMEOUT_MS (30 * 1000)
+
+// 自中断开启以来的总滴答数，定义在 timer.c 中
+extern uint32_t ticks;
+
+/* 读取时间戳计数器的低 32 位，用于统计命令的延迟 */
+static inline uint32_t rdtsc_low(void) {
+	uint32_t low, high;
+	__asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+	return low;
 }
 
-/* 将 buf 中 sec_cnt 扇区的数据写入硬盘 */
-static void write2sector(disk* hd, void* buf, uint8_t sec_cnt) {
-	uint32_t size_in_byte = sec_cnt2size_in_byte(sec_cnt);
-	outsw(reg_data(hd->my_channel), buf, size_in_byte / 2);
+/* 把一次单扇区读耗费的时钟周期数 cycles 计入直方图 */
+static void record_read_latency(ide_channel* channel, uint32_t cycles) {
+	uint32_t bucket = 0;
+	cycles >>= 12;
+	while (cycles != 0 && bucket < IDE_LAT_BUCKETS - 1) {
+		cycles >>= 1;
+		bucket++;
+	}
+	channel->stats.read_lat_hist[bucket]++;
 }
 
-/* 等待 30 秒或到硬盘准备好，因为据说硬盘处理请求最多花费 31 秒 */
-static bool busy_wait(disk* hd) {
+/*
+等待已发出的命令完成，返回硬盘的状态，超时则返回 BIT_ALT_STAT_BSY
+先在 alt_status 上短暂自旋，读这个寄存器不会清除硬盘的中断，
+若硬盘仍然忙，再睡眠等待中断，这样很快就绪的硬盘不必白等一个 tick
+*/
+static uint8_t wait_disk_done(disk* hd) {
 	ide_channel* channel = hd->my_channel;
-	uint16_t time_limit = 30 * 1000;
-	while (time_limit -= 10 >= 0) {
-		if (! (inb(reg_status(channel)) & BIT_ALT_STAT_BSY)) {
-			return (inb(reg_status(channel)) & BIT_ALT_STAT_DRQ);
+	intr_status old_status;
+	uint8_t status;
+	uint32_t spin = 0;
+
+	while (spin++ < IDE_SPIN_LIMIT) {
+		status = inb(reg_alt_status(channel));
+		if (status & BIT_ALT_STAT_BSY) {
+			continue;
+		}
+		old_status = intr_disable();
+		if (channel->expecting_intr) {
+			// 中断还没来，由这里认领此次完成，读 status 寄存器来清除硬盘的中断
+			channel->expecting_intr = 0;
+			status = inb(reg_status(channel));
 		} else {
-			mtime_sleep(10);
+			// 中断已经来过并做了 sema_up，需要把信号量消耗掉
+			sema_down(&channel->disk_done);
 		}
+		intr_set_status(old_status);
+		channel->stats.spin_done++;
+		return status;
 	}
-	return 0;
-}
 
-/* 从硬盘读取 sec_cnt 个扇区到 buf */
-void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-	ASSERT(lba <= max_lba);
-	ASSERT(sec_cnt > 0);
-	lock_acquire(&hd->my_channel->lock);
+	if (sema_down_timeout(&channel->disk_done, MS2TICKS(IDE_TIMEOUT_MS))) {
+		channel->stats.intr_done++;
+		return inb(reg_alt_status(channel));
+	}
 
-	// 先选择要操作的硬盘
-	select_disk(hd);
+	old_status = intr_disable();
+	if (channel->expecting_intr) {
+		// 确实超时了，之后迟到的中断不应再 sema_up
+		channel->expecting_intr = 0;
+		status = BIT_ALT_STAT_BSY;
+		channel->stats.timeouts++;
+	} else {
+		// 超时的同时中断到达了，仍算作完成
+		sema_down(&channel->disk_done);
+		status = inb(reg_alt_status(channel));
+		channel->stats.intr_done++;
+	}
+	intr_set_status(old_status);
+	return status;
+}
 
-	// 要操作的总扇区数
-	uint32_t secs_op;
-	// 已经完成的扇区数
-	uint32_t secs_done = 0;
-	while (secs_done < sec_cnt) {
-		if ((secs_done + 256) <= sec_cnt) {
-			secs_op = 256;
-		} else {
-			secs_op = sec_cnt - secs_done;
+/*
+等待硬盘请求数据，用于写命令发出后、传输数据前，这一阶段硬盘不会发中断
+先自旋，仍未就绪就让出 cpu 后再查，不再固定睡眠 10ms
+*/
+static bool wait_data_request(disk* hd) {
+	ide_channel* channel = hd->my_channel;
+	uint32_t start_tick = ticks;
+	uint32_t spin = 0;
+	uint8_t status;
+
+	while (1) {
+		status = inb(reg_alt_status(channel));
+		if (! (status & BIT_ALT_STAT_BSY)) {
+			return (status & BIT_ALT_STAT_DRQ);
+		}
+		if (++spin < IDE_SPIN_LIMIT) {
+			continue;
 		}
+		if (ticks - start_tick >= MS2TICKS(IDE_TIMEOUT_MS)) {
+			return 0;
+		}
+		thread_yeild();
+	}
+}
 
-		// 写入待读取的扇区数和起始扇区号码
-		select_sector(hd, lba + secs_done, secs_op);
+/*
+为请求 req 发出下一条命令，只发命令不传数据，
+这样 raid0 等调用者可以先在各个通道上都发出命令，让各硬盘同时寻道，再逐个等待
+*/
+static void ata_start_cmd(disk_req* req) {
+	disk* hd = req->hd;
+	uint32_t secs_left = req->sec_cnt - req->secs_done;
 
-		// 写入读命令
-		cmd_out(hd->my_channel, CMD_READ_SECTOR);
+	// 一条命令最多操作 256 个扇区，支持 48 位 lba 时为 65536 个
+	uint32_t max_sects = hd->lba48 ? LBA48_MAX_SECTS : LBA28_MAX_SECTS;
+	req->secs_op = secs_left < max_sects ? secs_left : max_sects;
+	req->start_cycles = rdtsc_low();
 
-		// 将当前线程阻塞，直到硬盘完成读操作后唤醒自己
-		sema_down(&hd->my_channel->disk_done);
+	// 写入待操作的扇区数和起始扇区号码
+	select_sector(hd, req->lba + req->secs_done, req->secs_op);
 
-		if (! busy_wait(hd)) {
-			// 如果读取失败
-			printk("%s read sector %d failed", hd->name, lba);
+	if (req->is_write) {
+		cmd_out(hd->my_channel, hd->lba48 ? CMD_WRITE_SECTOR_EXT : CMD_WRITE_SECTOR);
+	} else {
+		cmd_out(hd->my_channel, hd->lba48 ? CMD_READ_SECTOR_EXT : CMD_READ_SECTOR);
+	}
+}
+
+/* 完成当前命令的数据阶段，写命令在这里把数据交给硬盘，读命令在这里把数据从硬盘取出 */
+static void ata_finish_cmd(disk_req* req) {
+	disk* hd = req->hd;
+	uint8_t* buf = (uint8_t*)req->buf + req->secs_done * 512;
+	uint32_t sec_idx = 0;
+	uint8_t status;
+
+	if (req->is_write) {
+		// 第一个扇区在 DRQ 置位后写入，之后每写完一个扇区，硬盘发出中断并为下一个扇区置位 DRQ
+		for (; sec_idx < req->secs_op; sec_idx++) {
+			bool ready;
+			if (sec_idx == 0) {
+				ready = wait_data_request(hd);
+			} else {
+				status = wait_disk_done(hd);
+				ready = !(status & (BIT_ALT_STAT_BSY | BIT_ALT_STAT_ERR)) && (status & BIT_ALT_STAT_DRQ);
+			}
+			if (! ready) {
+				// 如果硬盘当前不可写
+				printk("%s write sector %d failed", hd->name, req->lba);
+				intr_disable();
+				while (1);
+			}
+			write2sector(hd, buf + sec_idx * 512);
+		}
+
+		// 等待硬盘把最后一个扇区写完
+		status = wait_disk_done(hd);
+		if (status & (BIT_ALT_STAT_BSY | BIT_ALT_STAT_ERR)) {
+			printk("%s write sector %d failed", hd->name, req->lba);
 			intr_disable();
 			while (1);
 		}
+		req->secs_done += req->secs_op;
+		return;
+	}
 
-		read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-		secs_done += secs_op;
+	// 每个扇区准备好时硬盘都发出中断并置位 DRQ，逐个扇区等待后取出
+	for (; sec_idx < req->secs_op; sec_idx++) {
+		status = wait_disk_done(hd);
+		if ((status & (BIT_ALT_STAT_BSY | BIT_ALT_STAT_ERR)) || ! (status & BIT_ALT_STAT_DRQ)) {
+			printk("%s read sector %d failed", hd->name, req->lba);
+			intr_disable();
+			while (1);
+		}
+		if (req->secs_op == 1) {
+			record_read_latency(hd->my_channel, rdtsc_low() - req->start_cycles);
+		}
+		read_from_sector(hd, buf + sec_idx * 512, sec_idx + 1 < req->secs_op);
 	}
-	lock_release(&hd->my_channel->lock);
+	req->secs_done += req->secs_op;
 }
 
-/* 将 buf 中 sec_cnt 扇区数据写入硬盘 */
-void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-	ASSERT(lba <= max_lba);
-	ASSERT(sec_cnt > 0);
-	lock_acquire(&hd->my_channel->lock);
+/* ide 硬盘发出请求，从此时起独占硬盘所在的通道，直到 ata_wait 返回 */
+static void ata_submit(disk_req* req) {
+	ASSERT(req->sec_cnt > 0);
+	ASSERT(req->lba + req->sec_cnt <= req->hd->sec_cnt);
+	lock_acquire(&req->hd->my_channel->lock);
 
-	// 先选择操作的硬盘
-	select_disk(hd);
+	// 先选择要操作的硬盘
+	select_disk(req->hd);
+	ata_start_cmd(req);
+}
 
-	uint32_t secs_op;
-	uint32_t secs_done = 0;
-	while (secs_done < sec_cnt) {
-		if ((secs_done + 256) <= sec_cnt) {
-			secs_op = 256;
-		} else {
-			secs_op = sec_cnt - secs_done;
-		}
+/* 等待 ide 硬盘上的请求完成，超过一条命令上限的请求会在这里继续发出后面的命令 */
+static void ata_wait(disk_req* req) {
+	ata_finish_cmd(req);
+	while (req->secs_done < req->sec_cnt) {
+		ata_start_cmd(req);
+		ata_finish_cmd(req);
+	}
+	lock_release(&req->hd->my_channel->lock);
+}
 
-		select_sector(hd, lba + secs_done, secs_op);
+/*
+让 ide 硬盘把写缓存中的数据落盘，命令没有数据阶段，完成时硬盘发出中断
+不支持这条命令的老硬盘会报错，它们也没有写缓存，忽略即可
+*/
+static void ata_flush(disk* hd) {
+	lock_acquire(&hd->my_channel->lock);
+	select_disk(hd);
+	cmd_out(hd->my_channel, hd->lba48 ? CMD_FLUSH_CACHE_EXT : CMD_FLUSH_CACHE);
+	if (wait_disk_done(hd) & BIT_ALT_STAT_BSY) {
+		printk("%s flush cache failed", hd->name);
+		intr_disable();
+		while (1);
+	}
+	lock_release(&hd->my_channel->lock);
+}
 
-		cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
+// ide 硬盘的 PIO 驱动
+static disk_ops ata_ops = {ata_submit, ata_wait, ata_flush};
+
+/* 初始化一个硬盘请求 */
+void disk_req_init(disk_req* req, disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+	req->hd = hd;
+	req->lba = lba;
+	req->buf = buf;
+	req->sec_cnt = sec_cnt;
+	req->is_write = is_write;
+	req->secs_done = req->secs_op = 0;
+}
 
-		if (! busy_wait(hd)) {
-			// 如果硬盘当前不可写
-			printk("%s read sector %d failed", hd->name, lba);
-			intr_disable();
-			while (1);
-		}
+/*
+向请求所在的硬盘发出请求，不等待其完成，长度为 0 的请求什么也不做
+驱动在中断上下文或持有通道、命令槽时访问缓冲区，不能再触发缺页，因此先映射好缓冲区的每一页
+*/
+void disk_submit(disk_req* req) {
+	if (req->sec_cnt == 0) {
+		return;
+	}
+	page_prefault(req->buf, req->sec_cnt * 512);
+	req->hd->ops->submit(req);
+}
 
-		write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
+/* 等待 disk_submit 发出的请求完成 */
+void disk_wait(disk_req* req) {
+	if (req->sec_cnt == 0) {
+		return;
+	}
+	req->hd->ops->wait(req);
+}
 
-		sema_down(&hd->my_channel->disk_done);
-		secs_done += secs_op;
+/* 等待硬盘 hd 把已经完成的写落盘，之后发出的写不会先于它们到达盘片 */
+void disk_flush(disk* hd) {
+	if (hd->ops->flush != NULL) {
+		hd->ops->flush(hd);
 	}
-	lock_release(&hd->my_channel->lock);
+}
+
+/* 从硬盘读取 sec_cnt 个扇区到 buf */
+void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+	disk_req req;
+	disk_req_init(&req, hd, lba, buf, sec_cnt, 0);
+	disk_submit(&req);
+	disk_wait(&req);
+}
+
+/* 将 buf 中 sec_cnt 扇区数据写入硬盘 */
+void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+	disk_req req;
+	disk_req_init(&req, hd, lba, buf, sec_cnt, 1);
+	disk_submit(&req);
+	disk_wait(&req);
 }
 
 /* 硬盘中断处理程序 */
@@ -298,15 +509,14 @@ static void identify_disk(disk* hd) {
 	char hd_info[512];
 	select_disk(hd);
 	cmd_out(hd->my_channel, CMD_IDENTIFY);
-	sema_down(&hd->my_channel->disk_done);
 
-	if (! busy_wait(hd)) {
+	if (! (wait_disk_done(hd) & BIT_ALT_STAT_DRQ)) {
 		printk("%s identify failed", hd->name);
 		intr_disable();
 		while (1);
 	}
 
-	read_from_sector(hd, hd_info, 1);
+	read_from_sector(hd, hd_info, 0);
 
 	char buf[64];
 	uint8_t sn_start = 10 * 2, sn_len = 20, md_start = 27 * 2, md_len = 40;
@@ -315,10 +525,20 @@ static void identify_disk(disk* hd) {
 	memset(buf, 0, sizeof(buf));
 	swap_pairs_bytes(&hd_info[md_start], buf, md_len);
 	printk("   MODULE: %s\n", buf);
-	//TODO: 这里可供使用的扇区数应该是长度为 2 的整型，用 uint32_t 是否会有问题
-	uint32_t sectors = *(uint32_t*)&hd_info[60 * 2];
-	printk("   SECTORS: %d\n", sectors);
-	printk("   CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
+
+	/*
+	第 83 字的第 10 位表示支持 48 位 lba，此时扇区数在 100~103 字中，
+	否则在 60~61 字中，超过 32 位能表示的部分不使用
+	*/
+	uint16_t* id = (uint16_t*)hd_info;
+	hd->lba48 = (id[83] & 0x400) != 0;
+	if (hd->lba48) {
+		hd->sec_cnt = (id[102] || id[103]) ? 0xffffffff : id[100] | ((uint32_t)id[101] << 16);
+	} else {
+		hd->sec_cnt = id[60] | (id[61] << 16);
+	}
+	printk("   SECTORS: %d%s\n", hd->sec_cnt, hd->lba48 ? " (LBA48)" : "");
+	printk("   CAPACITY: %dMB\n", hd->sec_cnt / 2048);
 }
 
 /* 扫描硬盘 hd 中地址为 ext_lba 的扇区中所有的分区 */
@@ -348,6 +568,7 @@ static void partition_scan(disk* hd, uint32_t ext_lba) {
 				hd->prim_parts[p_no].start_lba = ext_lba + p->start_lba;
 				hd->prim_parts[p_no].sec_cnt = p->sec_cnt;
 				hd->prim_parts[p_no].my_disk = hd;
+				hd->prim_parts[p_no].fs_type = p->fs_type;
 				list_append(&partition_list, &hd->prim_parts[p_no].part_tag);
 				sprintf(
 					hd->prim_parts[p_no].name,
@@ -361,6 +582,7 @@ static void partition_scan(disk* hd, uint32_t ext_lba) {
 				hd->logic_parts[l_no].start_lba = ext_lba + p->start_lba;
 				hd->logic_parts[l_no].sec_cnt = p->sec_cnt;
 				hd->logic_parts[l_no].my_disk = hd;
+				hd->logic_parts[l_no].fs_type = p->fs_type;
 				list_append(&partition_list, &hd->logic_parts[l_no].part_tag);
 				sprintf(
 					hd->logic_parts[l_no].name,
@@ -376,6 +598,15 @@ static void partition_scan(disk* hd, uint32_t ext_lba) {
 	sys_free(bs);
 }
 
+/* 扫描硬盘 hd 上的所有分区并加入分区队列，其他驱动的硬盘也用它扫描分区 */
+void disk_scan_partitions(disk* hd) {
+	p_no = 0, l_no = 0;
+	ext_lba_base = 0;
+	partition_scan(hd, 0);
+	p_no = 0, l_no = 0;
+	ext_lba_base = 0;
+}
+
 static bool partition_info(struct list_elem* pelem, int arg) {
 	partition* part = elem2entry(partition, part_tag, pelem);
 	printk(
@@ -385,6 +616,35 @@ static bool partition_info(struct list_elem* pelem, int arg) {
 	return 0;
 }
 
+/* 打印所有硬盘上的分区信息 */
+void disk_print_partitions() {
+	printk("\n  all partition info\n");
+	list_traversal(&partition_list, partition_info, (int)NULL);
+}
+
+/* 打印各通道的命令完成统计及单扇区读延迟直方图 */
+void ide_print_stats() {
+	uint8_t channel_no = 0;
+	while (channel_no < channel_cnt) {
+		ide_stats* st = &channels[channel_no].stats;
+		printk(
+			"  %s spin_done: %d, intr_done: %d, timeouts: %d\n"
+			"   1-sector read latency (x4096 cycles):",
+			channels[channel_no].name,
+			st->spin_done, st->intr_done, st->timeouts
+		);
+		uint32_t bucket = 0;
+		while (bucket < IDE_LAT_BUCKETS) {
+			if (st->read_lat_hist[bucket] != 0) {
+				printk(" <%d:%d", 1 << bucket, st->read_lat_hist[bucket]);
+			}
+			bucket++;
+		}
+		printk("\n");
+		channel_no++;
+	}
+}
+
 /* 硬盘数据结构初始化 */
 void ide_init() {
 	printk("ide_init start\n");
@@ -428,23 +688,29 @@ void ide_init() {
 		sema_init(&channel->disk_done, 0);
 		register_handler(channel->irq_no, intr_hd_handler);
 
-		while (dev_no < 2) {
+		// 没有 ide 控制器时（比如只有 ahci 的机器）总线浮空，状态寄存器读出 0xff
+		if (inb(reg_status(channel)) == 0xff) {
+			channel_no++;
+			continue;
+		}
+
+		// 硬盘数为奇数时，最后一个通道上只有主盘
+		while (dev_no < 2 && channel_no*2 + dev_no < hd_cnt) {
 			disk* hd = &channel->devices[dev_no];
+			hd->ops = &ata_ops;
+			hd->priv = NULL;
 			hd->my_channel = channel;
 			hd->dev_no = dev_no;
 			sprintf(hd->name, "sd%c", 'a'+channel_no*2 + dev_no);
 			identify_disk(hd);
-			if (dev_no != 0) {
+			if (channel_no != 0 || dev_no != 0) {
 				// 不处理 hd60M.img 这个裸盘
-				partition_scan(hd, 0);
+				disk_scan_partitions(hd);
 			}
-			p_no = 0, l_no = 0;
 			dev_no++;
 		}
 		dev_no = 0;
 		channel_no++;
 	}
-	printk("\n  all partition info\n");
-	list_traversal(&partition_list, partition_info, (int)NULL);
 	printk("ide_init done\n");
 }
\ No newline at end of file
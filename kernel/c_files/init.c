@@ -7,7 +7,11 @@
 #include "keyboard.h"
 #include "syscall.h"
 #include "ide.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "raid0.h"
 #include "fs.h"
+#include "mmap.h"
 
 extern void timer_init(void);
 extern void tss_init();
@@ -26,5 +30,12 @@ void init_all() {
 	tss_init();
 	syscall_init();
 	ide_init();
+	ahci_init();
+	virtio_blk_init();
+	// 把不同通道上的 raid 成员分区组装成条带卷
+	raid0_init();
+	disk_print_partitions();
 	filesys_init();
+	mmap_init();
+	ide_print_stats();
 }
\ No newline at end of file
@@ -4,12 +4,17 @@
 #include "inode.h"
 #include "list.h"
 #include "file.h"
+#include "extent.h"
+#include "journal.h"
+#include "page_cache.h"
+#include "dcache.h"
 #include "fs.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "stdio.h"
 
 /* 用来存储 inode 位置 */
 typedef struct {
-	// inode 是否跨扇区
-	uint8_t two_sec;
 	// inode 所在的扇区号
 	uint32_t sec_lba;
 	// inode 在扇区内的字节偏移量
@@ -19,120 +24,293 @@ typedef struct {
 /* 获取 inode 所在的扇区和扇区内的偏移量 */
 static void inode_locate(partition* part, uint32_t inode_no,
 inode_position* inode_pos) {
-	// 单硬盘最多支持 4096 个 inode
-	ASSERT(inode_no < MAX_FILES_PER_PART);
-	uint32_t inode_table_lba = part->sb->inode_table_lba;
-
-	uint32_t inode_size = sizeof(inode);
-	// 当前 inode 在 inode_table 中的偏移量
-	uint32_t off_size = inode_no * inode_size;
-	// 当前 inode 在相对 inode_table 的第几个扇区
-	uint32_t off_sec = off_size / SECTOR_SIZE;
-	// 当前 inode 在对应扇区内的偏移量
-	uint32_t off_size_in_sec = off_size % SECTOR_SIZE;
-
-	// 判断当前 inode 是否跨 2 个扇区
-	uint32_t left_in_sec = SECTOR_SIZE - off_size_in_sec;
-	if (left_in_sec < inode_size) {
-		inode_pos->two_sec = 1;
+	// inode 数在格式化时按分区大小确定
+	ASSERT(inode_no < part->sb->inode_cnt);
+	// 磁盘 inode 的大小整除扇区大小，不会跨扇区
+	inode_pos->sec_lba = part->sb->inode_table_lba + inode_no / INODES_PER_SECTOR;
+	inode_pos->off_size = inode_no % INODES_PER_SECTOR * sizeof(disk_inode);
+}
+
+/* 返回 inode 数组中扇区 lba 所在分配组的描述符，并把它在组内是第几个扇区存入 sec_in_group */
+static group_desc* inode_table_group(struct super_block* sb, uint32_t lba, uint32_t* sec_in_group) {
+	uint32_t group_sects = sb->inodes_per_group / INODES_PER_SECTOR;
+	uint32_t sec = lba - sb->inode_table_lba;
+	*sec_in_group = sec % group_sects;
+	return &sb->groups[sec / group_sects];
+}
+
+/* 读入 inode 数组中的扇区 lba，组内还没有初始化的扇区当作全 0 */
+static void inode_table_read(partition* part, uint32_t lba, void* buf) {
+	uint32_t sec_in_group;
+	group_desc* gd = inode_table_group(part->sb, lba, &sec_in_group);
+	if (sec_in_group < gd->inode_table_inited) {
+		journal_read(part, lba, buf, 1);
 	} else {
-		inode_pos->two_sec = 0;
+		memset(buf, 0, SECTOR_SIZE);
+	}
+}
+
+/*
+即将把 inode 数组中的扇区 lba 写入日志，把组内已初始化部分到 lba 之间的扇区清零，
+并在超级块中扩大该组已初始化的范围，与这次写入在同一个事务中
+*/
+static void inode_table_extend(partition* part, uint32_t lba) {
+	uint32_t sec_in_group;
+	group_desc* gd = inode_table_group(part->sb, lba, &sec_in_group);
+	if (sec_in_group < gd->inode_table_inited) {
+		return;
+	}
+	// 跳过的扇区不在事务中，直接写盘即可，超级块提交之前它们不会被当作已初始化
+	if (sec_in_group > gd->inode_table_inited) {
+		uint8_t* zero_buf = sys_malloc(SECTOR_SIZE);
+		ASSERT(zero_buf != NULL);
+		memset(zero_buf, 0, SECTOR_SIZE);
+		uint32_t sec = lba - (sec_in_group - gd->inode_table_inited);
+		for (; sec < lba; sec++) {
+			ide_write(part->my_disk, sec, zero_buf, 1);
+		}
+		sys_free(zero_buf);
+	}
+	gd->inode_table_inited = sec_in_group + 1;
+	super_block_sync(part, FS_DIRTY);
+}
+
+/* 版本 0 的磁盘 inode，直接照搬了当时内存中的 inode，92 字节，可能跨扇区 */
+typedef struct {
+	uint32_t i_no;
+	uint32_t i_size;
+	uint32_t i_open_cnts;
+	uint8_t write_deny;
+	uint8_t i_flags;
+	uint16_t i_extent_cnt;
+	uint16_t i_extent_depth;
+	union {
+		extent i_extents[INODE_EXTENTS];
+		uint8_t i_inline[sizeof(extent) * INODE_EXTENTS];
+	};
+	// 对齐空位和链表、分区指针等只在内存中有意义的字段
+	uint8_t mem[26];
+} __attribute__((packed)) inode_v0;
+
+/*
+把版本 0 的 inode 数组原地转换为版本 1 的格式，挂载时在使用 inode 数组之前调用
+新 inode 比旧的小，第 s 个新扇区只依赖从它自己开始往后的旧数据，按扇区从前往后转换不会覆盖还没读出的部分
+转换过程不经过日志，中途断电需要重新格式化
+*/
+void inode_table_migrate(partition* part) {
+	struct super_block* sb = part->sb;
+	ASSERT(sizeof(inode_v0) == 92);
+	uint32_t old_inited = sb->inode_table_inited;
+	// 旧的已初始化扇区中完整包含的 inode 数，之后的 inode 都是全 0
+	uint32_t inode_cnt = old_inited * SECTOR_SIZE / sizeof(inode_v0);
+	if (inode_cnt > sb->inode_cnt) {
+		inode_cnt = sb->inode_cnt;
+	}
+	uint32_t new_sects = DIV_ROUND_UP(inode_cnt, INODES_PER_SECTOR);
+	printk("%s: converting %d inodes to the compact layout\n", part->name, inode_cnt);
+
+	// 一个新扇区中的旧 inode 最多跨 3 个旧扇区
+	uint8_t* old_buf = sys_malloc(SECTOR_SIZE * 4);
+	uint8_t* new_buf = sys_malloc(SECTOR_SIZE);
+	ASSERT(old_buf != NULL && new_buf != NULL);
+	uint32_t sec_idx = 0;
+	for (; sec_idx < new_sects; sec_idx++) {
+		uint32_t first_no = sec_idx * INODES_PER_SECTOR;
+		uint32_t old_off = first_no * sizeof(inode_v0);
+		uint32_t old_sec = old_off / SECTOR_SIZE;
+		uint32_t old_end = DIV_ROUND_UP(old_off + INODES_PER_SECTOR * sizeof(inode_v0), SECTOR_SIZE);
+		if (old_end > old_inited) {
+			old_end = old_inited;
+		}
+		memset(old_buf, 0, SECTOR_SIZE * 4);
+		ide_read(part->my_disk, sb->inode_table_lba + old_sec, old_buf, old_end - old_sec);
+
+		memset(new_buf, 0, SECTOR_SIZE);
+		uint32_t idx = 0;
+		for (; idx < INODES_PER_SECTOR && first_no + idx < inode_cnt; idx++) {
+			inode_v0* old = (inode_v0*)(old_buf + old_off % SECTOR_SIZE) + idx;
+			disk_inode* d_inode = (disk_inode*)new_buf + idx;
+			d_inode->i_size = old->i_size;
+			d_inode->i_flags = old->i_flags;
+			d_inode->i_extent_depth = old->i_extent_depth;
+			d_inode->i_extent_cnt = old->i_extent_cnt;
+			memcpy(d_inode->i_inline, old->i_inline, sizeof(old->i_inline));
+		}
+		ide_write(part->my_disk, sb->inode_table_lba + sec_idx, new_buf, 1);
 	}
-	inode_pos->sec_lba = inode_table_lba + off_sec;
-	inode_pos->off_size = off_size_in_sec;
+	sys_free(old_buf);
+	sys_free(new_buf);
+
+	// 至少保留根目录 inode 所在的扇区
+	sb->inode_table_inited = new_sects > 0 ? new_sects : 1;
+	sb->version = 1;
 }
 
 /* 将 inode 写入到分区 part */
 void inode_sync(partition* part, inode* in, void* io_buf) {
-	uint8_t inode_no = in->i_no;
+	// inode 引用的块必须在同一个或更早的事务中被块位图记为已用，否则崩溃后这些块可能被重复分配
+	bitmap_flush(part);
+
+	uint32_t inode_no = in->i_no;
 	inode_position inode_pos;
 	inode_locate(part, inode_no, &inode_pos);
 	ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
 
-	// 用于清零 inode_tag 和 i_open_cnts
-	inode pure_inode;
-	memcpy(&pure_inode, in, sizeof(inode));
-	pure_inode.i_open_cnts = 0;
-	pure_inode.write_deny = 0;
-	pure_inode.inode_tag.prev = pure_inode.inode_tag.next = NULL;
+	// 只有磁盘 inode 中的字段落盘
+	disk_inode d_inode;
+	d_inode.i_size = in->i_size;
+	d_inode.i_flags = in->i_flags;
+	d_inode.i_extent_depth = in->i_extent_depth;
+	d_inode.i_extent_cnt = in->i_extent_cnt;
+	memcpy(d_inode.i_inline, in->i_inline, INODE_INLINE_SIZE);
 
 	uint8_t* inode_buf = (uint8_t*)io_buf;
-	if (inode_pos.two_sec) {
-		// 如果跨了两个扇区，就同时操作两个扇区
-		ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-		// 更新这两个扇区中当前 inode 部分的数据
-		memcpy(inode_buf + inode_pos.off_size, &pure_inode, sizeof(inode));
-		// 写回更新后的扇区
-		ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-	} else {
-		ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-		memcpy(inode_buf + inode_pos.off_size, &pure_inode, sizeof(inode));
-		ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+	inode_table_read(part, inode_pos.sec_lba, inode_buf);
+	// 更新扇区中当前 inode 部分的数据，再写回更新后的扇区
+	memcpy(inode_buf + inode_pos.off_size, &d_inode, sizeof(disk_inode));
+	inode_table_extend(part, inode_pos.sec_lba);
+	journal_write(part, inode_pos.sec_lba, inode_buf, 1);
+}
+
+/* 初始化分区 part 的 inode 缓存 */
+void inode_cache_init(partition* part) {
+	inode_cache* icache = part->icache = sys_malloc(sizeof(inode_cache));
+	ASSERT(icache != NULL);
+	uint32_t idx = 0;
+	while (idx < INODE_HASH_BUCKETS) {
+		list_init(&icache->buckets[idx]);
+		lock_init(&icache->bucket_locks[idx]);
+		idx++;
+	}
+	list_init(&icache->lru);
+	icache->lru_cnt = 0;
+}
+
+/* 在桶中查找编号为 inode_no 的 inode，调用者需关中断 */
+static inode* inode_cache_find(struct list* bucket, uint32_t inode_no) {
+	struct list_elem* elem = bucket->head.next;
+	while (elem != &bucket->tail) {
+		inode* found = elem2entry(inode, inode_tag, elem);
+		if (found->i_no == inode_no) {
+			return found;
+		}
+		elem = elem->next;
 	}
+	return NULL;
+}
+
+/*
+在内核空间中为 inode 分配内存，失败返回 NULL
+inode 缓存被所有任务和写回线程共享，关闭后仍然留在缓存中，不能放在某个进程的用户堆里
+*/
+inode* inode_alloc(void) {
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	inode* in = sys_malloc(sizeof(inode));
+	cur->pgdir = cur_pagedir_bak;
+	return in;
+}
+
+/* 释放 inode_alloc 分配的 inode */
+void inode_free(inode* in) {
+	// TODO: 同理，为什么要修改下面的内容，按理说不需要修改
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	sys_free(in);
+	cur->pgdir = cur_pagedir_bak;
 }
 
-/* 让 list_traversal 按 inode_no 进行查找 inode 的动作函数 */
-static bool find_inode_by_inode_no(struct list_elem* elem, int inode_no) {
-	return (elem2entry(inode, inode_tag, elem))->i_no == inode_no;
+/* 把新创建并已打开的 inode 加入分区 part 的 inode 缓存 */
+void inode_cache_add(partition* part, inode* in) {
+	inode_cache* icache = part->icache;
+	in->i_part = part;
+	in->i_open_cnts = 1;
+	intr_status old_status = intr_disable();
+	list_push(&icache->buckets[in->i_no % INODE_HASH_BUCKETS], &in->inode_tag);
+	intr_set_status(old_status);
 }
+
 /* 根据 inode 结点号返回对应的 inode */
 inode* inode_open(partition* part, uint32_t inode_no) {
-	inode* inode_found = NULL;
-	// 先试图在 inode 缓存中查找
-	struct list_elem* elem = list_traversal(
-		&part->open_inodes,
-		find_inode_by_inode_no,
-		inode_no
-	);
-	if (elem != NULL) {
-		inode_found = elem2entry(inode, inode_tag, elem);
-		inode_found->i_open_cnts++;
+	inode_cache* icache = part->icache;
+	uint32_t bucket_idx = inode_no % INODE_HASH_BUCKETS;
+	struct list* bucket = &icache->buckets[bucket_idx];
+	lock_acquire(&icache->bucket_locks[bucket_idx]);
+
+	// 先试图在 inode 缓存中查找，最近关闭的 inode 也还在桶中
+	intr_status old_status = intr_disable();
+	inode* inode_found = inode_cache_find(bucket, inode_no);
+	if (inode_found != NULL && inode_found->i_open_cnts++ == 0) {
+		list_remove(&inode_found->lru_tag);
+		icache->lru_cnt--;
+	}
+	intr_set_status(old_status);
+	if (inode_found != NULL) {
+		lock_release(&icache->bucket_locks[bucket_idx]);
 		return inode_found;
 	}
 
-	// 找不到就只能读盘
+	// 找不到就只能读盘，持有桶锁保证同一个 inode 不会被读入两次
 	inode_position inode_pos;
 	inode_locate(part, inode_no, &inode_pos);
 
 	// 为了让 inode 缓存被所有任务共享，需要将其置于内核空间
-	// TODO: 但是文件操作需要走系统调用，所以这个函数不是本来就被内核调用吗
-	task_struct* cur = running_thread();
-	uint32_t* cur_pagedir_bak = cur->pgdir;
-	cur->pgdir = NULL;
-	inode_found = sys_malloc(sizeof(inode));
-	cur->pgdir = cur_pagedir_bak;
-
-	uint8_t* inode_buf;
-	if (inode_pos.two_sec) {
-		inode_buf = sys_malloc(SECTOR_SIZE * 2);
-		ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-	} else {
-		inode_buf = sys_malloc(SECTOR_SIZE);
-		ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-	}
-	memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(inode));
+	inode_found = inode_alloc();
 
-	// 将该 inode 放在队首方便检测
-	list_push(&part->open_inodes, &inode_found->inode_tag);
-	inode_found->i_open_cnts = 1;
+	uint8_t* inode_buf = sys_malloc(SECTOR_SIZE);
+	inode_table_read(part, inode_pos.sec_lba, inode_buf);
+	disk_inode* d_inode = (disk_inode*)(inode_buf + inode_pos.off_size);
+	inode_init(inode_no, inode_found);
+	inode_found->i_size = d_inode->i_size;
+	inode_found->i_flags = d_inode->i_flags;
+	inode_found->i_extent_depth = d_inode->i_extent_depth;
+	inode_found->i_extent_cnt = d_inode->i_extent_cnt;
+	memcpy(inode_found->i_inline, d_inode->i_inline, INODE_INLINE_SIZE);
 	sys_free(inode_buf);
 
+	inode_cache_add(part, inode_found);
+	lock_release(&icache->bucket_locks[bucket_idx]);
 	return inode_found;
 }
 
-/* 关闭 inode 或者减少 inode 的打开次数 */
-void inode_close(inode* inode) {
+/*
+关闭 inode 或者减少 inode 的打开次数
+打开次数降为 0 时 inode 仍然留在缓存中并加入 LRU 链表，超出 INODE_LRU_MAX 时释放最久未用的
+*/
+void inode_close(inode* in) {
+	inode_cache* icache = in->i_part->icache;
+	// 最后一次关闭时写回延迟分配的数据，并归还预分配窗口
+	if (in->i_open_cnts == 1 && in->i_delay != NULL) {
+		delay_release(in->i_part, in, 0);
+	}
+	inode* victim = NULL;
 	intr_status old_status = intr_disable();
-	if (--inode->i_open_cnts == 0) {
-		list_remove(&inode->inode_tag);
-		// TODO: 同理，为什么要修改下面的内容，按理说不需要修改
-		task_struct* cur = running_thread();
-		uint32_t* cur_pagedir_bak = cur->pgdir;
-		cur->pgdir = NULL;
-		sys_free(inode);
-		cur->pgdir = cur_pagedir_bak;
+	if (--in->i_open_cnts == 0) {
+		list_push(&icache->lru, &in->lru_tag);
+		if (++icache->lru_cnt > INODE_LRU_MAX) {
+			victim = elem2entry(inode, lru_tag, icache->lru.tail.prev);
+			list_remove(&victim->lru_tag);
+			list_remove(&victim->inode_tag);
+			icache->lru_cnt--;
+		}
 	}
 	intr_set_status(old_status);
+	// 摘下后别的任务已经找不到它，开中断后再释放内存
+	if (victim != NULL) {
+		inode_free(victim);
+	}
+}
+
+/* 判断分区 part 上编号为 inode_no 的 inode 是否正被打开，文件关闭后 mmap 建立的映射仍持有 inode */
+bool inode_is_open(partition* part, uint32_t inode_no) {
+	struct list* bucket = &part->icache->buckets[inode_no % INODE_HASH_BUCKETS];
+	intr_status old_status = intr_disable();
+	inode* inode_found = inode_cache_find(bucket, inode_no);
+	bool ret = inode_found != NULL && inode_found->i_open_cnts > 0;
+	intr_set_status(old_status);
+	return ret;
 }
 
 /* 初始化一个 inode */
@@ -140,53 +318,79 @@ void inode_init(uint32_t inode_no, inode* new_inode) {
 	new_inode->i_no = inode_no;
 	new_inode->i_size = 0;
 	new_inode->i_open_cnts = 0;
-	new_inode->write_deny = 0;
+	new_inode->i_flags = 0;
+	new_inode->i_delay = NULL;
+	rwlock_init(&new_inode->i_rwlock);
+	list_init(&new_inode->i_ranges);
+	list_init(&new_inode->i_range_waiters);
 
-	for (int i=0; i<13; i++) {
-		new_inode->i_sectors[i] = 0;
-	}
+	extent_init(new_inode);
 }
 
 /* 回收 inode 的数据块和 inode 本身 */
 void inode_release(partition* part, uint32_t inode_no) {
 	inode* inode_to_del = inode_open(part, inode_no);
 	ASSERT(inode_to_del->i_no == inode_no);
+	page_cache_drop(part, inode_no);
+	dcache_invalidate_dir(part, inode_no);
+
+	// 回收 inode 的数据块及 extent 树块，缓冲中尚未写回的数据直接丢弃
+	delay_release(part, inode_to_del, 1);
+	extent_release(part, inode_to_del);
+
+	inode_bitmap_free(part, inode_no);
 
-/* 回收 inode 的数据块 */
-	uint8_t block_idx = 0, block_cnt = 12;
-	uint32_t block_bitmap_idx;
-	uint32_t all_blocks[140] = {0};
-
-	while (block_idx < 12) {
-		all_blocks[block_idx] = inode_to_del->i_sectors[block_idx];
-		block_idx++;
-	}
-/* 如果一级间接表存在，读入其条目并清理其本身所占的空间 */
-	if (inode_to_del->i_sectors[12] != 0) {
-		ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks+12, 1);
-		block_cnt = 140;
-
-		// 回收一级间接块表占用的扇区
-		block_bitmap_idx =\
-		inode_to_del->i_sectors[12] - part->sb->data_start_lba;
-		ASSERT(block_bitmap_idx > 0);
-		bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-		bitmap_sync(part, block_bitmap_idx, BLOCK_BITMAP);
-	}
-/* 逐个回收扇区们 */
-	block_idx = 0;
-	while (block_idx < block_cnt) {
-		if (all_blocks[block_idx] != 0) {
-			block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-			ASSERT(block_bitmap_idx > 0);
-			bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
-			bitmap_sync(part, block_bitmap_idx, BLOCK_BITMAP);
+	// 已删除的 inode 不能留在缓存中，否则同一编号被重新分配后会读到旧内容
+	intr_status old_status = intr_disable();
+	bool last = --inode_to_del->i_open_cnts == 0;
+	if (last) {
+		list_remove(&inode_to_del->inode_tag);
+	}
+	intr_set_status(old_status);
+	if (last) {
+		inode_free(inode_to_del);
+	}
+}
+
+/* 判断范围 range 是否与 inode in 中已经加锁的范围冲突，调用者需关中断 */
+static bool range_conflict(inode* in, range_lock* range) {
+	struct list_elem* elem = in->i_ranges.head.next;
+	while (elem != &in->i_ranges.tail) {
+		range_lock* held = elem2entry(range_lock, tag, elem);
+		if (
+			held->start < range->end && range->start < held->end
+			&& (held->exclusive || range->exclusive)
+		) {
+			return 1;
 		}
-		block_idx++;
+		elem = elem->next;
 	}
+	return 0;
+}
 
-	bitmap_set(&part->inode_bitmap, inode_no, 0);
-	bitmap_sync(part, inode_no, INODE_BITMAP);
+/*
+锁住文件 in 中从 start 开始的 cnt 个字节，与已经加锁的范围冲突时阻塞
+读写都是整个扇区地读改写，同一扇区中不相交的两段也会互相覆盖，所以范围向外扩展到扇区边界
+range 由调用者提供，在 inode_range_unlock 之前一直有效
+*/
+void inode_range_lock(inode* in, range_lock* range, uint32_t start, uint32_t cnt, bool exclusive) {
+	range->start = start / BLOCK_SIZE * BLOCK_SIZE;
+	// 超出 32 位时一直锁到最大的偏移量
+	uint32_t end = start + cnt < start ? 0xffffffff : start + cnt;
+	range->end = end > 0xffffffff - BLOCK_SIZE ? 0xffffffff : DIV_ROUND_UP(end, BLOCK_SIZE) * BLOCK_SIZE;
+	range->exclusive = exclusive;
+	intr_status old_status = intr_disable();
+	while (range_conflict(in, range)) {
+		wait_queue_block(&in->i_range_waiters);
+	}
+	list_append(&in->i_ranges, &range->tag);
+	intr_set_status(old_status);
+}
 
-	inode_close(inode_to_del);
-}
\ No newline at end of file
+/* 解锁 inode_range_lock 锁住的范围，并唤醒等待的任务重新检查 */
+void inode_range_unlock(inode* in, range_lock* range) {
+	intr_status old_status = intr_disable();
+	list_remove(&range->tag);
+	wait_queue_wake_all(&in->i_range_waiters);
+	intr_set_status(old_status);
+}
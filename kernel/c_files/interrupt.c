@@ -78,12 +78,20 @@ static void pic_init(void) {
 
 	// 打开主片的 IR0，当前仅支持时钟中断，键盘中断以及从片中断
 	outb(PIC_M_DATA, 0xf8);
-	// 打开从片上的 IRQ14，用来接收来自硬盘控制器的中断
-	outb(PIC_S_DATA, 0xbf);
+	// 打开从片上的 IRQ14 和 IRQ15，用来接收来自两个 ide 通道上硬盘控制器的中断
+	outb(PIC_S_DATA, 0x3f);
 
 	put_str("  pic_init done\n");
 }
 
+/* 在 8259A 上打开 irq 号中断，pci 设备的中断号由 BIOS 分配，只能在运行时打开 */
+void pic_enable_irq(uint8_t irq) {
+	if (irq < 8) {
+		outb(PIC_M_DATA, inb(PIC_M_DATA) & ~(1 << irq));
+	} else {
+		outb(PIC_S_DATA, inb(PIC_S_DATA) & ~(1 << (irq - 8)));
+	}
+}
 
 /**
  * 中断描述符结构体
@@ -112,7 +120,7 @@ extern void set_cursor(uint32_t pos);
 /**
  * 通用的中断处理函数，一般用于异常处理
  */
-static void general_intr_handler(uint8_t vec_nr) {
+void general_intr_handler(uint8_t vec_nr) {
 	// TODO:IRQ7 和 IRQ15 会产生伪中断，不用处理（？）
 	if (vec_nr == 0x27 || vec_nr == 0x2f) {
 		return;
@@ -0,0 +1,252 @@
+#include "journal.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "thread.h"
+
+/* 计算 cnt 个扇区内容的校验和 */
+static uint32_t journal_checksum(uint8_t* data, uint32_t cnt) {
+	uint32_t* word = (uint32_t*)data;
+	uint32_t words = cnt * SECTOR_SIZE / sizeof(uint32_t);
+	uint32_t sum = 0;
+	while (words-- > 0) {
+		// 循环左移后再加，使内容相同但位置不同的扇区得到不同的结果
+		sum = ((sum << 1) | (sum >> 31)) + *word++;
+	}
+	return sum;
+}
+
+/* 返回扇区 lba 在运行中的事务里的下标，不在事务中返回 -1，调用者需持有日志锁或关闭中断 */
+static int32_t journal_find(journal* jnl, uint32_t lba) {
+	uint32_t idx = 0;
+	while (idx < jnl->cnt) {
+		if (jnl->lbas[idx] == lba) {
+			return idx;
+		}
+		idx++;
+	}
+	return -1;
+}
+
+/* 返回运行中的事务中第 idx 个扇区的内容 */
+static uint8_t* journal_sector(journal* jnl, uint32_t idx) {
+	return jnl->buf + (idx + 1) * SECTOR_SIZE;
+}
+
+/* 重放日志区中最后一个完整的事务，并据此确定下一个事务的序号 */
+static void journal_replay(partition* part) {
+	journal* jnl = part->jnl;
+	disk* hd = part->my_disk;
+	uint32_t journal_lba = part->sb->journal_lba;
+	journal_header* desc = (journal_header*)jnl->buf;
+	journal_header* commit = (journal_header*)journal_sector(jnl, JOURNAL_TX_SECTS);
+
+	jnl->seq = 1;
+	ide_read(hd, journal_lba, desc, 1);
+	if (desc->magic != JOURNAL_DESC_MAGIC || desc->cnt == 0 || desc->cnt > JOURNAL_TX_SECTS) {
+		return;
+	}
+	jnl->seq = desc->seq + 1;
+
+	ide_read(hd, journal_lba + 1, journal_sector(jnl, 0), desc->cnt);
+	ide_read(hd, journal_lba + 1 + desc->cnt, commit, 1);
+	if (
+		commit->magic != JOURNAL_COMMIT_MAGIC || commit->seq != desc->seq
+		|| commit->cnt != desc->cnt
+		|| commit->checksum != journal_checksum(journal_sector(jnl, 0), desc->cnt)
+	) {
+		// 事务没有提交完，其中的修改都还没有写回原位置，丢弃即可
+		printk("%s: discard incomplete journal transaction %d\n", part->name, desc->seq);
+		return;
+	}
+
+	/*
+	最后一个提交的事务可能已经写回过了，但再写一次结果相同，
+	因为之后的修改都在更新的事务中，而更新的事务没有提交就不会写回
+	*/
+	uint32_t idx = 0;
+	while (idx < desc->cnt) {
+		ide_write(hd, desc->lbas[idx], journal_sector(jnl, idx), 1);
+		idx++;
+	}
+	// 新的事务会覆盖日志区，重放的内容要先落盘
+	disk_flush(hd);
+	printk("%s: replay journal transaction %d, %d sectors\n", part->name, desc->seq, desc->cnt);
+}
+
+/* 为已经读入超级块的分区 part 建立日志，并重放上次留下的事务 */
+void journal_init(partition* part) {
+	ASSERT(JOURNAL_TX_SECTS + 2 <= JOURNAL_SECTS);
+	ASSERT(JOURNAL_TX_SECTS <= sizeof(((journal_header*)0)->lbas) / sizeof(uint32_t));
+	journal* jnl = part->jnl = sys_malloc(sizeof(journal));
+	ASSERT(jnl != NULL);
+	// 描述块、事务中的扇区和提交块
+	jnl->buf = sys_malloc((JOURNAL_TX_SECTS + 2) * SECTOR_SIZE);
+	ASSERT(jnl->buf != NULL);
+	lock_init(&jnl->lock);
+	jnl->cnt = 0;
+	journal_replay(part);
+}
+
+/*
+开始一次完整的元数据操作，操作结束前事务不会被提交
+嵌套的操作属于外层的操作，只有最外层的操作开始前才能提交，此时为它预留 JOURNAL_OP_SECTS 个扇区
+*/
+void journal_begin(partition* part) {
+	journal* jnl = part->jnl;
+	bool outermost = jnl->lock.holder != running_thread();
+	lock_acquire(&jnl->lock);
+	if (outermost && jnl->cnt + JOURNAL_OP_SECTS > JOURNAL_TX_SECTS) {
+		journal_commit(part);
+	}
+}
+
+/* 结束 journal_begin 开始的元数据操作 */
+void journal_end(partition* part) {
+	lock_release(&part->jnl->lock);
+}
+
+/*
+读取元数据扇区，运行中的事务里有更新的内容时以事务中的为准
+读者不持有日志锁，否则持有 inode 缓存桶锁的读者会与持有日志锁、正在打开 inode 的操作互相等待；
+事务中的内容只在关中断时修改，提交完成时序号会改变，读的过程中遇到提交就重读
+*/
+void journal_read(partition* part, uint32_t lba, void* buf, uint32_t sec_cnt) {
+	journal* jnl = part->jnl;
+	uint8_t* dst = buf;
+	uint32_t idx;
+	int32_t tx_idx;
+
+	while (1) {
+		uint32_t seq = jnl->seq;
+		// 只有事务中没有全部的扇区时才需要读盘
+		intr_status old_status = intr_disable();
+		idx = 0;
+		while (idx < sec_cnt && journal_find(jnl, lba + idx) != -1) {
+			idx++;
+		}
+		intr_set_status(old_status);
+		if (idx < sec_cnt) {
+			ide_read(part->my_disk, lba, buf, sec_cnt);
+		}
+
+		old_status = intr_disable();
+		if (jnl->seq != seq) {
+			intr_set_status(old_status);
+			continue;
+		}
+		for (idx = 0; idx < sec_cnt; idx++) {
+			if ((tx_idx = journal_find(jnl, lba + idx)) != -1) {
+				memcpy(dst + idx * SECTOR_SIZE, journal_sector(jnl, tx_idx), SECTOR_SIZE);
+			}
+		}
+		intr_set_status(old_status);
+		return;
+	}
+}
+
+/* 把元数据扇区的新内容记入运行中的事务，同一扇区多次修改只保留最新的内容 */
+void journal_write(partition* part, uint32_t lba, const void* buf, uint32_t sec_cnt) {
+	journal* jnl = part->jnl;
+	const uint8_t* src = buf;
+	lock_acquire(&jnl->lock);
+
+	uint32_t idx = 0;
+	for (; idx < sec_cnt; idx++) {
+		// 操作超出了预留的空间，事务已满时只能提前提交，操作会被分到两个事务中
+		if (jnl->cnt == JOURNAL_TX_SECTS && journal_find(jnl, lba + idx) == -1) {
+			printk("%s: metadata operation exceeds JOURNAL_OP_SECTS, commit early\n", part->name);
+			journal_commit(part);
+		}
+		intr_status old_status = intr_disable();
+		int32_t tx_idx = journal_find(jnl, lba + idx);
+		if (tx_idx == -1) {
+			tx_idx = jnl->cnt++;
+			jnl->lbas[tx_idx] = lba + idx;
+		}
+		memcpy(journal_sector(jnl, tx_idx), src + idx * SECTOR_SIZE, SECTOR_SIZE);
+		intr_set_status(old_status);
+	}
+	lock_release(&jnl->lock);
+}
+
+/*
+从运行中的事务里去掉从 lba 开始的 sec_cnt 个扇区，在回收块时调用
+否则这些块被重新分配为数据块并直接写盘后，提交时又会被旧的元数据覆盖
+*/
+void journal_forget(partition* part, uint32_t lba, uint32_t sec_cnt) {
+	journal* jnl = part->jnl;
+	lock_acquire(&jnl->lock);
+	intr_status old_status = intr_disable();
+	uint32_t idx = 0;
+	while (idx < jnl->cnt) {
+		if (jnl->lbas[idx] >= lba && jnl->lbas[idx] - lba < sec_cnt) {
+			// 用最后一项填补空位
+			jnl->cnt--;
+			if (idx != jnl->cnt) {
+				jnl->lbas[idx] = jnl->lbas[jnl->cnt];
+				memcpy(journal_sector(jnl, idx), journal_sector(jnl, jnl->cnt), SECTOR_SIZE);
+			}
+			continue;
+		}
+		idx++;
+	}
+	intr_set_status(old_status);
+	lock_release(&jnl->lock);
+}
+
+/*
+提交运行中的事务：描述块和各扇区一次写入日志区，再写提交块，
+之后把各扇区写回原位置，地址相邻的扇区合并为一次写
+每一步之前都让硬盘把上一步落盘，否则写缓存可能先写提交块或原位置，崩溃后会重放不完整的事务，
+写回原位置后也要落盘，下一个事务才能覆盖日志区
+*/
+void journal_commit(partition* part) {
+	journal* jnl = part->jnl;
+	disk* hd = part->my_disk;
+	uint32_t journal_lba = part->sb->journal_lba;
+	lock_acquire(&jnl->lock);
+	if (jnl->cnt == 0) {
+		lock_release(&jnl->lock);
+		return;
+	}
+
+	journal_header* desc = (journal_header*)jnl->buf;
+	memset(desc, 0, SECTOR_SIZE);
+	desc->magic = JOURNAL_DESC_MAGIC;
+	desc->seq = jnl->seq;
+	desc->cnt = jnl->cnt;
+	desc->checksum = journal_checksum(journal_sector(jnl, 0), jnl->cnt);
+	memcpy(desc->lbas, jnl->lbas, jnl->cnt * sizeof(uint32_t));
+	ide_write(hd, journal_lba, jnl->buf, jnl->cnt + 1);
+	disk_flush(hd);
+
+	journal_header* commit = (journal_header*)journal_sector(jnl, JOURNAL_TX_SECTS);
+	memset(commit, 0, SECTOR_SIZE);
+	commit->magic = JOURNAL_COMMIT_MAGIC;
+	commit->seq = desc->seq;
+	commit->cnt = desc->cnt;
+	commit->checksum = desc->checksum;
+	ide_write(hd, journal_lba + 1 + jnl->cnt, commit, 1);
+	disk_flush(hd);
+
+	uint32_t idx = 0, run;
+	while (idx < jnl->cnt) {
+		run = 1;
+		while (idx + run < jnl->cnt && jnl->lbas[idx + run] == jnl->lbas[idx] + run) {
+			run++;
+		}
+		ide_write(hd, jnl->lbas[idx], journal_sector(jnl, idx), run);
+		idx += run;
+	}
+	disk_flush(hd);
+
+	// 各扇区都已写回原位置，清空事务，并让正在读的人重读
+	intr_status old_status = intr_disable();
+	jnl->cnt = 0;
+	jnl->seq++;
+	intr_set_status(old_status);
+	lock_release(&jnl->lock);
+}
@@ -126,7 +126,7 @@ void mem_init(void) {
  * 在 pf 表示的虚拟内存池中申请 pg_cnt 个虚拟页
  * 成功则返回虚拟页的起始地址，失败则返回 NULL
  */
-static void* vaddr_get(pool_flags pf, uint32_t pg_cnt) {
+void* vaddr_get(pool_flags pf, uint32_t pg_cnt) {
 	int vaddr_start, bit_idx_start;
 	uint32_t cnt = 0;
 	if (pf == PF_KERNEL) {
@@ -268,6 +268,30 @@ void* get_kernel_pages(uint32_t pg_cnt) {
 	return vaddr;
 }
 
+/* 从内核物理内存池中申请 pg_cnt 个物理上连续的页，供设备做 DMA 用，失败返回 NULL */
+void* get_kernel_pages_contiguous(uint32_t pg_cnt) {
+	lock_acquire(&kernel_pool.lock);
+	int bit_idx = bitmap_scan(&kernel_pool.pool_bitmap, pg_cnt);
+	void* vaddr_start = bit_idx == -1 ? NULL : vaddr_get(PF_KERNEL, pg_cnt);
+	if (vaddr_start == NULL) {
+		lock_release(&kernel_pool.lock);
+		return NULL;
+	}
+
+	uint32_t vaddr = (uint32_t)vaddr_start, cnt = 0;
+	uint32_t page_phyaddr = kernel_pool.phy_addr_start + bit_idx * PG_SIZE;
+	while (cnt < pg_cnt) {
+		bitmap_set(&kernel_pool.pool_bitmap, bit_idx + cnt, 1);
+		page_table_add((void*)vaddr, (void*)page_phyaddr);
+		vaddr += PG_SIZE;
+		page_phyaddr += PG_SIZE;
+		cnt++;
+	}
+	lock_release(&kernel_pool.lock);
+	memset(vaddr_start, 0, pg_cnt * PG_SIZE);
+	return vaddr_start;
+}
+
 /* 从用户空间中申请 4K 的内存 */
 void* get_user_pages(uint32_t pg_cnt) {
 	lock_acquire(&user_pool.lock);
@@ -279,12 +303,65 @@ void* get_user_pages(uint32_t pg_cnt) {
 	return vaddr;
 }
 
+/* 把物理地址 phy_addr 起始的 size 字节设备内存映射到内核空间，返回对应的虚拟地址 */
+void* map_mmio(uint32_t phy_addr, uint32_t size) {
+	uint32_t page_phyaddr = phy_addr & 0xfffff000;
+	uint32_t pg_cnt = DIV_ROUND_UP(phy_addr + size - page_phyaddr, PG_SIZE);
+
+	lock_acquire(&kernel_pool.lock);
+	void* vaddr_start = vaddr_get(PF_KERNEL, pg_cnt);
+	if (vaddr_start == NULL) {
+		lock_release(&kernel_pool.lock);
+		return NULL;
+	}
+
+	// 设备内存不属于任何物理内存池，直接建立映射即可
+	uint32_t vaddr = (uint32_t)vaddr_start;
+	while (pg_cnt-- > 0) {
+		page_table_add((void*)vaddr, (void*)page_phyaddr);
+		// 设备寄存器不能被缓存
+		*pte_ptr(vaddr) |= PG_PCD | PG_PWT;
+		vaddr += PG_SIZE;
+		page_phyaddr += PG_SIZE;
+	}
+	lock_release(&kernel_pool.lock);
+	return (void*)((uint32_t)vaddr_start + (phy_addr & 0x00000fff));
+}
+
 /* 得到虚拟地址对应的物理地址 */
 uint32_t addr_v2p(uint32_t vaddr) {
 	uint32_t* pte = pte_ptr(vaddr);
 	return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
 }
 
+/* 判断虚拟地址 vaddr 所在的页是否已经映射到物理页 */
+bool page_present(uint32_t vaddr) {
+	// 页表不存在时不能通过 pte_ptr 访问 pte
+	return (*pde_ptr(vaddr) & PG_P_1) && (*pte_ptr(vaddr) & PG_P_1);
+}
+
+/*
+保证 vaddr 开始的 bytes 字节所在的页都已映射，设备按物理地址直接读写缓冲区之前调用
+mmap 建立的用户页在第一次访问时才由缺页异常映射，这里逐页访问一次；
+内核不会换出物理页，页映射之后直到本次系统调用返回都不会改变
+*/
+void page_prefault(const void* vaddr, uint32_t bytes) {
+	if (bytes == 0) {
+		return;
+	}
+	uint32_t page = (uint32_t)vaddr & 0xfffff000;
+	uint32_t last = ((uint32_t)vaddr + bytes - 1) & 0xfffff000;
+	while (1) {
+		if (!page_present(page)) {
+			(void)*(volatile uint8_t*)page;
+		}
+		if (page == last) {
+			break;
+		}
+		page += PG_SIZE;
+	}
+}
+
 /* 将地址 vaddr 与 pf 池中的物理地址关联，仅支持一页空间分配 */
 void* get_a_page(pool_flags pf, uint32_t vaddr) {
 	pool* mem_pool = pf & PF_KERNEL ? &kernel_pool : &user_pool;
@@ -465,7 +542,7 @@ static void page_table_pte_remove(uint32_t vaddr) {
 }
 
 /* 在虚拟地址池中释放以 _vaddr 起始的连续 pg_cnt 个虚拟页地址 */
-static void vaddr_remove(pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
+void vaddr_remove(pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
 	uint32_t bit_idx_start = 0, vaddr = (uint32_t)_vaddr, cnt = 0;
 
 	if (pf == PF_KERNEL) {
@@ -490,6 +567,34 @@ static void vaddr_remove(pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
 	}
 }
 
+/*
+把物理页 page_phyaddr 映射到当前页表中的 vaddr，不占用任何内存池，用于映射页缓存等不属于该进程的页
+writable 为 false 时映射为只读
+*/
+void page_map(uint32_t vaddr, uint32_t page_phyaddr, bool writable) {
+	// 缺少页表时要从内核内存池中分配
+	lock_acquire(&kernel_pool.lock);
+	page_table_add((void*)vaddr, (void*)page_phyaddr);
+	if (!writable) {
+		*pte_ptr(vaddr) &= ~PG_RW_W;
+	}
+	lock_release(&kernel_pool.lock);
+}
+
+/* 去掉 vaddr 的映射并返回原来的 pte，vaddr 没有映射时返回 0，不回收物理页 */
+uint32_t page_unmap(uint32_t vaddr) {
+	// 页表不存在时不能通过 pte_ptr 访问 pte
+	if (!(*pde_ptr(vaddr) & PG_P_1)) {
+		return 0;
+	}
+	uint32_t pte = *pte_ptr(vaddr);
+	if (!(pte & PG_P_1)) {
+		return 0;
+	}
+	page_table_pte_remove(vaddr);
+	return pte;
+}
+
 /* 释放以虚拟地址 vaddr 为起始的 cnt 个物理页框 */
 void mfree_page(pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
 	uint32_t vaddr = (int32_t)_vaddr, page_cnt = 0;
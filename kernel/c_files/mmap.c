@@ -0,0 +1,219 @@
+#include "mmap.h"
+#include "page_cache.h"
+#include "journal.h"
+#include "file.h"
+#include "fs.h"
+#include "thread.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "global.h"
+#include "string.h"
+#include "print.h"
+#include "stdio.h"
+#include "debug.h"
+
+/* 在内核空间中分配一个 vm_area，这样它不会随用户堆一起被复制或释放 */
+static vm_area* vma_alloc(void) {
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	vm_area* vma = sys_malloc(sizeof(vm_area));
+	cur->pgdir = cur_pagedir_bak;
+	return vma;
+}
+
+/* 释放 vma_alloc 分配的 vm_area */
+static void vma_free(vm_area* vma) {
+	task_struct* cur = running_thread();
+	uint32_t* cur_pagedir_bak = cur->pgdir;
+	cur->pgdir = NULL;
+	sys_free(vma);
+	cur->pgdir = cur_pagedir_bak;
+}
+
+/* 在当前进程中查找包含 vaddr 的映射区域，找不到返回 NULL */
+static vm_area* vma_find(uint32_t vaddr) {
+	struct list* areas = &running_thread()->vm_areas;
+	struct list_elem* elem = areas->head.next;
+	while (elem != &areas->tail) {
+		vm_area* vma = elem2entry(vm_area, vm_tag, elem);
+		if (vaddr >= vma->vm_start && vaddr - vma->vm_start < vma->vm_pg_cnt * PG_SIZE) {
+			return vma;
+		}
+		elem = elem->next;
+	}
+	return NULL;
+}
+
+/* 为映射区域 vma 中 vaddr 所在的页建立映射，成功返回 1，失败返回 0 */
+static bool vma_fault(vm_area* vma, uint32_t vaddr) {
+	vaddr &= 0xfffff000;
+	uint32_t pg_idx = vma->vm_pg_off + (vaddr - vma->vm_start) / PG_SIZE;
+	uint8_t* kaddr = page_cache_get(vma->vm_inode, pg_idx);
+	if (kaddr == NULL) {
+		return 0;
+	}
+	bool writable = (vma->vm_prot & PROT_WRITE) != 0;
+
+	if (vma->vm_flags & MAP_SHARED) {
+		// 直接映射页缓存中的页，引用一直持有到解除映射
+		page_map(vaddr, addr_v2p((uint32_t)kaddr), writable);
+		return 1;
+	}
+
+	if (get_a_page_without_opvaddrbitmap(PF_USER, vaddr) == NULL) {
+		page_cache_put(vma->vm_inode, pg_idx, 0);
+		return 0;
+	}
+	/*
+	新的 pte 还没有被访问过，不在 TLB 中，可以直接去掉写权限；
+	cr0 的 WP 位没有打开，特权级 0 下仍然可以把内容复制进去
+	*/
+	if (!writable) {
+		*pte_ptr(vaddr) &= ~PG_RW_W;
+	}
+	memcpy((void*)vaddr, kaddr, PG_SIZE);
+	page_cache_put(vma->vm_inode, pg_idx, 0);
+	return 1;
+}
+
+/* 缺页异常处理程序，为映射区域中第一次被访问的页建立映射，其余情况仍按异常处理 */
+static void page_fault_handler(uint32_t vec_nr) {
+	// 参数就是中断入口压入的中断号，它和上方的通用寄存器、错误码一起构成 intr_stack
+	intr_stack* frame = (intr_stack*)&vec_nr;
+	uint32_t vaddr = 0;
+	__asm__ __volatile__ ("movl %%cr2, %0" : "=r"(vaddr));
+
+	// 错误码最低位为 1 表示页存在，是违反权限引起的，不能通过读入页解决
+	if (!(frame->err_code & 1) && running_thread()->pgdir != NULL) {
+		vm_area* vma = vma_find(vaddr);
+		if (vma != NULL && vma_fault(vma, vaddr)) {
+			return;
+		}
+	}
+	general_intr_handler(vec_nr);
+}
+
+/* 初始化页缓存并注册缺页异常处理程序 */
+void mmap_init(void) {
+	put_str("mmap_init start\n");
+	page_cache_init();
+	register_handler(0x0e, page_fault_handler);
+	put_str("mmap_init done\n");
+}
+
+/*
+把文件描述符 args->fd 从 args->offset 开始的 args->length 个字节映射到当前进程的用户空间
+页在第一次访问时才读入，成功返回映射的起始地址，失败返回 NULL
+*/
+void* sys_mmap(mmap_args* args) {
+	task_struct* cur = running_thread();
+	int32_t fd = args->fd;
+	if (cur->pgdir == NULL) {
+		printk("sys_mmap: only user process can mmap\n");
+		return NULL;
+	}
+	if (fd <= stderr_no || (uint32_t)fd >= cur->fd_table_size || cur->fd_table[fd] == -1) {
+		printk("sys_mmap: fd error\n");
+		return NULL;
+	}
+	if (
+		args->length == 0 || args->offset % PG_SIZE != 0
+		|| (args->flags != MAP_SHARED && args->flags != MAP_PRIVATE)
+	) {
+		printk("sys_mmap: invalid length, offset or flags\n");
+		return NULL;
+	}
+
+	file* mm_file = file_get(fd_local2global(fd));
+	// 与 sys_read 相同，这两种方式打开的文件不可读
+	if (mm_file->fd_flag & O_CREAT || mm_file->fd_flag & O_WRONLY) {
+		printk("sys_mmap: not allowed to map file with O_CREAT or O_WRONLY\n");
+		return NULL;
+	}
+	// 可写的共享映射会写回文件
+	if (
+		args->flags == MAP_SHARED && args->prot & PROT_WRITE
+		&& !(mm_file->fd_flag & O_RDWR)
+	) {
+		printk("sys_mmap: writable shared mapping needs O_RDWR\n");
+		return NULL;
+	}
+
+	vm_area* vma = vma_alloc();
+	if (vma == NULL) {
+		printk("sys_mmap: alloc vm_area failed\n");
+		return NULL;
+	}
+	uint32_t pg_cnt = DIV_ROUND_UP(args->length, PG_SIZE);
+	// 只占用虚拟地址，物理页在缺页时才映射
+	lock_acquire(&user_pool.lock);
+	void* vaddr_start = vaddr_get(PF_USER, pg_cnt);
+	lock_release(&user_pool.lock);
+	if (vaddr_start == NULL) {
+		vma_free(vma);
+		printk("sys_mmap: no enough virtual address\n");
+		return NULL;
+	}
+
+	vma->vm_start = (uint32_t)vaddr_start;
+	vma->vm_pg_cnt = pg_cnt;
+	// 映射期间文件即使被关闭，inode 也要一直可用
+	vma->vm_inode = inode_open(mm_file->fd_inode->i_part, mm_file->fd_inode->i_no);
+	vma->vm_pg_off = args->offset / PG_SIZE;
+	vma->vm_prot = args->prot;
+	vma->vm_flags = args->flags;
+	list_append(&cur->vm_areas, &vma->vm_tag);
+	return vaddr_start;
+}
+
+/*
+解除从 addr 开始、长度为 length 的映射，目前只能整个解除 mmap 建立的一段映射
+共享映射中被写过的页在这里写回文件，成功返回 0，失败返回 -1
+*/
+int32_t sys_munmap(void* addr, uint32_t length) {
+	vm_area* vma = vma_find((uint32_t)addr);
+	if (
+		vma == NULL || vma->vm_start != (uint32_t)addr
+		|| DIV_ROUND_UP(length, PG_SIZE) != vma->vm_pg_cnt
+	) {
+		printk("sys_munmap: only a whole mapping can be unmapped\n");
+		return -1;
+	}
+
+	bool shared = (vma->vm_flags & MAP_SHARED) != 0;
+	bool dirty = 0;
+	uint32_t idx = 0;
+	for (; idx < vma->vm_pg_cnt; idx++) {
+		uint32_t pte = page_unmap(vma->vm_start + idx * PG_SIZE);
+		// 没有访问过的页没有映射
+		if (pte == 0) {
+			continue;
+		}
+		if (shared) {
+			// 处理器在页被写过时置上 pte 中的脏位
+			bool pg_dirty = (pte & PG_D) != 0;
+			page_cache_put(vma->vm_inode, vma->vm_pg_off + idx, pg_dirty);
+			dirty |= pg_dirty;
+		} else {
+			lock_acquire(&user_pool.lock);
+			pfree(pte & 0xfffff000);
+			lock_release(&user_pool.lock);
+		}
+	}
+	lock_acquire(&user_pool.lock);
+	vaddr_remove(PF_USER, addr, vma->vm_pg_cnt);
+	lock_release(&user_pool.lock);
+
+	partition* part = vma->vm_inode->i_part;
+	journal_begin(part);
+	if (dirty) {
+		page_cache_flush(vma->vm_inode);
+	}
+	inode_close(vma->vm_inode);
+	journal_end(part);
+
+	list_remove(&vma->vm_tag);
+	vma_free(vma);
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include "page_cache.h"
+#include "file.h"
+#include "fs.h"
+#include "journal.h"
+#include "thread.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "sync.h"
+
+static cache_page* cache_pages;
+static struct list page_cache_buckets[PAGE_CACHE_BUCKETS];
+// 引用计数为 0 的页按使用时间排列，空闲的页在队尾，淘汰时从队尾取
+static struct list page_cache_lru;
+static lock page_cache_lock;
+// 等待页读入完成的任务
+static struct list page_cache_waiters;
+
+/* 计算键的哈希桶 */
+static uint32_t page_cache_hash(partition* part, uint32_t inode_no, uint32_t pg_idx) {
+	return ((uint32_t)part + inode_no * 31 + pg_idx) % PAGE_CACHE_BUCKETS;
+}
+
+/* 在哈希桶中查找键对应的页，调用者需持有 page_cache_lock */
+static cache_page* page_cache_find(partition* part, uint32_t inode_no, uint32_t pg_idx) {
+	struct list* bucket = &page_cache_buckets[page_cache_hash(part, inode_no, pg_idx)];
+	struct list_elem* elem = bucket->head.next;
+	while (elem != &bucket->tail) {
+		cache_page* pg = elem2entry(cache_page, hash_tag, elem);
+		if (pg->part == part && pg->i_no == inode_no && pg->pg_idx == pg_idx) {
+			return pg;
+		}
+		elem = elem->next;
+	}
+	return NULL;
+}
+
+/*
+把脏页 pg 的内容写回文件，文件末尾之后的部分不写，调用者持有 page_cache_lock，返回时仍持有
+写回要进入日志，日志锁在 page_cache_lock 之前获取，所以写回期间释放 page_cache_lock；
+页被临时引用，不会被淘汰，对它的查找仍然命中，写回期间再被修改时会重新变脏
+*/
+static void page_cache_writeback(cache_page* pg) {
+	if (pg->ref_cnt++ == 0) {
+		list_remove(&pg->lru_tag);
+	}
+	pg->dirty = 0;
+	partition* part = pg->part;
+	uint32_t i_no = pg->i_no;
+	lock_release(&page_cache_lock);
+
+	journal_begin(part);
+	// 释放 page_cache_lock 期间文件可能被删除，删除时页会被 page_cache_drop 摘下
+	lock_acquire(&page_cache_lock);
+	bool dropped = pg->part != part || pg->i_no != i_no;
+	lock_release(&page_cache_lock);
+	if (! dropped) {
+		// 页被淘汰时文件可能已经关闭，重新打开它的 inode
+		inode* in = inode_open(part, i_no);
+		uint32_t pos = pg->pg_idx * PG_SIZE;
+		if (pos < in->i_size) {
+			file f = {.fd_pos = pos, .fd_flag = O_RDWR, .fd_inode = in, .fd_refs = 0};
+			uint32_t cnt = in->i_size - pos < PG_SIZE ? in->i_size - pos : PG_SIZE;
+			file_overwrite(&f, pg->kaddr, cnt);
+		}
+		inode_close(in);
+	}
+	journal_end(part);
+
+	lock_acquire(&page_cache_lock);
+	if (--pg->ref_cnt == 0) {
+		list_push(&page_cache_lru, &pg->lru_tag);
+	}
+}
+
+/* 初始化页缓存，页在第一次使用时才分配 */
+void page_cache_init(void) {
+	cache_pages = sys_malloc(sizeof(cache_page) * PAGE_CACHE_PAGES);
+	ASSERT(cache_pages != NULL);
+	lock_init(&page_cache_lock);
+	list_init(&page_cache_lru);
+	list_init(&page_cache_waiters);
+	uint32_t idx = 0;
+	while (idx < PAGE_CACHE_BUCKETS) {
+		list_init(&page_cache_buckets[idx++]);
+	}
+	// 空闲页的 part 为 NULL，不在任何哈希桶中
+	for (idx = 0; idx < PAGE_CACHE_PAGES; idx++) {
+		cache_pages[idx].part = NULL;
+		cache_pages[idx].kaddr = NULL;
+		cache_pages[idx].ref_cnt = 0;
+		cache_pages[idx].loading = 0;
+		list_append(&page_cache_lru, &cache_pages[idx].lru_tag);
+	}
+}
+
+/* 等待已被引用的页 pg 读入完成 */
+static void page_cache_wait_loaded(cache_page* pg) {
+	intr_status old_status = intr_disable();
+	while (pg->loading) {
+		wait_queue_block(&page_cache_waiters);
+	}
+	intr_set_status(old_status);
+}
+
+/*
+返回文件 in 第 pg_idx 页在页缓存中的内核地址并增加引用计数，不在缓存中时从文件读入
+文件末尾之后的部分为 0，缓存中的页都被引用时返回 NULL
+读文件要获取 inode 的读锁，而持有读锁的任务可能在缺页处理中等待 page_cache_lock，
+所以页先标记为正在读入并加入缓存，释放 page_cache_lock 后再读，同一页的其他查找等待读入完成
+*/
+void* page_cache_get(inode* in, uint32_t pg_idx) {
+	lock_acquire(&page_cache_lock);
+	cache_page* pg;
+	while (1) {
+		pg = page_cache_find(in->i_part, in->i_no, pg_idx);
+		if (pg != NULL) {
+			if (pg->ref_cnt++ == 0) {
+				list_remove(&pg->lru_tag);
+			}
+			lock_release(&page_cache_lock);
+			page_cache_wait_loaded(pg);
+			return pg->kaddr;
+		}
+
+		if (list_empty(&page_cache_lru)) {
+			lock_release(&page_cache_lock);
+			printk("page_cache_get: all cached pages are in use\n");
+			return NULL;
+		}
+		// 淘汰最久没有使用的页，脏页写回后回到队首，写回期间锁被释放过，需要重新查找
+		pg = elem2entry(cache_page, lru_tag, page_cache_lru.tail.prev);
+		if (pg->part == NULL || ! pg->dirty) {
+			break;
+		}
+		page_cache_writeback(pg);
+	}
+	if (pg->part != NULL) {
+		list_remove(&pg->hash_tag);
+		pg->part = NULL;
+	}
+	if (pg->kaddr == NULL) {
+		lock_acquire(&kernel_pool.lock);
+		pg->kaddr = get_kernel_pages(1);
+		lock_release(&kernel_pool.lock);
+		if (pg->kaddr == NULL) {
+			lock_release(&page_cache_lock);
+			printk("page_cache_get: get_kernel_pages failed\n");
+			return NULL;
+		}
+	}
+	list_remove(&pg->lru_tag);
+
+	pg->part = in->i_part;
+	pg->i_no = in->i_no;
+	pg->pg_idx = pg_idx;
+	pg->ref_cnt = 1;
+	pg->dirty = 0;
+	pg->loading = 1;
+	list_push(&page_cache_buckets[page_cache_hash(pg->part, pg->i_no, pg_idx)], &pg->hash_tag);
+	lock_release(&page_cache_lock);
+
+	memset(pg->kaddr, 0, PG_SIZE);
+	file f = {.fd_pos = pg_idx * PG_SIZE, .fd_flag = O_RDONLY, .fd_inode = in, .fd_refs = 0};
+	// 整页都在文件末尾之后时 file_read 返回 -1，页保持为 0
+	file_read(&f, pg->kaddr, PG_SIZE);
+
+	intr_status old_status = intr_disable();
+	pg->loading = 0;
+	wait_queue_wake_all(&page_cache_waiters);
+	intr_set_status(old_status);
+	return pg->kaddr;
+}
+
+/* 放回 page_cache_get 得到的一个引用，dirty 表示持有者修改过页的内容 */
+void page_cache_put(inode* in, uint32_t pg_idx, bool dirty) {
+	lock_acquire(&page_cache_lock);
+	cache_page* pg = page_cache_find(in->i_part, in->i_no, pg_idx);
+	ASSERT(pg != NULL && pg->ref_cnt > 0);
+	if (dirty) {
+		pg->dirty = 1;
+	}
+	if (--pg->ref_cnt == 0) {
+		list_push(&page_cache_lru, &pg->lru_tag);
+	}
+	lock_release(&page_cache_lock);
+}
+
+/* 把文件 in 在页缓存中被修改过的页写回文件，写回期间释放 page_cache_lock 不影响按下标扫描 */
+void page_cache_flush(inode* in) {
+	lock_acquire(&page_cache_lock);
+	uint32_t idx = 0;
+	for (; idx < PAGE_CACHE_PAGES; idx++) {
+		cache_page* pg = &cache_pages[idx];
+		if (pg->part == in->i_part && pg->i_no == in->i_no && pg->dirty) {
+			page_cache_writeback(pg);
+		}
+	}
+	lock_release(&page_cache_lock);
+}
+
+/* 文件 in 从 pos 开始写入了 buf 中的 count 个字节，同步更新已经缓存的页 */
+void page_cache_update(inode* in, uint32_t pos, const void* buf, uint32_t count) {
+	if (count == 0) {
+		return;
+	}
+	const uint8_t* src = buf;
+	uint32_t end = pos + count;
+	uint32_t pg_idx = pos / PG_SIZE;
+	lock_acquire(&page_cache_lock);
+	for (; pg_idx <= (end - 1) / PG_SIZE; pg_idx++) {
+		cache_page* pg = page_cache_find(in->i_part, in->i_no, pg_idx);
+		if (pg == NULL) {
+			continue;
+		}
+		uint32_t pg_start = pg_idx * PG_SIZE;
+		uint32_t from = pos > pg_start ? pos : pg_start;
+		uint32_t to = end < pg_start + PG_SIZE ? end : pg_start + PG_SIZE;
+		memcpy(pg->kaddr + (from - pg_start), src + (from - pos), to - from);
+	}
+	lock_release(&page_cache_lock);
+}
+
+/*
+删除文件时丢弃它在页缓存中的所有页，此时这些页不能再被映射
+仍有引用的页只能是正在被 page_cache_writeback 写回的，写回发现页已被摘下就不再写，之后由它放回 LRU 链表
+*/
+void page_cache_drop(partition* part, uint32_t inode_no) {
+	lock_acquire(&page_cache_lock);
+	uint32_t idx = 0;
+	for (; idx < PAGE_CACHE_PAGES; idx++) {
+		cache_page* pg = &cache_pages[idx];
+		if (pg->part == part && pg->i_no == inode_no) {
+			list_remove(&pg->hash_tag);
+			pg->part = NULL;
+			pg->dirty = 0;
+			if (pg->ref_cnt > 0) {
+				continue;
+			}
+			// 空闲页放到队尾，优先被重用
+			list_remove(&pg->lru_tag);
+			list_append(&page_cache_lru, &pg->lru_tag);
+		}
+	}
+	lock_release(&page_cache_lock);
+}
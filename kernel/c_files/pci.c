@@ -0,0 +1,120 @@
+#include "pci.h"
+#include "io.h"
+#include "global.h"
+#include "interrupt.h"
+#include "debug.h"
+
+/* 通过这两个端口访问 pci 配置空间，先向地址端口写入要访问的位置，再读写数据端口 */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA    0xcfc
+
+// 只扫描前几条总线，模拟器上的设备都挂在 0 号总线上
+#define PCI_MAX_BUS 8
+
+// 每个中断号上最多挂接的处理函数数，pci 设备之间会共享中断
+#define PCI_IRQ_SHARE_MAX 4
+
+/* 挂接在某个中断号上的一个处理函数 */
+typedef struct {
+	void (*handler)(void* arg);
+	void* arg;
+} pci_irq_action;
+
+static pci_irq_action irq_actions[16][PCI_IRQ_SHARE_MAX];
+
+/* 计算配置空间地址端口的值，第 31 位为使能位，offset 要 4 字节对齐 */
+static uint32_t config_address(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+	return 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (offset & 0xfc);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+	outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, func, offset));
+	return inl(PCI_CONFIG_DATA);
+}
+
+/* 读取 pdev 配置空间中 offset 处的双字 */
+uint32_t pci_config_read(pci_device* pdev, uint8_t offset) {
+	return config_read(pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+/* 向 pdev 配置空间中 offset 处写入双字 value */
+void pci_config_write(pci_device* pdev, uint8_t offset, uint32_t value) {
+	outl(PCI_CONFIG_ADDRESS, config_address(pdev->bus, pdev->dev, pdev->func, offset));
+	outl(PCI_CONFIG_DATA, value);
+}
+
+/* 填写 pdev 的基本信息，该位置上没有设备时返回 0 */
+static bool probe_function(uint8_t bus, uint8_t dev, uint8_t func, pci_device* pdev) {
+	uint32_t id = config_read(bus, dev, func, PCI_VENDOR_ID);
+	if ((id & 0xffff) == 0xffff) {
+		return 0;
+	}
+	uint32_t class_rev = config_read(bus, dev, func, PCI_CLASS_REVISION);
+	pdev->bus = bus;
+	pdev->dev = dev;
+	pdev->func = func;
+	pdev->vendor_id = id & 0xffff;
+	pdev->device_id = id >> 16;
+	pdev->class_code = class_rev >> 24;
+	pdev->subclass = (class_rev >> 16) & 0xff;
+	pdev->prog_if = (class_rev >> 8) & 0xff;
+	pdev->irq_line = config_read(bus, dev, func, PCI_INTERRUPT_LINE) & 0xff;
+	return 1;
+}
+
+/* 扫描 pci 总线，找到第一个使 match(pdev, arg) 返回 1 的设备存入 found，找不到返回 0 */
+bool pci_find(bool (*match)(pci_device* pdev, int arg), int arg, pci_device* found) {
+	uint8_t bus, dev, func, func_cnt;
+	for (bus = 0; bus < PCI_MAX_BUS; bus++) {
+		for (dev = 0; dev < 32; dev++) {
+			if (!probe_function(bus, dev, 0, found)) {
+				continue;
+			}
+			// header type 的第 7 位表示这是一个多功能设备
+			func_cnt = (config_read(bus, dev, 0, PCI_HEADER_TYPE) & 0x800000) ? 8 : 1;
+			for (func = 0; func < func_cnt; func++) {
+				if (probe_function(bus, dev, func, found) && match(found, arg)) {
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* 在 command 寄存器中打开 cmd_bits，比如允许设备访问内存做 DMA */
+void pci_enable(pci_device* pdev, uint16_t cmd_bits) {
+	uint32_t cmd = pci_config_read(pdev, PCI_COMMAND);
+	// 高 16 位是状态寄存器，写 1 会清除其中的位，所以只写回低 16 位
+	pci_config_write(pdev, PCI_COMMAND, (cmd & 0xffff) | cmd_bits);
+}
+
+/* 中断号共享时依次调用挂接在上面的处理函数，由各设备自己判断是否是它产生的中断 */
+static void pci_intr_handler(uint8_t vec_no) {
+	pci_irq_action* action = irq_actions[vec_no - 0x20];
+	uint8_t idx = 0;
+	while (idx < PCI_IRQ_SHARE_MAX && action[idx].handler != NULL) {
+		action[idx].handler(action[idx].arg);
+		idx++;
+	}
+}
+
+/* 把 handler 挂接到 irq 号中断上，并在 8259A 上打开它 */
+void pci_register_irq(uint8_t irq, void (*handler)(void* arg), void* arg) {
+	ASSERT(irq < 16);
+	pci_irq_action* action = irq_actions[irq];
+	uint8_t idx = 0;
+	while (action[idx].handler != NULL) {
+		idx++;
+		ASSERT(idx < PCI_IRQ_SHARE_MAX);
+	}
+	action[idx].handler = handler;
+	action[idx].arg = arg;
+
+	register_handler(0x20 + irq, pci_intr_handler);
+	// 从片上的中断要经过主片的 IRQ2
+	if (irq >= 8) {
+		pic_enable_irq(2);
+	}
+	pic_enable_irq(irq);
+}
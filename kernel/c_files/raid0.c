@@ -0,0 +1,175 @@
+#include "raid0.h"
+#include "string.h"
+#include "stdio.h"
+#include "debug.h"
+#include "list.h"
+
+/* 条带卷的私有数据 */
+typedef struct {
+	// 组成条带卷的成员分区，条带块按顺序轮流落在各个成员上
+	partition* members[RAID0_MAX_MEMBERS];
+	uint8_t member_cnt;
+	// 每个成员分区上被条带卷使用的扇区数
+	uint32_t member_secs;
+} raid0_volume;
+
+extern struct list partition_list;
+
+// 当前只支持一个条带卷
+static disk md0;
+static raid0_volume md0_volume;
+
+/* 把条带卷上的扇区 lba 映射到成员分区，返回成员下标，成员上的扇区地址存入 member_lba */
+static uint8_t raid0_map(raid0_volume* vol, uint32_t lba, uint32_t* member_lba) {
+	uint32_t chunk_no = lba >> RAID0_CHUNK_SHIFT;
+	uint8_t member = chunk_no % vol->member_cnt;
+	uint32_t member_chunk = chunk_no / vol->member_cnt;
+	*member_lba = vol->members[member]->start_lba +\
+	(member_chunk << RAID0_CHUNK_SHIFT) + (lba & (RAID0_CHUNK_SECTS - 1));
+	return member;
+}
+
+/* 条带卷只记录请求，真正的读写在 raid0_wait 中按轮进行 */
+static void raid0_submit(disk_req* req) {
+	ASSERT(req->sec_cnt > 0);
+	ASSERT(req->lba + req->sec_cnt <= req->hd->sec_cnt);
+	req->secs_done = 0;
+}
+
+/*
+按轮处理请求，每轮至多向每个成员各发出一条命令，全部发出后再逐个等待，
+成员位于不同的通道上，各硬盘可以同时寻道，但 PIO 的数据要由 cpu 逐个扇区搬运，数据阶段仍是轮流进行的
+*/
+static void raid0_wait(disk_req* req) {
+	raid0_volume* vol = req->hd->priv;
+	disk_req sub_reqs[RAID0_MAX_MEMBERS];
+	bool used[RAID0_MAX_MEMBERS];
+	uint8_t member, sub_cnt;
+	uint32_t lba, member_lba, chunk_left, secs_left, secs_op;
+
+	while (req->secs_done < req->sec_cnt) {
+		memset(used, 0, sizeof(used));
+		sub_cnt = 0;
+		// 一轮中相邻的条带块一定落在不同的成员上
+		while (sub_cnt < vol->member_cnt && req->secs_done < req->sec_cnt) {
+			lba = req->lba + req->secs_done;
+			member = raid0_map(vol, lba, &member_lba);
+			// 本条命令最多操作到当前条带块的末尾
+			chunk_left = RAID0_CHUNK_SECTS - (lba & (RAID0_CHUNK_SECTS - 1));
+			secs_left = req->sec_cnt - req->secs_done;
+			secs_op = chunk_left < secs_left ? chunk_left : secs_left;
+
+			disk_req_init(
+				&sub_reqs[member], vol->members[member]->my_disk, member_lba,
+				(void*)((uint32_t)req->buf + req->secs_done * 512),
+				secs_op, req->is_write
+			);
+			used[member] = 1;
+			req->secs_done += secs_op;
+			sub_cnt++;
+		}
+
+		// 总是按成员下标的顺序发出，避免两个线程以相反顺序持有通道锁而死锁
+		for (member = 0; member < vol->member_cnt; member++) {
+			if (used[member]) {
+				disk_submit(&sub_reqs[member]);
+			}
+		}
+		for (member = 0; member < vol->member_cnt; member++) {
+			if (used[member]) {
+				disk_wait(&sub_reqs[member]);
+			}
+		}
+	}
+}
+
+/* 条带卷的写缓存就是各成员硬盘的写缓存，成员都在不同的硬盘上 */
+static void raid0_flush(disk* hd) {
+	raid0_volume* vol = hd->priv;
+	uint8_t idx = 0;
+	for (; idx < vol->member_cnt; idx++) {
+		disk_flush(vol->members[idx]->my_disk);
+	}
+}
+
+// 条带卷的驱动
+static disk_ops raid0_ops = {raid0_submit, raid0_wait, raid0_flush};
+
+/*
+让 list_traversal 收集 raid 成员分区的动作函数
+不论能否加入条带卷，raid 分区都要从分区队列中摘下，
+否则缺盘时落单的成员会因为没有超级块而被当作新分区格式化，毁掉条带上的数据
+list_remove 不改动被摘下元素的 next，所以可以在遍历中摘除
+*/
+static bool collect_member(struct list_elem* pelem, int arg) {
+	partition* part = elem2entry(partition, part_tag, pelem);
+	raid0_volume* vol = (raid0_volume*)arg;
+	if (part->fs_type != RAID_PART_TYPE) {
+		return 0;
+	}
+	list_remove(&part->part_tag);
+
+	uint8_t idx = 0;
+	while (idx < vol->member_cnt) {
+		disk* other = vol->members[idx]->my_disk;
+		// 同一通道上的两块盘不能同时工作，放在一起条带化没有意义
+		if (
+			other == part->my_disk
+			|| (other->my_channel != NULL && other->my_channel == part->my_disk->my_channel)
+		) {
+			printk("  raid0: %s shares a channel with %s, skipped and left untouched\n", part->name, vol->members[idx]->name);
+			return 0;
+		}
+		idx++;
+	}
+
+	if (vol->member_cnt == RAID0_MAX_MEMBERS) {
+		printk("  raid0: too many members, %s skipped and left untouched\n", part->name);
+		return 0;
+	}
+	vol->members[vol->member_cnt++] = part;
+	return 0;
+}
+
+/* 把类型为 RAID_PART_TYPE 的分区组装成条带卷 md0，并用它代替成员分区加入分区队列，成员分区不再被单独格式化和挂载 */
+void raid0_init(void) {
+	raid0_volume* vol = &md0_volume;
+	memset(vol, 0, sizeof(raid0_volume));
+	list_traversal(&partition_list, collect_member, (int)vol);
+	if (vol->member_cnt == 0) {
+		return;
+	}
+	if (vol->member_cnt < 2) {
+		printk("  raid0: %s is the only member, not assembled and left untouched\n", vol->members[0]->name);
+		return;
+	}
+
+	// 以最小的成员为准，并向下对齐到整个条带块
+	uint8_t idx = 0;
+	vol->member_secs = vol->members[0]->sec_cnt;
+	while (idx < vol->member_cnt) {
+		partition* part = vol->members[idx];
+		if (part->sec_cnt < vol->member_secs) {
+			vol->member_secs = part->sec_cnt;
+		}
+		idx++;
+	}
+	vol->member_secs &= ~(RAID0_CHUNK_SECTS - 1);
+
+	memset(&md0, 0, sizeof(disk));
+	strcpy(md0.name, "md0");
+	md0.ops = &raid0_ops;
+	md0.priv = vol;
+	md0.sec_cnt = vol->member_secs * vol->member_cnt;
+
+	// 整个条带卷作为一个分区
+	partition* part = &md0.prim_parts[0];
+	part->start_lba = 0;
+	part->sec_cnt = md0.sec_cnt;
+	part->my_disk = &md0;
+	part->fs_type = RAID_PART_TYPE;
+	sprintf(part->name, "%sp1", md0.name);
+	list_append(&partition_list, &part->part_tag);
+
+	printk("  raid0: %s assembled from %d members, %d sectors\n", md0.name, vol->member_cnt, part->sec_cnt);
+}
@@ -206,10 +206,55 @@ static void builtin_rm() {
 	}
 }
 
-extern dir root_dir;
-/*TODO: 显示当前目录里的内容，目前仅支持 root_dir*/
+/* 复制一个文件，数据由 copy_file_range 在内核中搬运 */
+static void builtin_cp() {
+	if (argc != 3 || argv[1][0] != '/' || argv[2][0] != '/') {
+		printf(
+			"[ERROR] cp cmd should look like `cp /%s /%s`\n",
+			(argc >= 2? argv[1]: "src"),
+			(argc >= 3? argv[2]: "dst")
+		);
+		return;
+	}
+
+	int32_t fd_in, fd_out;
+	if ((fd_in = open(argv[1], O_RDONLY)) == -1) {
+		printf("[ERROR] open file %s error\n", argv[1]);
+		return;
+	}
+	if ((fd_out = open(argv[2], O_CREAT | O_WRONLY)) == -1) {
+		printf("[ERROR] fail to create file %s\n", argv[2]);
+		close(fd_in);
+		return;
+	}
+	int32_t copied, total = 0;
+	while ((copied = copy_file_range(fd_in, fd_out, 0x10000)) > 0) {
+		total += copied;
+	}
+	if (copied == -1) {
+		printf("[ERROR] copy %s to %s failed\n", argv[1], argv[2]);
+	} else {
+		printf("copied %d bytes\n", total);
+	}
+	close(fd_in);
+	close(fd_out);
+}
+
+/* 显示根目录所在文件系统的块和 inode 的使用情况 */
+static void builtin_df() {
+	fs_stat st;
+	if (statfs("/", &st) == -1) {
+		printf("[ERROR] statfs / failed\n");
+		return;
+	}
+	printf("Block size: %d\n", st.f_bsize);
+	printf("Blocks:  %d total, %d used, %d free\n", st.f_blocks, st.f_blocks - st.f_bfree, st.f_bfree);
+	printf("Inodes:  %d total, %d used, %d free\n", st.f_files, st.f_files - st.f_ffree, st.f_ffree);
+}
+
+/*TODO: 显示当前目录里的内容，目前仅支持根目录*/
 static void builtin_ls() {
-	dir* path = &root_dir;
+	dir* path = mount_root_dir("/");
 	rewinddir(path);
 	dir_entry* dir_e = NULL;
 	while (dir_e = readdir(path)) {
@@ -225,6 +270,8 @@ static void builtin_help() {
 		" rm:    remove a regular file\n"
 		" ls:    list root directory contents\n"
 		" cat:   print a file content\n"
+		" cp:    copy a regular file\n"
+		" df:    show free blocks and inodes\n"
 		" touch: create a empty file\n"
 		" edit:  edit a exists file\n"
 		" clear: clear the screen\n"
@@ -256,6 +303,8 @@ void* cmd_map[][2] = {
 	{"clear", clear},
 	{"ls",    builtin_ls},
 	{"rm",    builtin_rm},
+	{"cp",    builtin_cp},
+	{"df",    builtin_df},
 	{"logo",  builtin_logo},
 	{"help",  builtin_help}
 };
@@ -21,6 +21,23 @@ void memcpy(void* dst_, const void* src_, uint32_t size) {
 	while (size-->0) *dst++ = *src++;
 }
 
+/**
+ * 将 src_ 起始的 size 个字节复制到 dst_，两者可以重叠
+ */
+void memmove(void* dst_, const void* src_, uint32_t size) {
+	ASSERT(dst_ != NULL && src_ != NULL);
+	uint8_t* dst = (uint8_t*)dst_;
+	const uint8_t* src = (const uint8_t*) src_;
+	if (dst <= src || dst >= src + size) {
+		while (size-->0) *dst++ = *src++;
+	} else {
+		// 目的区域在源区域之后且有重叠，要从后往前复制
+		dst += size;
+		src += size;
+		while (size-->0) *--dst = *--src;
+	}
+}
+
 /**
  * 连续比较以 a_ 和 b_ 开头的 size 个字节，若相等返回 0
  */
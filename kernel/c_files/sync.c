@@ -1,4 +1,5 @@
 #include "thread.h"
+#include "timer.h"
 #include "debug.h"
 #include "sync.h"
 #include "interrupt.h"
@@ -41,6 +42,58 @@ void sema_down(semaphore* psema) {
 	intr_set_status(old_status);
 }
 
+/* sema_down_timeout 中用于超时唤醒的记录 */
+typedef struct {
+	semaphore* psema;
+	task_struct* waiter;
+	bool expired;
+} sema_timeout;
+
+/* 超时后由时钟中断调用，把仍在等待的线程从 waiters 中摘下并唤醒 */
+static void sema_timeout_fire(void* arg) {
+	sema_timeout* st = arg;
+	st->expired = 1;
+	if (elem_find(&st->psema->waiters, &st->waiter->general_tag)) {
+		list_remove(&st->waiter->general_tag);
+		thread_unblock(st->waiter);
+	}
+}
+
+/* 带超时的 down 操作，最多阻塞 timeout_ticks 个滴答，成功返回 1，超时返回 0 */
+bool sema_down_timeout(semaphore* psema, uint32_t timeout_ticks) {
+	intr_status old_status = intr_disable();
+
+	if (psema->value == 0) {
+		task_struct* cur = running_thread();
+		sema_timeout st = {psema, cur, 0};
+		timer_event ev;
+		ev.func = sema_timeout_fire;
+		ev.arg = &st;
+		timer_add(&ev, timeout_ticks);
+
+		while (psema->value == 0 && !st.expired) {
+			ASSERT(! elem_find(&psema->waiters, &cur->general_tag));
+			list_append(&psema->waiters, &cur->general_tag);
+			thread_block(TASK_BLOCKED);
+		}
+
+		// 到期的事件已经被时钟中断摘下，这里只需撤销未到期的
+		if (! st.expired) {
+			timer_del(&ev);
+		}
+		if (psema->value == 0) {
+			intr_set_status(old_status);
+			return 0;
+		}
+	}
+
+	psema->value--;
+	ASSERT(psema->value == 0);
+
+	intr_set_status(old_status);
+	return 1;
+}
+
 /* 信号量的 up(V) 操作 */
 void sema_up(semaphore* psema) {
 	intr_status old_status = intr_disable();
@@ -82,4 +135,94 @@ void lock_release(lock* plock) {
 	plock->holder = NULL;
 	plock->holder_repeat_nr = 0;
 	sema_up(&plock->semaphore);
-}
\ No newline at end of file
+}
+/* 把当前任务加入等待队列 waiters 并阻塞，直到被 wait_queue_wake_all 唤醒，调用者需关中断 */
+void wait_queue_block(struct list* waiters) {
+	ASSERT(intr_get_status() == INTR_OFF);
+	task_struct* cur = running_thread();
+	ASSERT(! elem_find(waiters, &cur->general_tag));
+	list_append(waiters, &cur->general_tag);
+	thread_block(TASK_BLOCKED);
+}
+
+/* 唤醒等待队列 waiters 中的所有任务，调用者需关中断 */
+void wait_queue_wake_all(struct list* waiters) {
+	ASSERT(intr_get_status() == INTR_OFF);
+	while (! list_empty(waiters)) {
+		thread_unblock(elem2entry(task_struct, general_tag, list_pop(waiters)));
+	}
+}
+
+/* 初始化读写锁 rw */
+void rwlock_init(rwlock* rw) {
+	rw->readers = 0;
+	rw->writer = NULL;
+	rw->writer_repeat_nr = 0;
+	rw->writers_waiting = 0;
+	list_init(&rw->waiters);
+}
+
+/*
+获取读锁，有写者在等待时新的读者让它先走
+但已经持有读锁的任务不让：它可能持有的就是这把锁，写者又在等它释放，重复申请读锁时会互相等待
+*/
+void rwlock_read_acquire(rwlock* rw) {
+	intr_status old_status = intr_disable();
+	task_struct* cur = running_thread();
+	if (rw->writer == cur) {
+		// 已经持有写锁，当作重复申请写锁
+		rw->writer_repeat_nr++;
+	} else {
+		while (rw->writer != NULL || (rw->writers_waiting > 0 && cur->rwlock_reads == 0)) {
+			wait_queue_block(&rw->waiters);
+		}
+		rw->readers++;
+		cur->rwlock_reads++;
+	}
+	intr_set_status(old_status);
+}
+
+/* 释放读锁 */
+void rwlock_read_release(rwlock* rw) {
+	task_struct* cur = running_thread();
+	if (rw->writer == cur) {
+		rwlock_write_release(rw);
+		return;
+	}
+	intr_status old_status = intr_disable();
+	ASSERT(rw->readers > 0 && cur->rwlock_reads > 0);
+	cur->rwlock_reads--;
+	if (--rw->readers == 0) {
+		wait_queue_wake_all(&rw->waiters);
+	}
+	intr_set_status(old_status);
+}
+
+/* 获取写锁 */
+void rwlock_write_acquire(rwlock* rw) {
+	intr_status old_status = intr_disable();
+	task_struct* cur = running_thread();
+	if (rw->writer == cur) {
+		rw->writer_repeat_nr++;
+	} else {
+		rw->writers_waiting++;
+		while (rw->writer != NULL || rw->readers > 0) {
+			wait_queue_block(&rw->waiters);
+		}
+		rw->writers_waiting--;
+		rw->writer = cur;
+		rw->writer_repeat_nr = 1;
+	}
+	intr_set_status(old_status);
+}
+
+/* 释放写锁 */
+void rwlock_write_release(rwlock* rw) {
+	intr_status old_status = intr_disable();
+	ASSERT(rw->writer == running_thread());
+	if (--rw->writer_repeat_nr == 0) {
+		rw->writer = NULL;
+		wait_queue_wake_all(&rw->waiters);
+	}
+	intr_set_status(old_status);
+}
@@ -6,6 +6,7 @@
 #include "string.h"
 #include "memory.h"
 #include "fork.h"
+#include "mmap.h"
 
 #define SYSCALL_NR 32
 typedef void* syscall;
@@ -22,6 +23,17 @@ syscall syscall_table[SYSCALL_NR];
 	retval;\
 })
 
+#define _syscall4(NUMBER, ARG1, ARG2, ARG3, ARG4) ({\
+	int retval;\
+	__asm__ __volatile__ (\
+		"int $0x80"\
+		: "=a"(retval)\
+		: "a"(NUMBER), "b"(ARG1), "c"(ARG2), "d"(ARG3), "S"(ARG4)\
+		: "memory"\
+	);\
+	retval;\
+})
+
 #define _syscall0(NUMBER)             _syscall3(NUMBER, NULL, NULL, NULL)
 #define _syscall1(NUMBER, ARG1)       _syscall3(NUMBER, ARG1, NULL, NULL)
 #define _syscall2(NUMBER, ARG1, ARG2) _syscall3(NUMBER, ARG1, ARG2, NULL)
@@ -90,6 +102,57 @@ int32_t unlink(const char* pathname) {
 	return _syscall1(SYS_UNLINK, pathname);
 }
 
+/* 把文件 fd 从 offset 开始的 length 个字节映射到内存，失败返回 NULL */
+void* mmap(uint32_t length, uint8_t prot, uint8_t flags, int32_t fd, uint32_t offset) {
+	mmap_args args = {length, prot, flags, fd, offset};
+	return (void*)_syscall1(SYS_MMAP, &args);
+}
+
+/* 解除 mmap 建立的映射 */
+int32_t munmap(void* addr, uint32_t length) {
+	return _syscall2(SYS_MUNMAP, addr, length);
+}
+
+/* 从 fd 的 offset 处读取 count 个字节到 buf，不改变 fd 的读写位置 */
+int32_t pread(int32_t fd, void* buf, uint32_t count, uint32_t offset) {
+	return _syscall4(SYS_PREAD, fd, buf, count, offset);
+}
+
+/* 把 buf 中 count 个字节写入 fd 的 offset 处，不改变 fd 的读写位置 */
+int32_t pwrite(int32_t fd, const void* buf, uint32_t count, uint32_t offset) {
+	return _syscall4(SYS_PWRITE, fd, buf, count, offset);
+}
+
+/* 从 fd 依次读入 iovcnt 个缓冲区 */
+int32_t readv(int32_t fd, const iovec* iov, uint32_t iovcnt) {
+	return _syscall3(SYS_READV, fd, iov, iovcnt);
+}
+
+/* 把 iovcnt 个缓冲区依次写入 fd */
+int32_t writev(int32_t fd, const iovec* iov, uint32_t iovcnt) {
+	return _syscall3(SYS_WRITEV, fd, iov, iovcnt);
+}
+
+/* 在内核中把 fd_in 当前位置起的 count 个字节追加到 fd_out */
+int32_t copy_file_range(int32_t fd_in, int32_t fd_out, uint32_t count) {
+	return _syscall3(SYS_COPY_FILE_RANGE, fd_in, fd_out, count);
+}
+
+/* 等待 fd 对应文件的数据和元数据写到磁盘上 */
+int32_t fsync(int32_t fd) {
+	return _syscall1(SYS_FSYNC, fd);
+}
+
+/* 等待所有文件的数据和元数据写到磁盘上 */
+void sync(void) {
+	_syscall0(SYS_SYNC);
+}
+
+/* 查询 path 所在文件系统的容量和使用情况 */
+int32_t statfs(const char* path, fs_stat* buf) {
+	return _syscall2(SYS_STATFS, path, buf);
+}
+
 /*---------- 内核态使用，即需要被注册到 syscall_table 的具体实现 ----------*/
 
 uint32_t sys_getpid(void) {
@@ -115,5 +178,15 @@ void syscall_init(void) {
 	syscall_table[SYS_READDIR]   = sys_readdir;
 	syscall_table[SYS_REWINDDIR] = sys_rewinddir;
 	syscall_table[SYS_UNLINK]    = sys_unlink;
+	syscall_table[SYS_MMAP]      = sys_mmap;
+	syscall_table[SYS_MUNMAP]    = sys_munmap;
+	syscall_table[SYS_PREAD]     = sys_pread;
+	syscall_table[SYS_PWRITE]    = sys_pwrite;
+	syscall_table[SYS_READV]     = sys_readv;
+	syscall_table[SYS_WRITEV]    = sys_writev;
+	syscall_table[SYS_COPY_FILE_RANGE] = sys_copy_file_range;
+	syscall_table[SYS_FSYNC]     = sys_fsync;
+	syscall_table[SYS_SYNC]      = sys_sync;
+	syscall_table[SYS_STATFS]    = sys_statfs;
 	put_str("syscall_init done\n");
 }
\ No newline at end of file
@@ -100,6 +100,9 @@ void init_thread(task_struct* pthread, char* name, int prio) {
 	// 当前线程在内核态下使用的栈顶地址
 	pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
 
+	pthread->fd_table = pthread->fd_inline;
+	pthread->fd_table_size = MAX_FILES_OPEN_PER_PROC;
+	pthread->fd_free_hint = 3;
 	// 定义 stdin, stdout, stderr
 	pthread->fd_table[0] = 0;
 	pthread->fd_table[1] = 1;
@@ -109,6 +112,9 @@ void init_thread(task_struct* pthread, char* name, int prio) {
 		pthread->fd_table[i] = -1;
 	}
 
+	list_init(&pthread->vm_areas);
+	pthread->rwlock_reads = 0;
+
 	// 用于检测边界的魔数，避免压栈操作破坏 PCB 的基本信息
 	pthread->stack_magic = *((uint32_t*) "iLym");
 }
@@ -1,11 +1,10 @@
 #include "io.h"
+#include "timer.h"
 #include "debug.h"
 #include "stdint.h"
 #include "thread.h"
 #include "interrupt.h"
 
-// 8253 每秒产生的中断数，默认约 18 次
-#define IRQ0_FREQUENCY       100
 // 计数器 0 的工作脉冲信号频率
 #define INPUT_FREQUENCY      1193180
 // 将要设置的计数器初值
@@ -20,12 +19,38 @@
 #define READ_WRITE_LATCH     3
 // 控制字寄存器的端口
 #define PIT_CONTROL_PORT     0x43
-// sleep 系列函数的换算
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
 
 // 自中断开启以来的总滴答数
 uint32_t ticks;
 
+// 尚未到期的定时事件
+static struct list timer_events;
+
+/* 让 list_traversal 找出第一个到期事件的动作函数 */
+static bool timer_event_expired(struct list_elem* elem, int now) {
+	timer_event* ev = elem2entry(timer_event, tag, elem);
+	// 用差值比较，避免 ticks 回绕后判断出错
+	return (int32_t)(now - ev->expire_tick) >= 0;
+}
+
+/* 添加一个 after_ticks 个滴答后到期的定时事件 */
+void timer_add(timer_event* ev, uint32_t after_ticks) {
+	intr_status old_status = intr_disable();
+	ev->expire_tick = ticks + after_ticks;
+	ASSERT(! elem_find(&timer_events, &ev->tag));
+	list_append(&timer_events, &ev->tag);
+	intr_set_status(old_status);
+}
+
+/* 撤销一个尚未到期的定时事件 */
+void timer_del(timer_event* ev) {
+	intr_status old_status = intr_disable();
+	if (elem_find(&timer_events, &ev->tag)) {
+		list_remove(&ev->tag);
+	}
+	intr_set_status(old_status);
+}
+
 /* 时钟的中断处理函数 */
 static void intr_timer_handler(void) {
 
@@ -36,6 +61,14 @@ static void intr_timer_handler(void) {
 	cur_thread->elapsed_ticks++;
 	ticks++;
 
+	// 先从链表中摘下到期的事件再调用，这样 func 中可以重新添加事件
+	struct list_elem* elem;
+	while ((elem = list_traversal(&timer_events, timer_event_expired, ticks)) != NULL) {
+		list_remove(elem);
+		timer_event* ev = elem2entry(timer_event, tag, elem);
+		ev->func(ev->arg);
+	}
+
 	if (cur_thread->ticks == 0) {
 		schedule();
 	} else {
@@ -72,7 +105,7 @@ static void ticks_to_sleep(uint32_t sleep_ticks) {
 
 /* 以毫秒为单位的 sleep */
 void mtime_sleep(uint32_t m_seconds) {
-	uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
+	uint32_t sleep_ticks = MS2TICKS(m_seconds);
 	ASSERT(sleep_ticks > 0);
 	ticks_to_sleep(sleep_ticks);
 }
@@ -86,6 +119,7 @@ void timer_init(void) {
 		COUNTER_MODE,
 		COUNTER0_VALUE
 	);
+	list_init(&timer_events);
 	register_handler(0x20, intr_timer_handler);
 	put_str("timer_init done\n");
 }
\ No newline at end of file
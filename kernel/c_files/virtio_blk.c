@@ -0,0 +1,497 @@
+#include "virtio_blk.h"
+#include "pci.h"
+#include "io.h"
+#include "stdio.h"
+#include "string.h"
+#include "memory.h"
+#include "thread.h"
+#include "interrupt.h"
+
+/* legacy virtio 设备 BAR0 中的寄存器，都是 io 端口 */
+#define VIRTIO_PCI_HOST_FEATURES  0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+// 写入队列所在的物理页号
+#define VIRTIO_PCI_QUEUE_PFN      0x08
+#define VIRTIO_PCI_QUEUE_NUM      0x0c
+#define VIRTIO_PCI_QUEUE_SEL      0x0e
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10
+#define VIRTIO_PCI_STATUS         0x12
+// 读取后清零，第 0 位表示队列有更新
+#define VIRTIO_PCI_ISR            0x13
+// 设备配置从这里开始，virtio-blk 的前 8 字节为扇区数
+#define VIRTIO_PCI_CONFIG         0x14
+
+/* 设备状态 */
+#define VIRTIO_STATUS_ACK       0x1
+#define VIRTIO_STATUS_DRIVER    0x2
+#define VIRTIO_STATUS_DRIVER_OK 0x4
+
+// 设备支持刷新写缓存的请求
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+
+/* 描述符的标志 */
+#define VRING_DESC_F_NEXT  0x1
+// 设备向该缓冲区写入
+#define VRING_DESC_F_WRITE 0x2
+
+// 设备在 used 环中置此标志，表示它正在处理队列，驱动不必通知它
+#define VRING_USED_F_NO_NOTIFY 0x1
+// 驱动在 avail 环中置此标志，表示它正在轮询 used 环，设备不必发中断
+#define VRING_AVAIL_F_NO_INTERRUPT 0x1
+
+// 等待请求完成时先轮询 used 环的次数，之后才打开中断睡眠
+#define VIRTIO_SPIN_LIMIT 1000
+
+/* 请求类型 */
+#define VIRTIO_BLK_T_IN  0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+
+// legacy 接口的 PCI 厂商号及设备号
+#define VIRTIO_VENDOR_ID  0x1af4
+#define VIRTIO_BLK_DEV_ID 0x1001
+
+/* 在读 used 环前保证 avail 环的更新已经对设备可见 */
+#define virtio_mb() __asm__ volatile ("lock; addl $0, (%%esp)" : : : "memory")
+#define barrier()   __asm__ volatile ("" : : : "memory")
+
+/* 描述符表中的一项 */
+typedef struct {
+	uint32_t addr;
+	uint32_t addr_hi;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+} __attribute__((packed)) vring_desc;
+
+/* 驱动向设备提供请求的环 */
+typedef struct {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+} __attribute__((packed)) vring_avail;
+
+typedef struct {
+	uint32_t id;
+	uint32_t len;
+} __attribute__((packed)) vring_used_elem;
+
+/* 设备向驱动返回完成的请求的环 */
+typedef struct {
+	uint16_t flags;
+	uint16_t idx;
+	vring_used_elem ring[];
+} __attribute__((packed)) vring_used;
+
+/* virtio-blk 请求头 */
+typedef struct {
+	uint32_t type;
+	uint32_t reserved;
+	uint32_t sector;
+	uint32_t sector_hi;
+} __attribute__((packed)) virtio_blk_req_hdr;
+
+/* 一个请求槽，对应一条描述符链 */
+typedef struct {
+	disk_req* req;
+	semaphore done;
+} virtio_slot;
+
+/* 一块 virtio 硬盘 */
+typedef struct {
+	pci_device pdev;
+	uint16_t io_base;
+	uint16_t queue_size;
+	vring_desc* desc;
+	vring_avail* avail;
+	vring_used* used;
+	// 已放入 avail 环但还没有告诉设备的请求，kick 时一起发布
+	uint16_t avail_shadow;
+	// 下一个要处理的 used 环项
+	uint16_t last_used;
+	// 每个槽的请求头和状态字节，设备通过 DMA 访问它们
+	virtio_blk_req_hdr* hdrs;
+	uint8_t* status;
+	uint32_t busy;
+	uint8_t slot_cnt;
+	// 是否协商了 VIRTIO_BLK_F_FLUSH，没有时设备不缓存写
+	bool flush;
+	// 正在轮询 used 环的线程数，不为 0 时 avail 环上置有 VRING_AVAIL_F_NO_INTERRUPT
+	uint8_t pollers;
+	virtio_slot slots[VIRTIO_BLK_MAX_SLOTS];
+} virtio_blk;
+
+static disk vblk_disks[VIRTIO_BLK_MAX_DISKS];
+static uint8_t vblk_cnt;
+
+/*
+用 PRD 的方式把 vaddr 开始的 bytes 字节拆成物理上连续的段，填入从 desc_idx 开始的描述符，返回段数
+缓冲区按页逐个转换为物理地址，各页须已由 disk_submit 映射好，这里关着中断，不能再缺页
+*/
+static uint16_t fill_data_descs(virtio_blk* vblk, uint16_t desc_idx, void* vaddr, uint32_t bytes, uint16_t flags) {
+	ASSERT(bytes > 0);
+	uint32_t vaddr_cur = (uint32_t)vaddr;
+	uint16_t seg_cnt = 0;
+	while (bytes > 0) {
+		ASSERT(page_present(vaddr_cur));
+		uint32_t phy = addr_v2p(vaddr_cur);
+		uint32_t len = PG_SIZE - (vaddr_cur & 0x00000fff);
+		if (len > bytes) {
+			len = bytes;
+		}
+
+		vring_desc* last = seg_cnt > 0 ? &vblk->desc[desc_idx + seg_cnt - 1] : NULL;
+		if (last != NULL && last->addr + last->len == phy) {
+			last->len += len;
+		} else {
+			ASSERT(seg_cnt < VIRTIO_DESCS_PER_SLOT - 2);
+			vring_desc* d = &vblk->desc[desc_idx + seg_cnt];
+			d->addr = phy;
+			d->addr_hi = 0;
+			d->len = len;
+			d->flags = flags | VRING_DESC_F_NEXT;
+			d->next = desc_idx + seg_cnt + 1;
+			seg_cnt++;
+		}
+		vaddr_cur += len;
+		bytes -= len;
+	}
+	return seg_cnt;
+}
+
+/* 把请求的下一段组织成描述符链放入 avail 环，需在关中断时调用，要 kick 后设备才会看到 */
+static void add_chain(virtio_blk* vblk, uint8_t slot, disk_req* req) {
+	uint32_t secs_op = req->sec_cnt - req->secs_done;
+	if (secs_op > VIRTIO_MAX_SECTS_PER_CMD) {
+		secs_op = VIRTIO_MAX_SECTS_PER_CMD;
+	}
+	uint16_t head = slot * VIRTIO_DESCS_PER_SLOT;
+
+	virtio_blk_req_hdr* hdr = &vblk->hdrs[slot];
+	hdr->type = req->is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+	hdr->reserved = 0;
+	hdr->sector = req->lba + req->secs_done;
+	hdr->sector_hi = 0;
+	vblk->desc[head].addr = addr_v2p((uint32_t)hdr);
+	vblk->desc[head].addr_hi = 0;
+	vblk->desc[head].len = sizeof(virtio_blk_req_hdr);
+	vblk->desc[head].flags = VRING_DESC_F_NEXT;
+	vblk->desc[head].next = head + 1;
+
+	uint16_t seg_cnt = fill_data_descs(
+		vblk, head + 1, (void*)((uint32_t)req->buf + req->secs_done * 512),
+		secs_op * 512, req->is_write ? 0 : VRING_DESC_F_WRITE
+	);
+
+	// 最后是设备写回的状态字节
+	vring_desc* st = &vblk->desc[head + 1 + seg_cnt];
+	vblk->status[slot] = 0xff;
+	st->addr = addr_v2p((uint32_t)&vblk->status[slot]);
+	st->addr_hi = 0;
+	st->len = 1;
+	st->flags = VRING_DESC_F_WRITE;
+	st->next = 0;
+
+	vblk->slots[slot].req = req;
+	vblk->avail->ring[vblk->avail_shadow % vblk->queue_size] = head;
+	vblk->avail_shadow++;
+	// virtio 驱动中 secs_done 记录的是已经放入队列的扇区数
+	req->secs_done += secs_op;
+}
+
+/* 发布 avail 环中新加入的请求，设备正忙于处理队列时省去通知 */
+static void kick(virtio_blk* vblk) {
+	intr_status old_status = intr_disable();
+	if (vblk->avail->idx != vblk->avail_shadow) {
+		barrier();
+		vblk->avail->idx = vblk->avail_shadow;
+		virtio_mb();
+		if (!(vblk->used->flags & VRING_USED_F_NO_NOTIFY)) {
+			outw(vblk->io_base + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+		}
+	}
+	intr_set_status(old_status);
+}
+
+/* 尝试占用一个空闲的槽，没有时返回 -1 */
+static int8_t try_alloc_slot(virtio_blk* vblk) {
+	int8_t slot = -1;
+	intr_status old_status = intr_disable();
+	uint8_t idx = 0;
+	while (idx < vblk->slot_cnt) {
+		if (!(vblk->busy & (1 << idx))) {
+			vblk->busy |= 1 << idx;
+			slot = idx;
+			break;
+		}
+		idx++;
+	}
+	intr_set_status(old_status);
+	return slot;
+}
+
+static void release_slot(virtio_blk* vblk, uint8_t slot) {
+	intr_status old_status = intr_disable();
+	vblk->slots[slot].req = NULL;
+	vblk->busy &= ~(1 << slot);
+	intr_set_status(old_status);
+}
+
+/* 收割 used 环中所有完成的请求，唤醒等待它们的线程，需在关中断时调用 */
+static void reap_used(virtio_blk* vblk) {
+	while (vblk->last_used != vblk->used->idx) {
+		barrier();
+		vring_used_elem* e = &vblk->used->ring[vblk->last_used % vblk->queue_size];
+		sema_up(&vblk->slots[e->id / VIRTIO_DESCS_PER_SLOT].done);
+		vblk->last_used++;
+	}
+}
+
+/*
+等待槽 slot 上的请求完成
+先关掉设备的中断自己轮询 used 环，很快完成的请求不必付出一次中断，
+仍未完成时，最后一个轮询者在睡眠前打开中断并再收割一次，以免漏掉关中断期间完成的请求
+*/
+static void wait_slot(virtio_blk* vblk, uint8_t slot) {
+	semaphore* done = &vblk->slots[slot].done;
+	intr_status old_status = intr_disable();
+	vblk->pollers++;
+	vblk->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+	intr_set_status(old_status);
+
+	uint32_t spin = 0;
+	while (done->value == 0 && spin++ < VIRTIO_SPIN_LIMIT) {
+		old_status = intr_disable();
+		reap_used(vblk);
+		intr_set_status(old_status);
+	}
+
+	old_status = intr_disable();
+	if (--vblk->pollers == 0) {
+		vblk->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+		virtio_mb();
+		reap_used(vblk);
+	}
+	intr_set_status(old_status);
+	sema_down(done);
+}
+
+/*
+把请求的前几段一起放入队列后只通知设备一次
+与 ahci 一样只在第一个槽上等待空闲，其余的槽没空就留给 virtio_blk_wait 复用自己的槽
+*/
+static void virtio_blk_submit(disk_req* req) {
+	virtio_blk* vblk = req->hd->priv;
+	ASSERT(req->sec_cnt > 0);
+	ASSERT(req->lba + req->sec_cnt <= req->hd->sec_cnt);
+	req->secs_done = 0;
+
+	int8_t slot;
+	while ((slot = try_alloc_slot(vblk)) == -1) {
+		thread_yeild();
+	}
+	uint8_t slots_used = 0;
+	intr_status old_status = intr_disable();
+	do {
+		add_chain(vblk, slot, req);
+		slots_used++;
+	} while (
+		req->secs_done < req->sec_cnt && slots_used < VIRTIO_SLOTS_PER_REQ
+		&& (slot = try_alloc_slot(vblk)) != -1
+	);
+	intr_set_status(old_status);
+	kick(vblk);
+}
+
+/* 等待请求占用的槽逐个完成，完成的槽若还有剩余部分就继续放入队列，在下次睡眠前一起通知设备 */
+static void virtio_blk_wait(disk_req* req) {
+	virtio_blk* vblk = req->hd->priv;
+	bool pending = 1;
+	while (pending) {
+		pending = 0;
+		uint8_t slot = 0;
+		for (; slot < vblk->slot_cnt; slot++) {
+			if (vblk->slots[slot].req != req) {
+				continue;
+			}
+			pending = 1;
+			kick(vblk);
+			wait_slot(vblk, slot);
+			if (vblk->status[slot] != 0) {
+				printk("%s %s error, lba: %d\n", req->hd->name, req->is_write ? "write" : "read", req->lba);
+				intr_disable();
+				while (1);
+			}
+			if (req->secs_done < req->sec_cnt) {
+				intr_status old_status = intr_disable();
+				add_chain(vblk, slot, req);
+				intr_set_status(old_status);
+			} else {
+				release_slot(vblk, slot);
+			}
+		}
+	}
+	kick(vblk);
+}
+
+/* 让设备把已经完成的写落盘，请求只有请求头和状态字节两个描述符 */
+static void virtio_blk_flush(disk* hd) {
+	virtio_blk* vblk = hd->priv;
+	if (! vblk->flush) {
+		return;
+	}
+	int8_t slot;
+	while ((slot = try_alloc_slot(vblk)) == -1) {
+		thread_yeild();
+	}
+	uint16_t head = slot * VIRTIO_DESCS_PER_SLOT;
+	virtio_blk_req_hdr* hdr = &vblk->hdrs[slot];
+	hdr->type = VIRTIO_BLK_T_FLUSH;
+	hdr->reserved = 0;
+	hdr->sector = 0;
+	hdr->sector_hi = 0;
+	vblk->desc[head].addr = addr_v2p((uint32_t)hdr);
+	vblk->desc[head].addr_hi = 0;
+	vblk->desc[head].len = sizeof(virtio_blk_req_hdr);
+	vblk->desc[head].flags = VRING_DESC_F_NEXT;
+	vblk->desc[head].next = head + 1;
+
+	vring_desc* st = &vblk->desc[head + 1];
+	vblk->status[slot] = 0xff;
+	st->addr = addr_v2p((uint32_t)&vblk->status[slot]);
+	st->addr_hi = 0;
+	st->len = 1;
+	st->flags = VRING_DESC_F_WRITE;
+	st->next = 0;
+
+	intr_status old_status = intr_disable();
+	vblk->avail->ring[vblk->avail_shadow % vblk->queue_size] = head;
+	vblk->avail_shadow++;
+	intr_set_status(old_status);
+	kick(vblk);
+	wait_slot(vblk, slot);
+	if (vblk->status[slot] != 0) {
+		printk("%s flush error\n", hd->name);
+		intr_disable();
+		while (1);
+	}
+	release_slot(vblk, slot);
+}
+
+// virtio 硬盘的驱动
+static disk_ops virtio_blk_ops = {virtio_blk_submit, virtio_blk_wait, virtio_blk_flush};
+
+/* 一次中断中收割 used 环中所有完成的请求，中断号可能与其他 pci 设备共享 */
+static void intr_virtio_blk_handler(void* arg) {
+	virtio_blk* vblk = arg;
+	// 读 ISR 会清除中断，不是本设备的中断就直接返回
+	if (!(inb(vblk->io_base + VIRTIO_PCI_ISR) & 0x1)) {
+		return;
+	}
+	reap_used(vblk);
+}
+
+/* 按 legacy 接口的布局分配队列：描述符表、avail 环，然后在下一页开始 used 环 */
+static bool setup_queue(virtio_blk* vblk) {
+	outw(vblk->io_base + VIRTIO_PCI_QUEUE_SEL, 0);
+	uint16_t qsz = inw(vblk->io_base + VIRTIO_PCI_QUEUE_NUM);
+	if (qsz < VIRTIO_DESCS_PER_SLOT) {
+		return 0;
+	}
+	uint32_t used_off = DIV_ROUND_UP(16 * qsz + 6 + 2 * qsz, PG_SIZE) * PG_SIZE;
+	uint32_t pg_cnt = (used_off + DIV_ROUND_UP(6 + 8 * qsz, PG_SIZE) * PG_SIZE) / PG_SIZE;
+	uint8_t* ring = get_kernel_pages_contiguous(pg_cnt);
+	if (ring == NULL) {
+		return 0;
+	}
+	vblk->queue_size = qsz;
+	vblk->desc = (vring_desc*)ring;
+	vblk->avail = (vring_avail*)(ring + 16 * qsz);
+	vblk->used = (vring_used*)(ring + used_off);
+
+	vblk->slot_cnt = qsz / VIRTIO_DESCS_PER_SLOT;
+	if (vblk->slot_cnt > VIRTIO_BLK_MAX_SLOTS) {
+		vblk->slot_cnt = VIRTIO_BLK_MAX_SLOTS;
+	}
+	// 请求头放在页的前半部分，状态字节放在后半部分
+	uint8_t* page = get_kernel_pages(1);
+	vblk->hdrs = (virtio_blk_req_hdr*)page;
+	vblk->status = page + PG_SIZE / 2;
+	uint8_t slot = 0;
+	for (; slot < vblk->slot_cnt; slot++) {
+		sema_init(&vblk->slots[slot].done, 0);
+	}
+
+	outl(vblk->io_base + VIRTIO_PCI_QUEUE_PFN, addr_v2p((uint32_t)ring) / PG_SIZE);
+	return 1;
+}
+
+/* 匹配 legacy virtio-blk 设备，arg 指向还要跳过的同类设备数 */
+static bool match_virtio_blk(pci_device* pdev, int arg) {
+	uint8_t* skip = (uint8_t*)arg;
+	if (pdev->vendor_id != VIRTIO_VENDOR_ID || pdev->device_id != VIRTIO_BLK_DEV_ID) {
+		return 0;
+	}
+	if (*skip > 0) {
+		(*skip)--;
+		return 0;
+	}
+	return 1;
+}
+
+/* 初始化一块 virtio 硬盘：复位、协商特性、建立队列，然后扫描分区 */
+static void virtio_blk_probe(virtio_blk* vblk) {
+	uint16_t io = vblk->io_base;
+	outb(io + VIRTIO_PCI_STATUS, 0);
+	outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+	outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+	// 可选特性中只使用刷新写缓存
+	uint32_t features = inl(io + VIRTIO_PCI_HOST_FEATURES) & VIRTIO_BLK_F_FLUSH;
+	outl(io + VIRTIO_PCI_GUEST_FEATURES, features);
+	vblk->flush = features != 0;
+
+	if (!setup_queue(vblk)) {
+		printk("  virtio-blk %d: queue setup failed\n", vblk_cnt);
+		return;
+	}
+	pci_register_irq(vblk->pdev.irq_line, intr_virtio_blk_handler, vblk);
+	outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+	disk* hd = &vblk_disks[vblk_cnt];
+	// 容量是 64 位的，超过 32 位能表示的部分不使用
+	uint32_t cap_hi = inl(io + VIRTIO_PCI_CONFIG + 4);
+	hd->sec_cnt = cap_hi ? 0xffffffff : inl(io + VIRTIO_PCI_CONFIG);
+	sprintf(hd->name, "vd%c", 'a' + vblk_cnt);
+	vblk_cnt++;
+	hd->ops = &virtio_blk_ops;
+	hd->priv = vblk;
+	hd->my_channel = NULL;
+	hd->dev_no = 0;
+	printk(
+		"  disk %s info:\n   SECTORS: %d\n   CAPACITY: %dMB\n   QUEUE: %d slots\n",
+		hd->name, hd->sec_cnt, hd->sec_cnt / 2048, vblk->slot_cnt
+	);
+	disk_scan_partitions(hd);
+}
+
+/* 扫描 pci 总线上所有的 virtio-blk 设备 */
+void virtio_blk_init(void) {
+	pci_device pdev;
+	uint8_t found = 0, skip = 0;
+	while (vblk_cnt < VIRTIO_BLK_MAX_DISKS && pci_find(match_virtio_blk, (int)&skip, &pdev)) {
+		if (found == 0) {
+			printk("virtio_blk_init start\n");
+		}
+		skip = ++found;
+		virtio_blk* vblk = sys_malloc(sizeof(virtio_blk));
+		memset(vblk, 0, sizeof(virtio_blk));
+		vblk->pdev = pdev;
+		// legacy 设备的寄存器在 BAR0 的 io 空间中
+		vblk->io_base = pci_config_read(&pdev, PCI_BAR0) & 0xfffc;
+		pci_enable(&pdev, PCI_CMD_IO_SPACE | PCI_CMD_BUS_MASTER);
+		virtio_blk_probe(vblk);
+	}
+	if (found != 0) {
+		printk("virtio_blk_init done\n");
+	}
+}
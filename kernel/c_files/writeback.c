@@ -0,0 +1,75 @@
+#include "writeback.h"
+#include "file.h"
+#include "journal.h"
+#include "fs.h"
+#include "timer.h"
+#include "list.h"
+#include "debug.h"
+
+extern uint32_t ticks;
+
+/* 初始化分区 part 的脏文件链表 */
+void writeback_init(partition* part) {
+	list_init(&part->dirty_inodes);
+	part->dirty_cnt = 0;
+	list_init(&part->prealloc_windows);
+}
+
+/*
+写回分区 part 中延迟分配缓冲已经过期的文件，脏文件过多时也从最早变脏的开始写回，
+直到数量回到 WRITEBACK_DIRTY_MAX 以内；all 为 1 时写回全部
+*/
+void writeback_inodes(partition* part, bool all) {
+	/*
+	写回会修改 inode 和位图，与其他元数据操作互斥，持有期间被写回的 inode 也不会被关闭
+	每个文件的写回是一次单独的操作，由 journal_begin 各自在事务中预留空间
+	*/
+	while (1) {
+		journal_begin(part);
+		if (list_empty(&part->dirty_inodes)) {
+			journal_end(part);
+			break;
+		}
+		// 变脏时追加到队尾，所以队首是最早变脏的
+		inode_delay* d = elem2entry(inode_delay, dirty_tag, part->dirty_inodes.head.next);
+		if (
+			! all && part->dirty_cnt <= WRITEBACK_DIRTY_MAX
+			&& ticks - d->dirty_tick < MS2TICKS(WRITEBACK_EXPIRE)
+		) {
+			journal_end(part);
+			break;
+		}
+		// 写回后 d 会离开链表
+		delay_flush(part, d->owner);
+		journal_end(part);
+	}
+}
+
+/* 把分区 part 中所有还在内存里的数据和元数据写到磁盘上，并把超级块标记为干净 */
+void writeback_sync(partition* part) {
+	// 先逐个写回，持有日志锁后再写回期间新变脏的文件
+	writeback_inodes(part, 1);
+	journal_begin(part);
+	writeback_inodes(part, 1);
+	bitmap_flush(part);
+	// 持有日志锁期间不会有新的分配，此时日志中的位图和空闲计数一致，可以标记为干净
+	super_block_sync(part, FS_CLEAN);
+	journal_commit(part);
+	journal_end(part);
+	// 与 sys_fsync 一样，原地写入的文件数据不经过日志，提交为空时也要刷新写缓存
+	disk_flush(part->my_disk);
+}
+
+/*
+后台线程，定期写回分区 arg 中过期的文件数据和脏位图扇区，再提交日志，
+使写入在内存中完成，多个操作的修改也合并为一次提交
+*/
+void writeback_daemon(void* arg) {
+	partition* part = arg;
+	while (1) {
+		mtime_sleep(WRITEBACK_INTERVAL);
+		writeback_inodes(part, 0);
+		bitmap_flush(part);
+		journal_commit(part);
+	}
+}
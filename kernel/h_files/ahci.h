@@ -0,0 +1,17 @@
+#ifndef __KERNEL_AHCI_H
+#define __KERNEL_AHCI_H
+
+#include "ide.h"
+
+// 最多驱动的 sata 端口数，即 ahci 硬盘数
+#define AHCI_MAX_PORTS 4
+// 每个端口的命令槽数，也是 NCQ 的最大队列深度
+#define AHCI_MAX_SLOTS 32
+// 一条命令最多读写的扇区数，即 64KB
+#define AHCI_MAX_SECTS_PER_CMD 128
+// 一个请求最多同时占用的命令槽数，剩余的部分在它自己的槽完成后继续发出
+#define AHCI_SLOTS_PER_REQ 8
+
+void ahci_init(void);
+
+#endif
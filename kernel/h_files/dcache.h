@@ -0,0 +1,40 @@
+#ifndef __DCACHE_H
+#define __DCACHE_H
+
+#include "dir.h"
+#include "ide.h"
+#include "list.h"
+#include "stdint.h"
+
+// 目录项缓存的容量
+#define DCACHE_ENTRYS 256
+// 哈希桶数
+#define DCACHE_BUCKETS 64
+
+/*
+目录项缓存中的一项，以 (分区, 父目录 inode 号, 文件名) 为键
+f_type 为 FT_UNKNOWN 时是负缓存，表示该目录下确定没有这个名字
+*/
+typedef struct {
+	partition* part;
+	uint32_t parent_ino;
+	char name[MAX_FILE_NAME_LEN];
+	uint32_t i_no;
+	file_types f_type;
+	// 用于加入哈希桶
+	struct list_elem hash_tag;
+	// 用于加入 LRU 链表，队首是最近使用的
+	struct list_elem lru_tag;
+} dentry;
+
+void dcache_init(void);
+bool dcache_lookup(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e);
+void dcache_insert(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e);
+void dcache_dir_begin(partition* part, uint32_t parent_ino);
+void dcache_dir_end(partition* part, uint32_t parent_ino);
+uint32_t dcache_version(partition* part, uint32_t parent_ino);
+void dcache_fill(partition* part, uint32_t parent_ino, const char* name, dir_entry* dir_e, uint32_t ver);
+void dcache_invalidate(partition* part, uint32_t parent_ino, const char* name);
+void dcache_invalidate_dir(partition* part, uint32_t parent_ino);
+
+#endif
@@ -15,6 +15,13 @@ typedef struct __dir {
 	uint32_t dir_pos;
 	// 目录的数据缓存
 	uint8_t dir_buf[512];
+	/*
+	空闲位置提示：search_dir_entry 未找到目录项时，记下途中见到的有空位的逻辑块号加 1，
+	紧随其后的 sync_dir_entry 会先尝试这个块，0 表示没有提示
+	*/
+	uint32_t free_hint;
+	// free_hint 对应的文件名哈希，索引目录中只有同一个哈希桶的块才能使用该提示
+	uint32_t free_hint_hash;
 } dir;
 
 /* 目录项结构 */
@@ -24,7 +31,42 @@ typedef struct {
 	file_types f_type;
 } dir_entry;
 
-void open_root_dir(partition* part);
+// 每块能容纳的目录项数，剩下的 8 字节作为 dir_leaf_tail
+#define DIR_ENTRYS_PER_BLOCK (BLOCK_SIZE / sizeof(dir_entry))
+// 索引块是一张 uint16_t 的哈希表，每项为哈希桶对应叶子块的逻辑块号
+#define DIR_INDEX_BUCKETS (BLOCK_SIZE / sizeof(uint16_t))
+// 线性目录的块数超过该值后转换为索引目录
+#define DIR_INDEX_THRESHOLD 4
+// 索引头在第 0 块中的位置，前两项是 . 和 ..
+#define DIR_INDEX_HEAD_SLOT 2
+
+/*
+索引目录的头，占据第 0 块中的第 DIR_INDEX_HEAD_SLOT 项，与目录项大小相同
+zero 和 f_type 总为 0，因此按名字查找和 dir_read 都不会把它当作目录项
+*/
+typedef struct {
+	char zero;
+	char magic[3];
+	// 哈希表所在的逻辑块号
+	uint32_t index_block;
+	// 下一个可以用作叶子的逻辑块号，在它之前的块都已经被使用
+	uint32_t leaf_next;
+	uint32_t reserved[2];
+	file_types f_type;
+} dir_index_head;
+
+/*
+索引目录中叶子块末尾的 8 字节，线性目录中这部分总为 0
+一个叶子负责哈希桶 [bucket_lo, bucket_lo + bucket_cnt)，
+只负责一个桶的叶子写满后通过 next 串起溢出链
+*/
+typedef struct {
+	uint16_t bucket_lo;
+	uint16_t bucket_cnt;
+	// 溢出链中下一个叶子的逻辑块号，0 表示没有
+	uint32_t next;
+} dir_leaf_tail;
+
 dir* dir_open(partition* part, uint32_t inode_no);
 bool search_dir_entry(partition* part, dir* pdir, const char* name, dir_entry* dir_e);
 void dir_close(dir* dir);
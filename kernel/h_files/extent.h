@@ -0,0 +1,34 @@
+#ifndef __EXTENT_H
+#define __EXTENT_H
+
+#include "inode.h"
+#include "fs.h"
+#include "stdint.h"
+
+// 每个树块中的项数，8 字节的头部加上 42 项刚好 512 字节
+#define EXTENTS_PER_BLOCK ((BLOCK_SIZE - 8) / sizeof(extent))
+// extent 树的最大深度，4*42*42*42 项足以容纳任何文件
+#define EXTENT_MAX_DEPTH 3
+
+/*
+extent 树块，深度为 0 的是叶子，存放数据的 extent
+否则存放索引，索引的 ee_block 为子树中最小的逻辑块号，ee_start 为子树块的扇区地址
+*/
+typedef struct {
+	uint16_t eh_cnt;
+	uint16_t eh_depth;
+	uint32_t eh_reserved;
+	extent entries[EXTENTS_PER_BLOCK];
+} __attribute__((packed)) extent_block;
+
+void extent_init(inode* inode);
+
+uint32_t extent_map(partition* part, inode* inode, uint32_t lblock, uint32_t* run_len);
+
+int32_t extent_alloc(partition* part, inode* inode, uint32_t lblock, uint32_t cnt);
+
+int32_t extent_add(partition* part, inode* inode, uint32_t lblock, uint32_t block_lba, uint32_t cnt);
+
+void extent_release(partition* part, inode* inode);
+
+#endif
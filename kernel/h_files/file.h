@@ -4,6 +4,7 @@
 #include "stdint.h"
 #include "inode.h"
 #include "dir.h"
+#include "thread.h"
 
 /* 文件结构 */
 typedef struct {
@@ -11,6 +12,8 @@ typedef struct {
 	uint32_t fd_pos;
 	uint32_t fd_flag;
 	inode* fd_inode;
+	// 引用这一项的文件描述符数，fork 后父子进程共享同一项
+	uint32_t fd_refs;
 } file;
 
 /* 标准输入输出描述符 */
@@ -26,18 +29,71 @@ typedef enum {
 	BLOCK_BITMAP
 } bitmap_type;
 
-// TODO: 为什么要把它限制在 32
-#define MAX_FILE_OPEN 32
+// 延迟分配缓冲的块数
+#define DELAY_BUF_BLOCKS 16
+// 预分配窗口的初始块数和上限，文件每用完一个窗口，下一个窗口翻倍
+#define PREALLOC_MIN_BLOCKS 8
+#define PREALLOC_MAX_BLOCKS 256
 
+/*
+inode 的延迟分配状态
+追加写入的数据先放在 buf 中，写回时才为它们分配物理块，这样可以一次分配一整段连续的块；
+预分配窗口是为持续增长的文件预先在块位图中分配的一段连续块，
+使交替追加的多个文件各自连续，而不是在磁盘上互相穿插；
+窗口只是内存中的预留，写入日志的位图和超级块里这些块仍是空闲的，崩溃后不会丢失
+*/
+typedef struct __inode_delay {
+	// 缓冲中是否有尚未写回的数据
+	bool dirty;
+	// 所属的 inode
+	inode* owner;
+	// 变脏时的 ticks，以及变脏后用于加入分区的 dirty_inodes 链表
+	uint32_t dirty_tick;
+	struct list_elem dirty_tag;
+	// 缓冲中第一块对应的逻辑块号，缓冲覆盖从这一块直到文件末尾
+	uint32_t first_block;
+	// 预分配窗口的起始扇区地址和剩余块数
+	uint32_t pa_start;
+	uint32_t pa_len;
+	// 窗口中有剩余的块时用于加入分区的 prealloc_windows 链表
+	struct list_elem pa_tag;
+	// 下一个预分配窗口的块数
+	uint32_t pa_window;
+	uint8_t buf[DELAY_BUF_BLOCKS * BLOCK_SIZE];
+} inode_delay;
+
+// 全局文件表每次增长的项数
+#define FILE_TABLE_CHUNK 32
+// 全局文件表最多的块数
+#define FILE_TABLE_CHUNKS 32
+// 系统中最多同时打开的文件数
+#define MAX_FILE_OPEN (FILE_TABLE_CHUNK * FILE_TABLE_CHUNKS)
+
+void file_table_init(void);
+file* file_get(uint32_t global_fd);
 int32_t get_free_slot_in_global(void);
+void put_free_slot_in_global(uint32_t global_fd);
 int32_t pcb_fd_install(int32_t globa_fd_idx);
-int32_t inode_bitmap_alloc(partition* part);
-int32_t block_bitmap_alloc(partition* part);
-void bitmap_sync(partition* part, uint32_t bit_idx, bitmap_type btmp);
+int32_t fd_table_copy(task_struct* child_thread, task_struct* parent_thread);
+int32_t inode_bitmap_alloc(partition* part, uint32_t goal_group);
+void inode_bitmap_free(partition* part, uint32_t inode_no);
+void bitmap_load(partition* part, bitmap_type type, uint32_t bit_idx, uint32_t cnt);
+uint32_t block_group_goal(partition* part, uint32_t inode_no);
+int32_t block_bitmap_alloc(partition* part, uint32_t goal);
+int32_t block_bitmap_alloc_run(partition* part, uint32_t goal, uint32_t max_cnt, uint32_t* cnt);
+void block_bitmap_free_run(partition* part, uint32_t block_lba, uint32_t cnt);
+void bitmap_mark_dirty(partition* part, uint32_t bit_idx, bitmap_type btmp);
+void bitmap_flush(partition* part);
+void prealloc_unreserve_counts(partition* part, struct super_block* sb);
+void delay_flush(partition* part, inode* in);
+void delay_release(partition* part, inode* in, bool discard);
 int32_t file_create(dir* parent_dir, char* filename, uint8_t flag);
-int32_t file_open(uint32_t inode_no, uint8_t flag);
+int32_t file_open(partition* part, uint32_t inode_no, uint8_t flag);
 int32_t file_close(file* file);
+uint32_t file_append_lock(inode* in, range_lock* range);
+int32_t file_append(file* file, const void* buf, uint32_t count);
 int32_t file_write(file* file, const void*buf, uint32_t count);
+int32_t file_overwrite(file* file, const void* buf, uint32_t count);
 int32_t file_read(file* file, void* buf, uint32_t count);
 
 #endif
\ No newline at end of file
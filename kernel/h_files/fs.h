@@ -2,20 +2,32 @@
 #define __FS_H
 
 #include "stdint.h"
+#include "ide.h"
 
 // 前向引用
 typedef struct __dir  dir;
 
-// 每个分区所支持的最大创建文件的数量
-#define MAX_FILES_PER_PART 4096
+// 每个分区的 inode 数按分区大小计算，每 SECTORS_PER_INODE 个扇区一个 inode
+#define SECTORS_PER_INODE 16
+// 每个分区 inode 数的下限和上限
+#define MIN_FILES_PER_PART 4096
+#define MAX_FILES_PER_PART 65536
+// 格式化时写入元信息所用缓冲区的扇区数
+#define FORMAT_BUF_SECTS 64
 // 每扇区的位数
 #define BITS_PER_SECTOR 4096
 // 扇区字节大小
 #define SECTOR_SIZE 512
 // 块字节大小
 #define BLOCK_SIZE SECTOR_SIZE
+// copy_file_range 每批搬运的扇区数
+#define COPY_CHUNK_SECTS 16
 // 路径最大长度
 #define MAX_PATH_LEN 512
+// 挂载表的最大项数
+#define MAX_MOUNTS 8
+// 挂载点路径的最大长度，除 "/" 外的挂载点都是根目录下以分区名命名的一级路径
+#define MAX_MOUNT_PATH_LEN 12
 
 typedef enum {
 	// 不支持的文件类型
@@ -48,6 +60,25 @@ typedef enum {
 	SEEK_END
 } whence;
 
+// readv 和 writev 一次最多处理的缓冲区数
+#define IOV_MAX 16
+
+/* readv 和 writev 使用的缓冲区描述 */
+typedef struct {
+	void* iov_base;
+	uint32_t iov_len;
+} iovec;
+
+/* statfs 返回的文件系统信息，块数和 inode 数都只算数据区和 inode 数组 */
+typedef struct {
+	// 块大小，单位为字节
+	uint32_t f_bsize;
+	uint32_t f_blocks;
+	uint32_t f_bfree;
+	uint32_t f_files;
+	uint32_t f_ffree;
+} fs_stat;
+
 /* 用来记录查找文件过程中已找到的上级路径，也就是查找文件过程中“走过的地方” */
 typedef struct {
 	// 查找过程中的父路径，如果文件不存在的话可通过此值来判断是路径的哪个部分不存在
@@ -58,13 +89,36 @@ typedef struct {
 	file_types file_type;
 } path_search_record;
 
+/*
+挂载表中的一项，把分区 part 挂载在路径 path 上
+超级块、位图、inode 缓存、日志和写回线程都属于各自的分区，不同挂载点上的读写互不等待
+*/
+typedef struct {
+	char path[MAX_MOUNT_PATH_LEN];
+	partition* part;
+	// 挂载期间一直打开着的根目录
+	dir* root;
+} mount_point;
+
 int32_t sys_open(const char* pathname, uint8_t flags);
+uint32_t fd_local2global(uint32_t local_fd);
 uint32_t path_depth_cnt(char* pathname);
 void filesys_init();
 int32_t sys_close(int32_t fd);
 int32_t sys_write(int32_t fd, const void* buf, uint32_t count);
 int32_t sys_read(int32_t fd, void* buf, uint32_t count);
 int32_t sys_lseek(int32_t fd, int32_t offset, uint8_t whence);
+int32_t sys_pread(int32_t fd, void* buf, uint32_t count, uint32_t offset);
+int32_t sys_pwrite(int32_t fd, const void* buf, uint32_t count, uint32_t offset);
+int32_t sys_readv(int32_t fd, const iovec* iov, uint32_t iovcnt);
+int32_t sys_writev(int32_t fd, const iovec* iov, uint32_t iovcnt);
+int32_t sys_copy_file_range(int32_t fd_in, int32_t fd_out, uint32_t count);
+int32_t sys_fsync(int32_t fd);
+void sys_sync(void);
+int32_t sys_statfs(const char* path, fs_stat* buf);
+void super_block_sync(partition* part, uint32_t state);
+bool is_mount_root(dir* d);
+dir* mount_root_dir(const char* path);
 dir* sys_opendir(const char* name);
 int32_t sys_closedir(dir* d);
 int32_t sys_unlink(const char* pathname);
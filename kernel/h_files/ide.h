@@ -10,6 +10,40 @@
 
 typedef struct __disk disk;
 typedef struct __ide_channel ide_channel;
+typedef struct __inode_cache inode_cache;
+typedef struct __journal journal;
+
+/* 一次硬盘读写请求 */
+typedef struct {
+	disk* hd;
+	// 起始扇区
+	uint32_t lba;
+	void* buf;
+	// 要读写的扇区数
+	uint32_t sec_cnt;
+	// 为 1 表示写硬盘，为 0 表示读硬盘
+	bool is_write;
+
+	/* 下面的内容由驱动程序使用 */
+	// 已经完成的扇区数
+	uint32_t secs_done;
+	// 当前这条命令所操作的扇区数
+	uint32_t secs_op;
+	// 当前这条命令发出时的时间戳，用于统计延迟
+	uint32_t start_cycles;
+} disk_req;
+
+/*
+硬盘驱动提供的操作，不同的驱动通过它挂接到同一个 disk 结构上
+submit 只负责发出请求，wait 等待请求全部完成，
+这样调用者可以先向多块硬盘发出请求，再逐个等待，让它们并行工作；
+flush 把已经完成的写从硬盘的写缓存落到盘片上，没有写缓存的驱动可以为 NULL
+*/
+typedef struct {
+	void (*submit)(disk_req* req);
+	void (*wait)(disk_req* req);
+	void (*flush)(disk* hd);
+} disk_ops;
 
 /* 分区结构 */
 typedef struct {
@@ -20,6 +54,8 @@ typedef struct {
 	uint32_t sec_cnt;
 	// 分区所属的硬盘
 	disk* my_disk;
+	// 分区表中记录的分区类型
+	uint8_t fs_type;
 	// 用于队列中的标记
 	struct list_elem part_tag;
 	// 分区名称
@@ -32,24 +68,64 @@ typedef struct {
 	bitmap block_bitmap;
 	// i结点位图
 	bitmap inode_bitmap;
-	// 本分区打开的i结点队列
-	struct list open_inodes;
+	// 两个位图中被修改过、尚未写回的扇区，每个扇区对应一位
+	bitmap block_bitmap_dirty;
+	bitmap inode_bitmap_dirty;
+	// 两个位图中已经从磁盘读入的扇区，挂载时位图按扇区在第一次使用时才读入
+	bitmap block_bitmap_loaded;
+	bitmap inode_bitmap_loaded;
+	// 读入位图扇区时持有
+	lock bitmap_load_lock;
+	// 写回位图时持有，保证 bitmap_flush 返回时之前的修改都已进入日志
+	lock bitmap_flush_lock;
+	// 本分区的元数据日志
+	journal* jnl;
+	// 本分区的 inode 缓存，包括打开的和最近关闭的 inode
+	inode_cache* icache;
+	// 延迟分配缓冲中有数据的文件，按变脏的先后排列，由写回线程定期写回
+	struct list dirty_inodes;
+	uint32_t dirty_cnt;
+	// 有剩余块的预分配窗口，写位图和超级块时要把这些块当作空闲的
+	struct list prealloc_windows;
 } partition;
 
 /* 硬盘结构 */
 typedef struct __disk {
 	// 硬盘的名称
 	char name[8];
-	// 此块硬盘归属于哪个 ide 通道
+	// 驱动此硬盘的操作
+	disk_ops* ops;
+	// 硬盘的扇区数，由 identify 等方式得到
+	uint32_t sec_cnt;
+	// 驱动程序的私有数据
+	void* priv;
+	// 此块硬盘归属于哪个 ide 通道，不是 ide 硬盘则为 NULL
 	ide_channel* my_channel;
 	// 本硬盘是主/从(0/1)
 	uint8_t dev_no;
+	// ide 硬盘是否支持 48 位 lba
+	bool lba48;
 	// 主分区项最多 4 个
 	partition prim_parts[4];
 	// 当前支持 8 个逻辑分区
 	partition logic_parts[8];
 } disk;
 
+// 单扇区读延迟直方图的桶数，第 i 个桶统计耗时在 [2^(i-1), 2^i) * 4096 个时钟周期内的读操作
+#define IDE_LAT_BUCKETS 16
+
+/* 硬盘命令完成方式及延迟的统计信息 */
+typedef struct {
+	// 在自旋阶段就等到完成的命令数
+	uint32_t spin_done;
+	// 睡眠等待中断才完成的命令数
+	uint32_t intr_done;
+	// 等待超时的命令数
+	uint32_t timeouts;
+	// 单扇区读的延迟直方图
+	uint32_t read_lat_hist[IDE_LAT_BUCKETS];
+} ide_stats;
+
 /* ata 通道结构 */
 typedef struct __ide_channel {
 	// 通道的名称
@@ -70,12 +146,28 @@ typedef struct __ide_channel {
 	semaphore disk_done;
 	// 一个通道上连接两个硬盘，一主一从
 	disk devices[2];
+	// 本通道上命令的完成统计
+	ide_stats stats;
 } ide_channel;
 
 void ide_init();
 
+void ide_print_stats();
+
+void disk_scan_partitions(disk* hd);
+
+void disk_print_partitions();
+
 void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 
 void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 
+void disk_req_init(disk_req* req, disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write);
+
+void disk_submit(disk_req* req);
+
+void disk_wait(disk_req* req);
+
+void disk_flush(disk* hd);
+
 #endif
\ No newline at end of file
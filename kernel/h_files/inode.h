@@ -5,7 +5,46 @@
 #include "list.h"
 #include "stdint.h"
 
-/* inode 结构 */
+/* 一段连续的块映射，文件的第 ee_block 块起的 ee_len 块依次存放在从 ee_start 开始的扇区中 */
+typedef struct {
+	uint32_t ee_block;
+	uint32_t ee_start;
+	uint32_t ee_len;
+} __attribute__((packed)) extent;
+
+// 延迟分配的状态，见 file.h
+typedef struct __inode_delay inode_delay;
+
+// inode 中内联的 extent 数，也就是 extent 树根节点的项数上限
+#define INODE_EXTENTS 4
+
+// i_flags 中的位：文件的数据直接存放在 i_inline 中，此时 i_extent_cnt 为 0
+#define INODE_INLINE 1
+/*
+内联数据的最大字节数，与 extent 树根节点共用磁盘 inode 头部之后的空间：
+64 字节的磁盘 inode 去掉 8 字节的头部 (i_size、i_flags、i_extent_depth、i_extent_cnt)，
+所以只有不超过 56 字节的文件是内联的，更大的文件即使只多一个字节也要占用一个数据块
+*/
+#define INODE_INLINE_SIZE 56
+
+/*
+磁盘上的 inode，64 字节，每个扇区正好放下 INODES_PER_SECTOR 个，不会跨扇区
+inode 号由它在 inode 数组中的位置决定，打开次数、链表等只存在于内存中的 inode 里
+*/
+typedef struct {
+	uint32_t i_size;
+	uint8_t i_flags;
+	uint8_t i_extent_depth;
+	uint16_t i_extent_cnt;
+	union {
+		extent i_extents[INODE_EXTENTS];
+		uint8_t i_inline[INODE_INLINE_SIZE];
+	};
+} __attribute__((packed)) disk_inode;
+
+#define INODES_PER_SECTOR (512 / sizeof(disk_inode))
+
+/* 内存中的 inode 结构，前面的字段从磁盘 inode 中读入 */
 typedef struct {
 	// inode 编号
 	uint32_t i_no;
@@ -17,18 +56,75 @@ typedef struct {
 	uint32_t i_size;
 	// 记录此文件被打开的次数
 	uint32_t i_open_cnts;
-	// TODO: 写文件不能并行，此标记用于供准备写文件的进程检查（为什么不加锁？）
-	bool write_deny;
-	// 下标 0-11 为直接块，12 存储一级间接块指针，共支持 128 个间接块，因此单文件总大小限制在 70K
-	uint32_t i_sectors[13];
-	// 用于加入 "已打开的 inode 列表"，该列表做缓存用，避免多次读盘
+	// inode 的标志
+	uint8_t i_flags;
+	// extent 树根节点中的项数
+	uint16_t i_extent_cnt;
+	// extent 树的深度，为 0 时下面存放的就是数据的 extent，否则是指向下一层树块的索引
+	uint16_t i_extent_depth;
+	// extent 树的根节点，内联的文件则是文件的数据
+	union {
+		extent i_extents[INODE_EXTENTS];
+		uint8_t i_inline[INODE_INLINE_SIZE];
+	};
+	// 用于加入 inode 缓存的哈希桶，避免多次读盘
 	struct list_elem inode_tag;
+	// 打开次数降为 0 后用于加入 inode 缓存的 LRU 链表
+	struct list_elem lru_tag;
+	// inode 所在的分区
+	partition* i_part;
+	// 追加写入的延迟分配缓冲和预分配窗口，第一次写入时才创建
+	inode_delay* i_delay;
+	/*
+	保护文件大小、extent 树和延迟分配状态，读和覆盖写持有读锁，追加写和写回修改它们时持有写锁
+	持有读锁的任务之间再由字节范围锁互斥，追加的写者锁住文件末尾之后的范围，写数据时只持有读锁
+	*/
+	rwlock i_rwlock;
+	// 已经加锁的字节范围和等待它们的任务
+	struct list i_ranges;
+	struct list i_range_waiters;
 } inode;
 
+/* 文件中被锁住的字节范围 [start, end)，两端都对齐到扇区，由加锁的任务提供，通常在它的栈上 */
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+	// 为 1 时与所有重叠的范围互斥，为 0 时只与重叠的独占范围互斥
+	bool exclusive;
+	// 用于加入 inode 的 i_ranges 链表
+	struct list_elem tag;
+} range_lock;
+
+// inode 缓存的哈希桶数
+#define INODE_HASH_BUCKETS 64
+// 关闭后仍保留在缓存中的 inode 数上限
+#define INODE_LRU_MAX 64
+
+/*
+每个分区的 inode 缓存，按 inode 号散列到哈希桶中
+桶锁保证同一个桶中的 inode 只被读盘一次，读盘时不会阻塞其他桶；
+链表本身只在关中断时短暂修改
+*/
+typedef struct __inode_cache {
+	struct list buckets[INODE_HASH_BUCKETS];
+	lock bucket_locks[INODE_HASH_BUCKETS];
+	// 打开次数为 0 的 inode，队首是最近关闭的
+	struct list lru;
+	uint32_t lru_cnt;
+} inode_cache;
+
+void inode_cache_init(partition* part);
+inode* inode_alloc(void);
+void inode_free(inode* in);
+void inode_cache_add(partition* part, inode* in);
 void inode_sync(partition* part, inode* in, void* io_buf);
 inode* inode_open(partition* part, uint32_t inode_no);
-void inode_close(inode* inode);
+void inode_close(inode* in);
+bool inode_is_open(partition* part, uint32_t inode_no);
 void inode_init(uint32_t inode_no, inode* new_inode);
 void inode_release(partition* part, uint32_t inode_no);
+void inode_table_migrate(partition* part);
+void inode_range_lock(inode* in, range_lock* range, uint32_t start, uint32_t cnt, bool exclusive);
+void inode_range_unlock(inode* in, range_lock* range);
 
 #endif
\ No newline at end of file
@@ -17,5 +17,7 @@ intr_status intr_enable();
 intr_status intr_disable();
 
 void register_handler(uint8_t, intr_handler);
+void general_intr_handler(uint8_t vec_nr);
+void pic_enable_irq(uint8_t irq);
 
 #endif
\ No newline at end of file
@@ -45,4 +45,36 @@ static inline void insw(uint16_t port, void* addr, uint32_t word_cnt) {
 	);
 }
 
+/**
+ * 向端口 port 写入一个字的 data
+ */
+static inline void outw(uint16_t port, uint16_t data) {
+	__asm__ volatile ("outw %w0, %w1": : "a"(data), "Nd"(port));
+}
+
+/**
+ * 从端口 port 读入的一个字返回
+ */
+static inline uint16_t inw(uint16_t port) {
+	uint16_t data;
+	__asm__ volatile ("inw %w1, %w0": "=a"(data): "Nd"(port));
+	return data;
+}
+
+/**
+ * 向端口 port 写入一个双字的 data
+ */
+static inline void outl(uint16_t port, uint32_t data) {
+	__asm__ volatile ("outl %0, %w1": : "a"(data), "Nd"(port));
+}
+
+/**
+ * 从端口 port 读入的一个双字返回
+ */
+static inline uint32_t inl(uint16_t port) {
+	uint32_t data;
+	__asm__ volatile ("inl %w1, %0": "=a"(data): "Nd"(port));
+	return data;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+#ifndef __JOURNAL_H
+#define __JOURNAL_H
+
+#include "ide.h"
+#include "fs.h"
+#include "sync.h"
+#include "stdint.h"
+
+// 日志区的扇区数，格式化时保留在 inode 数组之后
+#define JOURNAL_SECTS 128
+// 一个事务最多包含的元数据扇区数，加上描述块和提交块不能超过日志区，也不能超过描述块能记录的地址数
+#define JOURNAL_TX_SECTS 124
+/*
+为一次完整的元数据操作预留的扇区数，最外层的 journal_begin 发现事务剩余的空间不够时先提交，
+使操作不会被拆到两个事务中；大文件的删除等操作还要加上它修改的位图扇区，可能超出预留
+*/
+#define JOURNAL_OP_SECTS 60
+
+#define JOURNAL_DESC_MAGIC   0x4c4e524a // "JRNL"
+#define JOURNAL_COMMIT_MAGIC 0x544d434a // "JCMT"
+
+/*
+日志区的格式：描述块，事务中的各元数据扇区，提交块
+描述块和提交块都使用这个结构，提交块中的 lbas 不使用
+*/
+typedef struct {
+	uint32_t magic;
+	// 事务序号
+	uint32_t seq;
+	// 事务中的扇区数
+	uint32_t cnt;
+	// 事务中所有扇区内容的校验和，用于发现没有写完整的事务
+	uint32_t checksum;
+	// 各扇区在分区中的地址
+	uint32_t lbas[(SECTOR_SIZE - 16) / sizeof(uint32_t)];
+} __attribute__((packed)) journal_header;
+
+/*
+分区的元数据日志
+元数据的修改先在内存中的事务里合并，由后台线程定期成批提交到日志区，再写回原位置；
+挂载时重放日志区中最后一个完整的事务
+*/
+typedef struct __journal {
+	// 保护运行中的事务，一次完整的元数据操作也持有它，使提交不会把操作拆开
+	lock lock;
+	// 运行中的事务的序号
+	uint32_t seq;
+	// 运行中的事务包含的扇区数及它们的扇区地址
+	uint32_t cnt;
+	uint32_t lbas[JOURNAL_TX_SECTS];
+	/*
+	第 0 个扇区是描述块，之后依次是各元数据扇区的最新内容，
+	这样提交时可以一次写入日志区，最后一个扇区用于提交块
+	*/
+	uint8_t* buf;
+} journal;
+
+void journal_init(partition* part);
+void journal_begin(partition* part);
+void journal_end(partition* part);
+void journal_read(partition* part, uint32_t lba, void* buf, uint32_t sec_cnt);
+void journal_write(partition* part, uint32_t lba, const void* buf, uint32_t sec_cnt);
+void journal_forget(partition* part, uint32_t lba, uint32_t sec_cnt);
+void journal_commit(partition* part);
+
+#endif
@@ -12,6 +12,9 @@
 #define PG_RW_W 2 // R/W 属性位，此处表示读/写/执行
 #define PG_US_S 0 // U/S 属性位，此处表示系统级，仅允许 0～2 特权级访问
 #define PG_US_U 4 // U/S 属性位，此处表示用户级
+#define PG_PWT  8 // 页级写穿透，用于设备内存
+#define PG_PCD  16 // 页级禁止缓存，用于设备内存
+#define PG_D    64 // 脏位，页被写过时由处理器置 1
 
 /* 内存池标记，用于判断是哪个内存池 */
 typedef enum {
@@ -64,6 +67,10 @@ void* get_kernel_pages(uint32_t);
 
 uint32_t addr_v2p(uint32_t vaddr);
 
+bool page_present(uint32_t vaddr);
+
+void page_prefault(const void* vaddr, uint32_t bytes);
+
 void* get_a_page(pool_flags pf, uint32_t vaddr);
 
 void block_desc_init(mem_block_desc* desc_array);
@@ -76,4 +83,18 @@ void* get_a_page_without_opvaddrbitmap(pool_flags pf, uint32_t vaddr);
 
 void mfree_page(pool_flags pf, void* _vaddr, uint32_t pg_cnt);
 
+void* get_kernel_pages_contiguous(uint32_t pg_cnt);
+
+void* map_mmio(uint32_t phy_addr, uint32_t size);
+
+void* vaddr_get(pool_flags pf, uint32_t pg_cnt);
+
+void vaddr_remove(pool_flags pf, void* _vaddr, uint32_t pg_cnt);
+
+void pfree(uint32_t pg_phy_addr);
+
+void page_map(uint32_t vaddr, uint32_t page_phyaddr, bool writable);
+
+uint32_t page_unmap(uint32_t vaddr);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef __MMAP_H
+#define __MMAP_H
+
+#include "stdint.h"
+#include "inode.h"
+#include "list.h"
+
+// 映射区域的访问权限
+#define PROT_READ  1
+#define PROT_WRITE 2
+
+// 共享映射的修改在解除映射时写回文件，私有映射的修改只属于当前进程
+#define MAP_SHARED  1
+#define MAP_PRIVATE 2
+
+/* mmap 的参数，系统调用最多只能传 3 个参数，因此打包后传它的地址 */
+typedef struct {
+	uint32_t length;
+	uint8_t prot;
+	uint8_t flags;
+	int32_t fd;
+	// 文件中的起始偏移量，必须按页对齐
+	uint32_t offset;
+} mmap_args;
+
+/*
+进程中的一段文件映射区域
+区域中的页在第一次访问时由缺页异常处理程序读入，共享映射直接映射页缓存中的页，
+私有映射则复制一份到用户内存池中
+*/
+typedef struct {
+	uint32_t vm_start;
+	uint32_t vm_pg_cnt;
+	// 映射期间一直持有的 inode 引用
+	inode* vm_inode;
+	// vm_start 对应的文件页号
+	uint32_t vm_pg_off;
+	uint8_t vm_prot;
+	uint8_t vm_flags;
+	// 用于加入进程的 vm_areas 链表
+	struct list_elem vm_tag;
+} vm_area;
+
+void mmap_init(void);
+void* sys_mmap(mmap_args* args);
+int32_t sys_munmap(void* addr, uint32_t length);
+
+#endif
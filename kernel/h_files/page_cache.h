@@ -0,0 +1,42 @@
+#ifndef __PAGE_CACHE_H
+#define __PAGE_CACHE_H
+
+#include "inode.h"
+#include "ide.h"
+#include "list.h"
+#include "stdint.h"
+
+// 页缓存最多占用的内核页数
+#define PAGE_CACHE_PAGES 128
+// 哈希桶数
+#define PAGE_CACHE_BUCKETS 64
+
+/*
+页缓存中的一页，以 (分区, inode 号, 文件中的页号) 为键
+被映射到用户空间的页有引用计数，引用计数为 0 的页才在 LRU 链表中，可以被淘汰
+*/
+typedef struct {
+	partition* part;
+	uint32_t i_no;
+	uint32_t pg_idx;
+	// 缓存内容所在的内核页
+	uint8_t* kaddr;
+	uint32_t ref_cnt;
+	// 内容是否比文件中的新，共享映射被写过的页在解除映射时置位
+	bool dirty;
+	// 正在从文件读入，读入时不持有 page_cache_lock，其他查找到它的任务要等它读完
+	bool loading;
+	// 用于加入哈希桶
+	struct list_elem hash_tag;
+	// 引用计数为 0 时用于加入 LRU 链表，队首是最近使用的
+	struct list_elem lru_tag;
+} cache_page;
+
+void page_cache_init(void);
+void* page_cache_get(inode* in, uint32_t pg_idx);
+void page_cache_put(inode* in, uint32_t pg_idx, bool dirty);
+void page_cache_flush(inode* in);
+void page_cache_update(inode* in, uint32_t pos, const void* buf, uint32_t count);
+void page_cache_drop(partition* part, uint32_t inode_no);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __KERNEL_PCI_H
+#define __KERNEL_PCI_H
+
+#include "stdint.h"
+#include "global.h"
+
+/* pci 配置空间中的一些寄存器偏移 */
+#define PCI_VENDOR_ID      0x00
+#define PCI_COMMAND        0x04
+#define PCI_CLASS_REVISION 0x08
+#define PCI_HEADER_TYPE    0x0c
+#define PCI_BAR0           0x10
+#define PCI_BAR5           0x24
+#define PCI_INTERRUPT_LINE 0x3c
+
+/* command 寄存器的一些关键位 */
+#define PCI_CMD_IO_SPACE   0x1
+#define PCI_CMD_MEM_SPACE  0x2
+#define PCI_CMD_BUS_MASTER 0x4
+
+/* 一个 pci 功能的位置及基本信息 */
+typedef struct {
+	uint8_t bus;
+	uint8_t dev;
+	uint8_t func;
+	uint16_t vendor_id;
+	uint16_t device_id;
+	uint8_t class_code;
+	uint8_t subclass;
+	uint8_t prog_if;
+	// BIOS 分配的中断号
+	uint8_t irq_line;
+} pci_device;
+
+uint32_t pci_config_read(pci_device* pdev, uint8_t offset);
+
+void pci_config_write(pci_device* pdev, uint8_t offset, uint32_t value);
+
+bool pci_find(bool (*match)(pci_device* pdev, int arg), int arg, pci_device* found);
+
+void pci_enable(pci_device* pdev, uint16_t cmd_bits);
+
+void pci_register_irq(uint8_t irq, void (*handler)(void* arg), void* arg);
+
+#endif
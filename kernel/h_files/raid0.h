@@ -0,0 +1,16 @@
+#ifndef __RAID0_H
+#define __RAID0_H
+
+#include "ide.h"
+
+// 分区表中 raid 成员分区的类型
+#define RAID_PART_TYPE 0xfd
+// 条带卷最多支持的成员分区数
+#define RAID0_MAX_MEMBERS 4
+// 每个条带块的扇区数为 2 的 RAID0_CHUNK_SHIFT 次方
+#define RAID0_CHUNK_SHIFT 4
+#define RAID0_CHUNK_SECTS (1 << RAID0_CHUNK_SHIFT)
+
+void raid0_init(void);
+
+#endif
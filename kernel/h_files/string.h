@@ -7,6 +7,8 @@ void memset(void*, uint8_t, uint32_t);
 
 void memcpy(void*, const void*, uint32_t);
 
+void memmove(void*, const void*, uint32_t);
+
 int memcmp(const void*, const void*, uint32_t);
 
 char* strcpy(char*, const char*);
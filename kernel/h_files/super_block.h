@@ -3,6 +3,36 @@
 
 #include "stdint.h"
 
+// 文件系统的标识，磁盘格式不兼容地改变时随之修改，使旧格式的分区被重新格式化
+#define FS_MAGIC (*((uint32_t*) "iLe7"))
+/*
+磁盘格式的版本，能够在挂载时转换的格式改变只增加版本号
+版本 0：磁盘 inode 与内存中的 inode 相同，92 字节
+版本 1：64 字节的磁盘 inode，见 inode_table_migrate
+版本 2：分区划分为分配组，各组的空闲计数和 inode 数组初始化进度记录在超级块中
+*/
+#define FS_VERSION 2
+
+// 超级块中的挂载状态，干净时空闲计数与位图一致，否则挂载时要根据位图重新统计
+#define FS_DIRTY 0
+#define FS_CLEAN 1
+
+// 分配组数的上限，组描述符都放在超级块中
+#define MAX_GROUPS 32
+
+/*
+分配组描述符
+第 g 组拥有块位图中从 g * blocks_per_group 开始的一段和 inode 号从 g * inodes_per_group 开始的一段，
+以及 inode 数组中对应的扇区，位图和 inode 数组仍然各自连续存放
+*/
+typedef struct {
+	// 组内空闲的块数和 inode 数
+	uint32_t free_blocks;
+	uint32_t free_inodes;
+	// 组内 inode 数组开头已经初始化过的扇区数，之后的扇区在第一次写入 inode 时才清零
+	uint32_t inode_table_inited;
+} __attribute__ ((packed)) group_desc;
+
 /* 超级块结构体 */
 struct super_block {
 	// 用来标识文件系统类型
@@ -25,14 +55,36 @@ struct super_block {
 	uint32_t inode_table_lba;
 	// inode 结点表占用的扇区数量
 	uint32_t inode_table_sects;
+	// 版本 2 之前 inode 结点表开头已经初始化过的扇区数，之后改为记录在各组的描述符中
+	uint32_t inode_table_inited;
+	// 日志区起始扇区 lba 地址
+	uint32_t journal_lba;
+	// 日志区占用的扇区数量
+	uint32_t journal_sects;
 	// 数据区开始的第一个扇区号
 	uint32_t data_start_lba;
 	// 根目录所在的 inode 号
 	uint32_t root_inode_no;
 	// 目录项大小
 	uint32_t dir_entry_size;
-	// 加上 460 字节，以凑够 512 字节的大小
-	uint8_t pad[460];
+	// 空闲的块数和 inode 数，分配和回收时维护
+	uint32_t free_block_cnt;
+	uint32_t free_inode_cnt;
+	// 挂载状态，FS_DIRTY 或 FS_CLEAN
+	uint32_t state;
+	// 磁盘格式的版本，旧版本的分区这里是 0
+	uint32_t version;
+	// 分配组数，每组的块数和 inode 数，块数是一个位图扇区的位数的整数倍
+	uint32_t group_cnt;
+	uint32_t blocks_per_group;
+	uint32_t inodes_per_group;
+	group_desc groups[MAX_GROUPS];
+	// 加上 36 字节，以凑够 512 字节的大小
+	uint8_t pad[36];
 } __attribute__ ((packed));
 
+// 数据块 (块位图下标) 和 inode 所在的分配组
+#define BLOCK_GROUP(sb, bit_idx) ((bit_idx) / (sb)->blocks_per_group)
+#define INODE_GROUP(sb, inode_no) ((inode_no) / (sb)->inodes_per_group)
+
 #endif
\ No newline at end of file
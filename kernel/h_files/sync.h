@@ -23,12 +23,36 @@ typedef struct {
 	uint32_t holder_repeat_nr;
 } lock;
 
+/*
+读写锁，读者之间共享，写者独占
+有写者等待时新的读者也要等待，避免写者饿死；持有写锁的任务可以重复申请读锁或写锁
+*/
+typedef struct {
+	// 持有读锁的任务数
+	uint32_t readers;
+	// 写锁当前的持有者和它重复申请的次数
+	task_struct* writer;
+	uint32_t writer_repeat_nr;
+	// 正在等待的写者数
+	uint32_t writers_waiting;
+	// 所有等待的任务，锁被释放时全部唤醒，各自重新检查条件
+	struct list waiters;
+} rwlock;
+
 
 void sema_init(semaphore*, uint8_t);
 void lock_init(lock*);
 void sema_down(semaphore*);
+bool sema_down_timeout(semaphore*, uint32_t);
 void sema_up(semaphore*);
 void lock_acquire(lock*);
 void lock_release(lock*);
+void wait_queue_block(struct list*);
+void wait_queue_wake_all(struct list*);
+void rwlock_init(rwlock*);
+void rwlock_read_acquire(rwlock*);
+void rwlock_read_release(rwlock*);
+void rwlock_write_acquire(rwlock*);
+void rwlock_write_release(rwlock*);
 
 #endif
\ No newline at end of file
@@ -19,7 +19,17 @@ typedef enum {
 	SYS_CLOSEDIR,
 	SYS_READDIR,
 	SYS_REWINDDIR,
-	SYS_UNLINK
+	SYS_UNLINK,
+	SYS_MMAP,
+	SYS_MUNMAP,
+	SYS_PREAD,
+	SYS_PWRITE,
+	SYS_READV,
+	SYS_WRITEV,
+	SYS_COPY_FILE_RANGE,
+	SYS_FSYNC,
+	SYS_SYNC,
+	SYS_STATFS
 } stscall_nr;
 
 uint32_t getpid(void);
@@ -50,4 +60,21 @@ void rewinddir(dir* dir);
 
 int32_t unlink(const char* pathname);
 
+void* mmap(uint32_t length, uint8_t prot, uint8_t flags, int32_t fd, uint32_t offset);
+
+int32_t munmap(void* addr, uint32_t length);
+
+int32_t pread(int32_t fd, void* buf, uint32_t count, uint32_t offset);
+
+int32_t pwrite(int32_t fd, const void* buf, uint32_t count, uint32_t offset);
+
+int32_t readv(int32_t fd, const iovec* iov, uint32_t iovcnt);
+
+int32_t writev(int32_t fd, const iovec* iov, uint32_t iovcnt);
+
+int32_t copy_file_range(int32_t fd_in, int32_t fd_out, uint32_t count);
+int32_t fsync(int32_t fd);
+void sync(void);
+int32_t statfs(const char* path, fs_stat* buf);
+
 #endif
\ No newline at end of file
@@ -6,7 +6,10 @@
 #include "memory.h"
 
 #define PG_SIZE 4096
+// pcb 中内联的文件描述符数，打开更多文件时描述符表换到内核堆中
 #define MAX_FILES_OPEN_PER_PROC 8
+// 每个任务的文件描述符表可以增长到的项数上限
+#define MAX_FD_TABLE_SIZE 1024
 
 /* 自定义的通用函数类型，将被用在很多线程函数中作为参数类型 */
 typedef void thread_func(void*);
@@ -77,8 +80,13 @@ typedef struct __task_struct {
 	uint32_t ticks;
 	// 任务从上 cpu 运行后至今一共占用了多少 ticks，只增不减
 	uint32_t elapsed_ticks;
-	// 一个任务打开的文件描述符数组，最大数量定义为下面的宏，内部元素是当前描述符在全局 file_table 的下标
-	int32_t fd_table[MAX_FILES_OPEN_PER_PROC];
+	// 一个任务打开的文件描述符数组，内部元素是当前描述符在全局 file_table 的下标，空闲为 -1
+	// 起初指向下面的 fd_inline，不够用时换成内核堆中成倍增长的数组
+	int32_t* fd_table;
+	uint32_t fd_table_size;
+	// 下标小于它的描述符都已被占用，分配描述符时从这里开始找
+	uint32_t fd_free_hint;
+	int32_t fd_inline[MAX_FILES_OPEN_PER_PROC];
 	// 其他 list 中的结点标记，用于表示此任务当前的状态
 	// 比如若该标记在 thread_ready_list 中则表示当前任务出于就绪状态
 	struct list_elem general_tag;
@@ -91,6 +99,10 @@ typedef struct __task_struct {
 	virtual_addr userprog_vaddr;
 	// 进程自己的内存块描述符
 	mem_block_desc u_block_desc[DESC_CNT];
+	// 进程通过 mmap 建立的文件映射区域，元素为 vm_area
+	struct list vm_areas;
+	// 任务当前持有的读锁数，所有 rwlock 合计，见 rwlock_read_acquire
+	uint32_t rwlock_reads;
 	// 魔数，用于检测 PCB 信息是否被损坏
 	uint32_t stack_magic;
 } task_struct;
@@ -2,7 +2,25 @@
 #define __TIMER_H
 
 #include "stdint.h"
+#include "list.h"
+
+// 时钟中断的频率，每秒 100 次，即每个 tick 为 10ms
+#define IRQ0_FREQUENCY 100
+
+/* 以毫秒为单位的时间换算成 ticks，向上取整 */
+#define MS2TICKS(m_seconds) DIV_ROUND_UP(m_seconds, 1000 / IRQ0_FREQUENCY)
+
+/* 定时事件，到期后在时钟中断中调用 func(arg)，调用时处于关中断状态 */
+typedef struct {
+	struct list_elem tag;
+	// 到期时的 ticks
+	uint32_t expire_tick;
+	void (*func)(void* arg);
+	void* arg;
+} timer_event;
 
 void mtime_sleep(uint32_t m_seconds);
+void timer_add(timer_event* ev, uint32_t after_ticks);
+void timer_del(timer_event* ev);
 
 #endif
\ No newline at end of file
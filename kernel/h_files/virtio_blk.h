@@ -0,0 +1,19 @@
+#ifndef __KERNEL_VIRTIO_BLK_H
+#define __KERNEL_VIRTIO_BLK_H
+
+#include "ide.h"
+
+// 最多驱动的 virtio 硬盘数
+#define VIRTIO_BLK_MAX_DISKS 4
+// 每个请求槽占用的描述符数：请求头、至多 14 段数据缓冲区、状态字节
+#define VIRTIO_DESCS_PER_SLOT 16
+// 最多的请求槽数
+#define VIRTIO_BLK_MAX_SLOTS 32
+// 一个槽最多读写的扇区数，32KB 的缓冲区跨越的物理页不会超过 9 个
+#define VIRTIO_MAX_SECTS_PER_CMD 64
+// 一个请求最多同时占用的槽数
+#define VIRTIO_SLOTS_PER_REQ 8
+
+void virtio_blk_init(void);
+
+#endif
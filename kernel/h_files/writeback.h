@@ -0,0 +1,19 @@
+#ifndef __WRITEBACK_H
+#define __WRITEBACK_H
+
+#include "ide.h"
+#include "stdint.h"
+
+// 后台线程每次醒来的间隔，单位为毫秒
+#define WRITEBACK_INTERVAL 500
+// 延迟分配缓冲中的数据最多在内存中停留的时间，单位为毫秒
+#define WRITEBACK_EXPIRE 3000
+// 一个分区中最多同时存在的脏文件数，超过时写者自己从最早变脏的文件开始写回
+#define WRITEBACK_DIRTY_MAX 8
+
+void writeback_init(partition* part);
+void writeback_inodes(partition* part, bool all);
+void writeback_sync(partition* part);
+void writeback_daemon(void* arg);
+
+#endif
@@ -0,0 +1,343 @@
+/*
+在宿主机上生成带有一个已格式化分区的硬盘镜像，内核挂载时发现文件系统已经存在，就不用在启动时格式化
+用法：mkfs <镜像文件> <大小，单位为 MB> [要放进根目录的文件 ...]
+分区的布局和 fs.c 中的 partition_format 相同，修改磁盘格式时两边要一起修改
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+// 用宿主机的 stdint.h 代替内核的，两者的 64 位类型定义不同
+#define __LIB_STDINT_H
+#include "super_block.h"
+
+/* 下面的常量和结构体与内核头文件中的一致，那些头文件依赖内核的其他部分，不能在宿主机上直接包含 */
+
+// fs.h
+#define SECTORS_PER_INODE 16
+#define MIN_FILES_PER_PART 4096
+#define MAX_FILES_PER_PART 65536
+#define BITS_PER_SECTOR 4096
+#define SECTOR_SIZE 512
+#define BLOCK_SIZE SECTOR_SIZE
+#define DIV_ROUND_UP(X, STEP) (((X) + (STEP) - 1) / (STEP))
+enum { FT_UNKNOWN, FT_REGULAR, FT_DIRECTORY };
+// journal.h
+#define JOURNAL_SECTS 128
+// dir.h
+#define MAX_FILE_NAME_LEN 16
+#define DIR_ENTRYS_PER_BLOCK (BLOCK_SIZE / sizeof(dir_entry))
+#define DIR_INDEX_THRESHOLD 4
+// inode.h
+#define INODE_EXTENTS 4
+#define INODE_INLINE 1
+#define INODE_INLINE_SIZE 56
+
+// 硬盘的几何参数，与 bximage 生成的镜像相同，bochs 按镜像大小推算柱面数
+#define DISK_HEADS 16
+#define DISK_SPT 63
+// 分区的起始扇区
+#define PART_START_LBA 2048
+// 分区表中的分区类型，内核只要求它不为 0 且不是扩展分区
+#define PART_FS_TYPE 0x83
+
+typedef struct {
+	uint32_t ee_block;
+	uint32_t ee_start;
+	uint32_t ee_len;
+} __attribute__((packed)) extent;
+
+typedef struct {
+	uint32_t i_size;
+	uint8_t i_flags;
+	uint8_t i_extent_depth;
+	uint16_t i_extent_cnt;
+	union {
+		extent i_extents[INODE_EXTENTS];
+		uint8_t i_inline[INODE_INLINE_SIZE];
+	};
+} __attribute__((packed)) disk_inode;
+
+typedef struct {
+	char filename[MAX_FILE_NAME_LEN];
+	uint32_t i_no;
+	uint32_t f_type;
+} dir_entry;
+
+_Static_assert(sizeof(struct super_block) == SECTOR_SIZE, "super_block must fill a sector");
+_Static_assert(sizeof(disk_inode) == 64, "disk_inode must match inode.h");
+
+#define INODES_PER_SECTOR (SECTOR_SIZE / sizeof(disk_inode))
+_Static_assert(sizeof(dir_entry) == 24, "dir_entry must match dir.h");
+
+/* MBR 中的分区表项 */
+typedef struct {
+	uint8_t bootable;
+	uint8_t start_head;
+	uint8_t start_sec;
+	uint8_t start_chs;
+	uint8_t fs_type;
+	uint8_t end_head;
+	uint8_t end_sec;
+	uint8_t end_chs;
+	uint32_t start_lba;
+	uint32_t sec_cnt;
+} __attribute__((packed)) partition_table_entry;
+
+/* 要放进根目录的文件 */
+typedef struct {
+	const char* name;
+	uint8_t* data;
+	uint32_t size;
+} host_file;
+
+static int img_fd;
+
+static void die(const char* msg, const char* arg) {
+	fprintf(stderr, "mkfs: %s%s\n", msg, arg);
+	exit(1);
+}
+
+/* 把 buf 中的 cnt 个扇区写入镜像的 lba 处 */
+static void write_sectors(uint32_t lba, const void* buf, uint32_t cnt) {
+	ssize_t len = (ssize_t)cnt * SECTOR_SIZE;
+	if (pwrite(img_fd, buf, len, (off_t)lba * SECTOR_SIZE) != len) {
+		die("write image failed", "");
+	}
+}
+
+/* 读入宿主机上的文件 path，文件名取路径的最后一部分 */
+static void load_host_file(const char* path, host_file* f) {
+	const char* slash = strrchr(path, '/');
+	f->name = slash ? slash + 1 : path;
+	// 文件名要留出结尾的 0
+	if (strlen(f->name) == 0 || strlen(f->name) >= MAX_FILE_NAME_LEN) {
+		die("file name is empty or too long: ", f->name);
+	}
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		die("can not open ", path);
+	}
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	f->size = size;
+	f->data = calloc(DIV_ROUND_UP(size, BLOCK_SIZE) + 1, BLOCK_SIZE);
+	if (f->data == NULL || fread(f->data, 1, size, fp) != (size_t)size) {
+		die("can not read ", path);
+	}
+	fclose(fp);
+}
+
+/* 与 fs.c 中的 group_size 相同 */
+static uint32_t group_size(uint32_t group, uint32_t per_group, uint32_t total) {
+	if (group * per_group >= total) {
+		return 0;
+	}
+	uint32_t left = total - group * per_group;
+	return left < per_group ? left : per_group;
+}
+
+/* 与 fs.c 中的 group_layout 相同 */
+static void group_layout(struct super_block* sb, uint32_t block_cnt) {
+	uint32_t bitmap_sects = DIV_ROUND_UP(block_cnt, BITS_PER_SECTOR);
+	sb->blocks_per_group = DIV_ROUND_UP(bitmap_sects, MAX_GROUPS) * BITS_PER_SECTOR;
+	sb->group_cnt = DIV_ROUND_UP(block_cnt, sb->blocks_per_group);
+	sb->inodes_per_group = DIV_ROUND_UP(
+		DIV_ROUND_UP(sb->inode_cnt, sb->group_cnt), INODES_PER_SECTOR
+	) * INODES_PER_SECTOR;
+}
+
+/* 在分区中建立文件系统，files 中的 file_cnt 个文件被放进根目录 */
+static void format_partition(uint32_t part_lba, uint32_t part_sects, host_file* files, uint32_t file_cnt) {
+	uint32_t inode_cnt = part_sects / SECTORS_PER_INODE;
+	if (inode_cnt < MIN_FILES_PER_PART) {
+		inode_cnt = MIN_FILES_PER_PART;
+	} else if (inode_cnt > MAX_FILES_PER_PART) {
+		inode_cnt = MAX_FILES_PER_PART;
+	}
+	inode_cnt = DIV_ROUND_UP(inode_cnt, BITS_PER_SECTOR) * BITS_PER_SECTOR;
+	uint32_t inode_bitmap_sects = inode_cnt / BITS_PER_SECTOR;
+	uint32_t inode_table_sects = DIV_ROUND_UP(sizeof(disk_inode) * inode_cnt, SECTOR_SIZE);
+	uint32_t used_sects = 2 + inode_bitmap_sects + inode_table_sects + JOURNAL_SECTS;
+	if (part_sects <= used_sects) {
+		die("partition is too small", "");
+	}
+	uint32_t free_sects = part_sects - used_sects;
+	uint32_t block_bitmap_sects = DIV_ROUND_UP(free_sects, BITS_PER_SECTOR);
+	uint32_t block_bitmap_bit_len = free_sects - block_bitmap_sects;
+	block_bitmap_sects = DIV_ROUND_UP(block_bitmap_bit_len, BITS_PER_SECTOR);
+
+	struct super_block sb;
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = FS_MAGIC;
+	sb.sec_cnt = part_sects;
+	sb.inode_cnt = inode_cnt;
+	sb.part_lba_base = part_lba;
+	sb.block_bitmap_lba = part_lba + 2;
+	sb.block_bitmap_sects = block_bitmap_sects;
+	sb.inode_bitmap_lba = sb.block_bitmap_lba + block_bitmap_sects;
+	sb.inode_bitmap_sects = inode_bitmap_sects;
+	sb.inode_table_lba = sb.inode_bitmap_lba + inode_bitmap_sects;
+	sb.inode_table_sects = inode_table_sects;
+	sb.journal_lba = sb.inode_table_lba + inode_table_sects;
+	sb.journal_sects = JOURNAL_SECTS;
+	sb.data_start_lba = sb.journal_lba + JOURNAL_SECTS;
+	sb.root_inode_no = 0;
+	sb.dir_entry_size = sizeof(dir_entry);
+	group_layout(&sb, block_bitmap_bit_len);
+
+	// 根目录保持为线性目录，块数不能超过转换为索引目录的阈值
+	uint32_t dir_entries = file_cnt + 2;
+	uint32_t root_blocks = DIV_ROUND_UP(dir_entries, DIR_ENTRYS_PER_BLOCK);
+	if (root_blocks > DIR_INDEX_THRESHOLD) {
+		die("too many files for the root directory", "");
+	}
+	// 所有文件都在根目录中，它们的 inode 与根目录一样放在第 0 组
+	if (file_cnt + 1 > sb.inodes_per_group) {
+		die("too many files for the first inode group", "");
+	}
+
+	uint8_t* inode_bitmap = calloc(inode_bitmap_sects, SECTOR_SIZE);
+	uint8_t* block_bitmap = calloc(block_bitmap_sects, SECTOR_SIZE);
+	disk_inode* inode_table = calloc(inode_table_sects, SECTOR_SIZE);
+	dir_entry* root_dir = calloc(root_blocks, BLOCK_SIZE);
+	if (!inode_bitmap || !block_bitmap || !inode_table || !root_dir) {
+		die("out of memory", "");
+	}
+
+	// 根目录占用第 0 个 inode 和数据区开头的几块，其他文件的数据紧随其后，每个文件一段 extent，从第 0 组开始放
+	uint32_t next_block = 0, idx;
+	disk_inode* in = &inode_table[0];
+	in->i_size = dir_entries * sizeof(dir_entry);
+	in->i_extent_cnt = 1;
+	in->i_extents[0].ee_start = sb.data_start_lba;
+	in->i_extents[0].ee_len = root_blocks;
+	next_block += root_blocks;
+
+	dir_entry* p_de = root_dir;
+	strcpy(p_de->filename, ".");
+	p_de->f_type = FT_DIRECTORY;
+	p_de++;
+	strcpy(p_de->filename, "..");
+	p_de->f_type = FT_DIRECTORY;
+
+	for (idx = 0; idx < file_cnt; idx++) {
+		uint32_t blocks = DIV_ROUND_UP(files[idx].size, BLOCK_SIZE);
+		if (next_block + blocks > block_bitmap_bit_len) {
+			die("no space left for ", files[idx].name);
+		}
+		in = &inode_table[idx + 1];
+		in->i_size = files[idx].size;
+		if (files[idx].size <= INODE_INLINE_SIZE) {
+			// 小文件与内核中新建的文件一样内联在 inode 中，不占用数据块
+			in->i_flags = INODE_INLINE;
+			memcpy(in->i_inline, files[idx].data, files[idx].size);
+			blocks = 0;
+		} else {
+			in->i_extent_cnt = 1;
+			in->i_extents[0].ee_start = sb.data_start_lba + next_block;
+			in->i_extents[0].ee_len = blocks;
+			write_sectors(sb.data_start_lba + next_block, files[idx].data, blocks);
+		}
+		next_block += blocks;
+
+		// 每块末尾留给索引目录的 8 字节不使用
+		p_de = (dir_entry*)((uint8_t*)root_dir + (idx + 2) / DIR_ENTRYS_PER_BLOCK * BLOCK_SIZE)
+			+ (idx + 2) % DIR_ENTRYS_PER_BLOCK;
+		strcpy(p_de->filename, files[idx].name);
+		p_de->i_no = idx + 1;
+		p_de->f_type = FT_REGULAR;
+	}
+
+	for (idx = 0; idx < file_cnt + 1; idx++) {
+		inode_bitmap[idx / 8] |= 1 << (idx % 8);
+	}
+	for (idx = 0; idx < next_block; idx++) {
+		block_bitmap[idx / 8] |= 1 << (idx % 8);
+	}
+	// 位图最后一个扇区中超出数据区的位置 1，防止分配到分区之外的块
+	for (idx = block_bitmap_bit_len; idx < block_bitmap_sects * BITS_PER_SECTOR; idx++) {
+		block_bitmap[idx / 8] |= 1 << (idx % 8);
+	}
+	sb.free_block_cnt = block_bitmap_bit_len - next_block;
+	sb.free_inode_cnt = inode_cnt - (file_cnt + 1);
+	for (idx = 0; idx < sb.group_cnt; idx++) {
+		uint32_t group_start = idx * sb.blocks_per_group;
+		uint32_t group_blocks = group_size(idx, sb.blocks_per_group, block_bitmap_bit_len);
+		uint32_t used = next_block > group_start ? next_block - group_start : 0;
+		sb.groups[idx].free_blocks = group_blocks - (used < group_blocks ? used : group_blocks);
+		sb.groups[idx].free_inodes = group_size(idx, sb.inodes_per_group, inode_cnt);
+	}
+	sb.groups[0].free_inodes -= file_cnt + 1;
+	// 只写入用到的 inode 所在的扇区，其余的由内核在第一次写入 inode 时清零
+	sb.groups[0].inode_table_inited = DIV_ROUND_UP(file_cnt + 1, INODES_PER_SECTOR);
+	sb.state = FS_CLEAN;
+	sb.version = FS_VERSION;
+
+	// 日志区在镜像创建时已经是 0，挂载时不会重放
+	write_sectors(part_lba + 1, &sb, 1);
+	write_sectors(sb.block_bitmap_lba, block_bitmap, block_bitmap_sects);
+	write_sectors(sb.inode_bitmap_lba, inode_bitmap, inode_bitmap_sects);
+	write_sectors(sb.inode_table_lba, inode_table, sb.groups[0].inode_table_inited);
+	write_sectors(sb.data_start_lba, root_dir, root_blocks);
+
+	printf(
+		"mkfs: %u sectors, %u inodes, %u free blocks, %u files\n",
+		part_sects, inode_cnt, sb.free_block_cnt, file_cnt
+	);
+	free(inode_bitmap);
+	free(block_bitmap);
+	free(inode_table);
+	free(root_dir);
+}
+
+/* 在 MBR 中写入只有一个主分区的分区表 */
+static void write_mbr(uint32_t part_lba, uint32_t part_sects) {
+	uint8_t mbr[SECTOR_SIZE];
+	memset(mbr, 0, sizeof(mbr));
+	partition_table_entry* p = (partition_table_entry*)(mbr + 446);
+	// 内核只使用 LBA，CHS 字段填成表示超出范围的值
+	p->start_head = p->end_head = 0xfe;
+	p->start_sec = p->end_sec = 0xff;
+	p->start_chs = p->end_chs = 0xff;
+	p->fs_type = PART_FS_TYPE;
+	p->start_lba = part_lba;
+	p->sec_cnt = part_sects;
+	mbr[510] = 0x55;
+	mbr[511] = 0xaa;
+	write_sectors(0, mbr, 1);
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		fprintf(stderr, "usage: %s <image> <size in MB> [file ...]\n", argv[0]);
+		return 1;
+	}
+	uint32_t size_mb = strtoul(argv[2], NULL, 10);
+	// 按整柱面取整
+	uint32_t disk_sects = size_mb * 2048 / (DISK_HEADS * DISK_SPT) * (DISK_HEADS * DISK_SPT);
+	if (disk_sects <= PART_START_LBA) {
+		die("image is too small", "");
+	}
+
+	uint32_t file_cnt = argc - 3, idx;
+	host_file* files = calloc(file_cnt + 1, sizeof(host_file));
+	for (idx = 0; idx < file_cnt; idx++) {
+		load_host_file(argv[idx + 3], &files[idx]);
+	}
+
+	img_fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (img_fd == -1) {
+		die("can not create ", argv[1]);
+	}
+	if (ftruncate(img_fd, (off_t)disk_sects * SECTOR_SIZE) == -1) {
+		die("can not resize ", argv[1]);
+	}
+	write_mbr(PART_START_LBA, disk_sects - PART_START_LBA);
+	format_partition(PART_START_LBA, disk_sects - PART_START_LBA, files, file_cnt);
+	close(img_fd);
+	return 0;
+}